@@ -6,6 +6,10 @@ Bit field manipulation and bit hacks.
 
 Everything in here operates on the yarn_word_t type. Any provided index will be trunk to
 an appropriate size.
+
+Bitfields that are larger then a single word are represented as an array of words where
+the bit at index i lives in the word i / YARN_WORD_BIT_SIZE. The max value of the
+bitfield must be a power of two so that the indexes can be computed with a mask.
  */
 
 
@@ -16,12 +20,21 @@ an appropriate size.
 #include "yarn/types.h"
 #include <assert.h>
 
-#define YARN_BIT_INDEX(value,max) (assert(max!=0), (value) % (max))
-//#define YARN_BIT_INDEX(value,max) ((value) % (max))
+#define YARN_BIT_INDEX(value,max)					\
+  (assert((max) != 0 && ((max) & ((max)-1)) == 0), (value) & ((max)-1))
+//#define YARN_BIT_INDEX(value,max) ((value) & ((max)-1))
 #define YARN_BIT_MASK(index,max) (((yarn_word_t)1) << YARN_BIT_INDEX(index, max))
 #define YARN_BIT_SET(word,index,max) ((word) | YARN_BIT_MASK(index, max))
 #define YARN_BIT_CLEAR(word,index,max) ((word) & ~YARN_BIT_MASK(index, max))
 
+//! Number of words required to hold a multi-word bitfield.
+#define YARN_BIT_WORDS(max) (((max) + YARN_WORD_BIT_SIZE - 1) / YARN_WORD_BIT_SIZE)
+//! Word of a multi-word bitfield that contains the given index.
+#define YARN_BIT_WORD(index,max) (YARN_BIT_INDEX(index, max) / YARN_WORD_BIT_SIZE)
+//! Mask of the given index within its word of a multi-word bitfield.
+#define YARN_BIT_WORD_MASK(index,max)					\
+  (((yarn_word_t)1) << (YARN_BIT_INDEX(index, max) % YARN_WORD_BIT_SIZE))
+
 
 inline yarn_word_t yarn_bit_mask_range (yarn_word_t first, 
 					yarn_word_t second, 
@@ -40,6 +53,53 @@ inline yarn_word_t yarn_bit_mask_range (yarn_word_t first,
 }
 
 
+/*!
+Returns the mask of every bit of the non-wrapping range [first, last) that falls within
+the word at word_index.
+ */
+inline yarn_word_t yarn_bit_mask_linear (yarn_word_t first, 
+					 yarn_word_t last, 
+					 yarn_word_t word_index)
+{
+  const yarn_word_t base = word_index * YARN_WORD_BIT_SIZE;
+
+  if (first >= last || last <= base || first >= base + YARN_WORD_BIT_SIZE) {
+    return 0;
+  }
+
+  yarn_word_t mask = ((yarn_word_t)-1) << (first > base ? first - base : 0);
+  if (last - base < YARN_WORD_BIT_SIZE) {
+    mask &= (((yarn_word_t)1) << (last - base)) - 1;
+  }
+  return mask;
+}
+
+/*!
+Multi-word version of yarn_bit_mask_range. Returns the portion of the [first, second) 
+range that falls within the word at word_index of a bitfield of max bits. Follows the 
+same wrapping conventions as yarn_bit_mask_range.
+ */
+inline yarn_word_t yarn_bit_mask_range_word (yarn_word_t first, 
+					     yarn_word_t second, 
+					     yarn_word_t max,
+					     yarn_word_t word_index)
+{
+  const yarn_word_t a = YARN_BIT_INDEX(first, max);
+  const yarn_word_t b = YARN_BIT_INDEX(second, max);
+
+  if (a < b) {
+    return yarn_bit_mask_linear(a, b, word_index);
+  }
+  else if (a > b || first < second) {
+    return yarn_bit_mask_linear(a, max, word_index) | 
+      yarn_bit_mask_linear(0, b, word_index);
+  }
+  else {
+    return 0;
+  }
+}
+
+
 /*!
 \todo Probably won't be inlined because of the table. Fix it.
 
@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <setjmp.h>
 
 
 #define YARN_DBG 0
@@ -30,11 +32,39 @@
 
 struct addr_info {
   void* addr;
-  yarn_atomic_var flags; // read and write flags packed with yarn_bit_pack
 
   yarn_atomic_var last_commit;
   pthread_mutex_t commit_lock;
 
+  // Saturating count of the rollbacks caused by writes to the address. See sync_load.
+  yarn_atomic_var conflicts;
+
+  // Last epoch that wrote the address directly to memory as the head. See sync_load.
+  yarn_atomic_var head_store;
+
+  // Stride predictor trained on the committed values. Protected by commit_lock.
+  volatile yarn_word_t pred_epoch;
+  volatile yarn_word_t pred_value;
+  volatile yarn_word_t pred_stride;
+  volatile yarn_word_t pred_hits;
+
+  // Multi-word bitfields of g_epoch_words words each.
+  yarn_atomic_var* read_flags;
+  yarn_atomic_var* write_flags;
+  yarn_atomic_var* predict_flags;
+
+  // Epochs that were rolled back because of a write to the address. See restart_epoch.
+  yarn_atomic_var* violation_flags;
+
+  // Value read by each epoch that must still be in memory when the epoch commits. Filled
+  // in by the predictions and by the loads of lazy epochs. Only valid if the predict 
+  // flag is set.
+  volatile yarn_word_t* predictions;
+
+  // Accesses of each lazy epoch. Only touched by the owner of the epoch until it's done
+  // so the other epochs never see them before the commit. See load_lazy.
+  volatile uint8_t* lazy_access;
+
   struct addr_info** info_list;
   volatile yarn_word_t write_buffer[];
 };
@@ -49,7 +79,16 @@ static struct yarn_pmem* g_addr_info_alloc;
 //! \todo Probably won't only hold epochs.
 static struct yarn_pstore* g_epoch_store = NULL;
 
+// Buffer used by each thread to merge the write sets of a commit batch.
+struct batch_buffer {
+  yarn_word_t capacity;
+  struct addr_info* infos[];
+};
+
+static struct yarn_pstore* g_batch_store = NULL;
+
 static yarn_word_t g_epoch_max;
+static yarn_word_t g_epoch_words;
 
 // Heads for the addr_info linked list of each epoch.
 static struct addr_info** g_info_list;
@@ -58,6 +97,111 @@ static struct addr_info** g_info_list;
 static struct addr_info** g_info_index;
 static size_t g_info_index_size;
 
+// Multi-word bitfields of the epochs that produced the value of each index. 
+// See yarn_dep_produce. The extra bitfield at the end flags the epochs that produced 
+// anything so that the others don't have to look at every index.
+static yarn_atomic_var* g_channel_flags;
+
+
+// Number of partitions a write set is split into for a parallel commit.
+#define YARN_DEP_COMMIT_PARTS 8
+// Write sets smaller then this are committed by a single thread.
+#define YARN_DEP_COMMIT_SPLIT 64
+// Granularity of the partitions (cache line).
+#define YARN_DEP_COMMIT_LINE 64
+// Initial number of addr_info that the batch buffer of a thread can hold.
+#define YARN_DEP_BATCH_SIZE 256
+
+// Rollbacks caused by an address before its loads start waiting on the older epochs.
+#define YARN_DEP_SYNC_THRESHOLD 2
+// Upper bound of the conflict count. Also the number of quiet loads before it stops.
+#define YARN_DEP_SYNC_MAX 8
+
+// Busy polls of a channel before the consumer starts yielding its time slice.
+#define YARN_DEP_CHANNEL_SPIN 256
+
+// Consecutive commits that must follow the stride before it's used for predictions.
+#define YARN_DEP_PREDICT_THRESHOLD 2
+#define YARN_DEP_PREDICT_MAX 16
+
+// Checkpoints kept per epoch. Past that, the last one is moved forward.
+#define YARN_DEP_CHECKPOINT_MAX 8
+// Initial size of the undo log of each epoch.
+#define YARN_DEP_UNDO_SIZE 64
+
+/*
+Write set of an epoch that can be committed by multiple threads. The addr_info are
+partitioned by cache line so that two helpers never write to the same line.
+ */
+struct commit_job {
+  yarn_word_t epoch;
+
+  // Index of the next partition to commit. YARN_DEP_COMMIT_PARTS or more means closed.
+  yarn_atomic_var next_part;
+  yarn_atomic_var parts_done;
+
+  struct addr_info* parts[YARN_DEP_COMMIT_PARTS];
+};
+
+// One job per epoch slot.
+static struct commit_job* g_commit_jobs;
+
+/*
+Undo log entry for a store to an address that the epoch accessed before its last 
+checkpoint. The addresses first accessed after a checkpoint are simply dropped.
+ */
+struct undo_entry {
+  struct addr_info* info;
+  bool is_written;
+  yarn_word_t value;
+};
+
+/*
+Lets an epoch resume its execution from the point where it took a checkpoint. The info 
+list only grows while the epoch executes so its head at the time of the checkpoint marks
+the addresses that were accessed before it. Only touched by the owner of the epoch.
+ */
+struct checkpoint {
+  jmp_buf context;
+  struct addr_info* watermark;
+  size_t undo_size;
+};
+
+struct checkpoint_set {
+  yarn_word_t count;
+  bool is_restartable;
+  struct checkpoint checkpoints[YARN_DEP_CHECKPOINT_MAX];
+
+  struct undo_entry* undo;
+  size_t undo_size;
+  size_t undo_capacity;
+};
+
+// One set per epoch slot.
+static struct checkpoint_set* g_checkpoints;
+
+// Number of jobs currently open. Lets the helpers bail out early.
+static yarn_atomic_var g_commit_pending;
+
+// Lets the head epoch bypass the write buffers.
+static bool g_direct_head;
+
+// Epochs only see their own writes and conflicts are detected on commit.
+static bool g_unordered;
+
+// Stale loads are replaced by predicted values. See yarn_dep_set_prediction.
+static bool g_predict;
+
+// Conflicts are detected when the epochs commit. See yarn_dep_set_lazy.
+static bool g_lazy;
+
+// Number of addresses that each epoch has to validate. Indexed by epoch slot.
+static yarn_atomic_var* g_predict_counts;
+
+// Bits of addr_info.lazy_access.
+#define YARN_DEP_LAZY_READ 0x1
+#define YARN_DEP_LAZY_WRITE 0x2
+
 
 
 // Prototypes
@@ -71,6 +215,11 @@ static inline yarn_word_t index_to_epoch_before (yarn_word_t base_epoch,
 						 yarn_word_t index);
 
 
+static inline struct addr_info* find_map_addr_info (yarn_word_t pool_id, 
+						    const void* addr);
+static inline struct addr_info* find_index_addr_info (yarn_word_t pool_id,
+						      yarn_word_t index_id,
+						      const void* addr);
 static inline struct addr_info* get_map_addr_info (yarn_word_t pool_id, 
 						   const void* addr);
 static inline struct addr_info* get_index_addr_info (yarn_word_t pool_id,
@@ -81,16 +230,85 @@ static inline void info_list_push (yarn_word_t epoch, struct addr_info* info);
 static inline void info_list_push_if_new (yarn_word_t epoch, struct addr_info* info);
 static inline struct addr_info* info_list_pop (yarn_word_t epoch);
 
-static inline void dep_violation_check (yarn_word_t epoch, yarn_word_t read_flags);
-
-static inline yarn_word_t store_to_wbuf (struct addr_info* info, yarn_word_t epoch, 
-					 const void* src, void* dest);
+static inline void commit_info (struct addr_info* info, yarn_word_t epoch);
+static inline void commit_info_batch (struct addr_info* info, 
+				      yarn_word_t first_epoch, 
+				      yarn_word_t count);
+static inline void commit_part (struct commit_job* job, yarn_word_t part);
+static inline void reset_commit_jobs (void);
+
+static inline void dep_violation_check (struct addr_info* info, 
+					yarn_word_t epoch, 
+					yarn_word_t value);
+static inline void add_conflict (struct addr_info* info);
+static inline void add_violation (struct addr_info* info, yarn_word_t epoch);
+static inline bool is_executing (yarn_word_t producer);
+static inline void sync_load (struct addr_info* info, yarn_word_t epoch);
+static inline void invalidate_readers (struct addr_info* info, yarn_word_t epoch);
+
+static inline bool predict_value (struct addr_info* info, 
+				  yarn_word_t epoch, 
+				  yarn_word_t* value);
+static inline bool is_predicted (struct addr_info* info, 
+				 yarn_word_t epoch, 
+				 yarn_word_t writer,
+				 yarn_word_t value);
+static inline void train_predictor (struct addr_info* info, 
+				    yarn_word_t epoch, 
+				    yarn_word_t value);
+
+static inline yarn_atomic_var* get_channel_flags (yarn_word_t index_id);
+static inline yarn_atomic_var* get_producer_flags (void);
+static inline bool alloc_channels (yarn_word_t index_size);
+static inline void clear_channels (yarn_word_t epoch);
+static inline void wait_channel (yarn_word_t index_id, yarn_word_t epoch);
+
+static inline void reset_checkpoints (yarn_word_t epoch);
+static inline void restart_check (yarn_word_t epoch);
+static inline bool find_restart_point (yarn_word_t epoch, 
+				       struct checkpoint_set* set,
+				       yarn_word_t* restart);
+static inline void undo_checkpoint (yarn_word_t epoch, 
+				    struct checkpoint_set* set, 
+				    yarn_word_t restart);
+static inline void undo_log_push (yarn_word_t epoch, struct addr_info* info);
+
+static inline void store_to_wbuf (struct addr_info* info, yarn_word_t epoch, 
+				  const void* src, void* dest);
 static inline void load_from_wbuf (struct addr_info* info, yarn_word_t epoch, 
 				   const void* src, void* dest); 
-
-static inline yarn_word_t clear_flags (struct addr_info* info, yarn_word_t epoch);
-static inline yarn_word_t set_read_flag (struct addr_info* info, yarn_word_t epoch);
-static inline yarn_word_t set_write_flag (struct addr_info* info, yarn_word_t epoch);
+static inline void load_unordered (struct addr_info* info, yarn_word_t epoch, 
+				   const void* src, void* dest);
+static inline void load_lazy (struct addr_info* info, yarn_word_t epoch, 
+			      const void* src, void* dest); 
+static inline void store_lazy (struct addr_info* info, yarn_word_t epoch, 
+			       const void* src);
+static inline bool is_write_buffered (struct addr_info* info, yarn_word_t epoch);
+static inline bool is_read_recorded (struct addr_info* info, yarn_word_t epoch);
+
+static inline bool is_direct_head (yarn_word_t epoch);
+static inline bool has_buffered_info (yarn_word_t epoch);
+static inline void store_head (struct addr_info* info, yarn_word_t epoch, 
+			       const void* src, void* dest);
+static inline void load_head (struct addr_info* info, yarn_word_t epoch, 
+			      const void* src, void* dest); 
+
+static inline bool find_first_flag (yarn_atomic_var* flags, 
+				    yarn_word_t first_index, 
+				    yarn_word_t last_index,
+				    yarn_word_t* index);
+static inline bool find_first_epoch (yarn_atomic_var* flags, 
+				     yarn_word_t first_epoch, 
+				     yarn_word_t last_epoch,
+				     yarn_word_t* epoch);
+static inline bool find_last_flag (yarn_atomic_var* flags, 
+				   yarn_word_t first_index, 
+				   yarn_word_t last_index,
+				   yarn_word_t* index);
+
+static inline bool is_flag_set (yarn_atomic_var* flags, yarn_word_t epoch);
+static inline void set_flag (yarn_atomic_var* flags, yarn_word_t epoch);
+static inline void clear_flag (yarn_atomic_var* flags, yarn_word_t epoch);
 
 static inline void alignment_check (const void* addr);
 
@@ -113,8 +331,30 @@ static bool addr_info_construct(void* data) {
     info->info_list[i] = NULL;
   }
 
+  info->read_flags = (yarn_atomic_var*) (info->info_list + g_epoch_max);
+  info->write_flags = info->read_flags + g_epoch_words;
+  info->predict_flags = info->write_flags + g_epoch_words;
+  info->violation_flags = info->predict_flags + g_epoch_words;
+  for (size_t i = 0; i < g_epoch_words; ++i) {
+    yarn_writev(&info->read_flags[i], 0);
+    yarn_writev(&info->write_flags[i], 0);
+    yarn_writev(&info->predict_flags[i], 0);
+    yarn_writev(&info->violation_flags[i], 0);
+  }
+  info->predictions = (volatile yarn_word_t*) (info->violation_flags + g_epoch_words);
+  info->lazy_access = (volatile uint8_t*) (info->predictions + g_epoch_max);
+  for (size_t i = 0; i < g_epoch_max; ++i) {
+    info->lazy_access[i] = 0;
+  }
+
   yarn_writev(&info->last_commit, -1);
-  yarn_writev(&info->flags, 0);
+  yarn_writev(&info->conflicts, 0);
+  yarn_writev(&info->head_store, -1);
+
+  info->pred_epoch = -1;
+  info->pred_value = 0;
+  info->pred_stride = 0;
+  info->pred_hits = 0;
 
   return true;
 
@@ -139,6 +379,7 @@ static void map_item_destruct (void* data) {
 
 bool yarn_dep_global_init (size_t ws_size, yarn_word_t index_size) {
   g_epoch_max = yarn_epoch_max();
+  g_epoch_words = YARN_BIT_WORDS(g_epoch_max);
 
   g_dependency_map = yarn_map_init(ws_size);
   if (!g_dependency_map) goto map_error;
@@ -151,6 +392,9 @@ bool yarn_dep_global_init (size_t ws_size, yarn_word_t index_size) {
   g_epoch_store = yarn_pstore_init();
   if (!g_epoch_store) goto epoch_store_error;
 
+  g_batch_store = yarn_pstore_init();
+  if (!g_batch_store) goto batch_store_error;
+
   g_info_list = (struct addr_info**) malloc(g_epoch_max * sizeof(struct addr_info*));
   if (!g_info_list) goto list_alloc_error;
 
@@ -161,16 +405,53 @@ bool yarn_dep_global_init (size_t ws_size, yarn_word_t index_size) {
     g_info_index[i] = NULL;
   }
 
+  g_channel_flags = NULL;
+  if (!alloc_channels(index_size)) goto channel_alloc_error;
+
   for (size_t i = 0; i < g_epoch_max; ++i) {
     g_info_list[i] = NULL;
   }
 
+  g_commit_jobs = (struct commit_job*) malloc(g_epoch_max * sizeof(struct commit_job));
+  if (!g_commit_jobs) goto job_alloc_error;
+  reset_commit_jobs();
+
+  g_predict_counts = (yarn_atomic_var*) malloc(g_epoch_max * sizeof(yarn_atomic_var));
+  if (!g_predict_counts) goto predict_alloc_error;
+  for (size_t i = 0; i < g_epoch_max; ++i) {
+    yarn_writev(&g_predict_counts[i], 0);
+  }
+
+  g_checkpoints = (struct checkpoint_set*) 
+    malloc(g_epoch_max * sizeof(struct checkpoint_set));
+  if (!g_checkpoints) goto checkpoint_alloc_error;
+  for (size_t i = 0; i < g_epoch_max; ++i) {
+    g_checkpoints[i].undo = NULL;
+    g_checkpoints[i].undo_capacity = 0;
+    reset_checkpoints(i);
+  }
+
+  g_direct_head = false;
+  g_unordered = false;
+  g_lazy = false;
+  g_predict = false;
+
   return true;
   
+  free(g_checkpoints);
+ checkpoint_alloc_error:
+  free(g_predict_counts);
+ predict_alloc_error:
+  free(g_commit_jobs);
+ job_alloc_error:
+  free(g_channel_flags);
+ channel_alloc_error:
   free(g_info_index);
  index_alloc_error:
   free(g_info_list);
  list_alloc_error:
+  yarn_pstore_destroy(g_batch_store);
+ batch_store_error:
   yarn_pstore_destroy(g_epoch_store);
  epoch_store_error:
   yarn_pmem_destroy(g_addr_info_alloc);
@@ -201,12 +482,22 @@ bool yarn_dep_global_reset (size_t ws_size, yarn_word_t index_size) {
     g_info_index[i] = NULL;
   }
 
+  if (!alloc_channels(index_size)) goto channel_alloc_error;
+
   for (size_t i = 0; i < g_epoch_max; ++i) {
     g_info_list[i] = NULL;
   }
 
+  reset_commit_jobs();
+
+  for (size_t i = 0; i < g_epoch_max; ++i) {
+    yarn_writev(&g_predict_counts[i], 0);
+    reset_checkpoints(i);
+  }
+
   return true;
   
+ channel_alloc_error:
  index_alloc_error:
  map_reset_error:
   perror(__FUNCTION__);
@@ -224,19 +515,46 @@ void yarn_dep_global_destroy (void) {
     if (p_epoch != NULL) {
       free(p_epoch);
     }
+    free(yarn_pstore_load(g_batch_store, pool_id));
   }
 
   if (g_info_index != NULL) {
     free(g_info_index);
   }
+  free(g_channel_flags);
 
+  yarn_pstore_destroy(g_batch_store);
   yarn_pstore_destroy(g_epoch_store);
+  for (yarn_word_t i = 0; i < g_epoch_max; ++i) {
+    free(g_checkpoints[i].undo);
+  }
+  free(g_checkpoints);
+  free(g_predict_counts);
+  free(g_commit_jobs);
   free(g_info_list);
 }
 
 
 
 
+void yarn_dep_set_direct_head (bool enable) {
+  g_direct_head = enable;
+}
+
+void yarn_dep_set_unordered (bool enable) {
+  g_unordered = enable;
+}
+
+void yarn_dep_set_prediction (bool enable) {
+  g_predict = enable;
+}
+
+void yarn_dep_set_lazy (bool enable) {
+  g_lazy = enable;
+}
+
+
+
 bool yarn_dep_thread_init (yarn_word_t pool_id, yarn_word_t epoch) {
   yarn_word_t* p_epoch = yarn_pstore_load(g_epoch_store, pool_id);
   
@@ -248,6 +566,8 @@ bool yarn_dep_thread_init (yarn_word_t pool_id, yarn_word_t epoch) {
   }
 
   *p_epoch = epoch;
+  yarn_writev(&g_predict_counts[YARN_BIT_INDEX(epoch, g_epoch_max)], 0);
+  reset_checkpoints(epoch);
 
   return true;
 
@@ -263,16 +583,78 @@ void yarn_dep_thread_destroy (yarn_word_t pool_id) {
 
 
 
+/*
+The status of the epoch is only written by the rollback and the epoch is owned by the 
+calling thread so this amounts to a per-thread abort flag.
+ */
+static inline bool is_epoch_aborted (yarn_word_t epoch) {
+  return yarn_epoch_get_status(epoch) == yarn_epoch_pending_rollback;
+}
+
+bool yarn_dep_is_aborted (yarn_word_t pool_id) {
+  const yarn_word_t epoch = get_epoch(pool_id);
+  restart_check(epoch);
+  return is_epoch_aborted(epoch);
+}
+
+
+/*
+The watermark is taken before setjmp is called by the YARN_DEP_CHECKPOINT macro. That's 
+fine since nothing can be accessed in between.
+ */
+jmp_buf* yarn_dep_checkpoint (yarn_word_t pool_id) {
+  const yarn_word_t epoch = get_epoch(pool_id);
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  struct checkpoint_set* set = &g_checkpoints[epoch_index];
+
+  const yarn_word_t i = 
+    set->count < YARN_DEP_CHECKPOINT_MAX ? set->count++ : YARN_DEP_CHECKPOINT_MAX-1;
+
+  struct checkpoint* checkpoint = &set->checkpoints[i];
+  checkpoint->watermark = g_info_list[epoch_index];
+  checkpoint->undo_size = set->undo_size;
+
+  DBG printf("[%3zu] CHECKPOINT -> %zu\n", epoch, i);
+
+  return &checkpoint->context;
+}
+
+void yarn_dep_drop_checkpoints (yarn_word_t pool_id) {
+  const yarn_word_t epoch = get_epoch(pool_id);
+  g_checkpoints[YARN_BIT_INDEX(epoch, g_epoch_max)].count = 0;
+}
+
+
 bool yarn_dep_store (yarn_word_t pool_id, const void* src, void* dest) {
   alignment_check(src);
 
   const yarn_word_t epoch = get_epoch(pool_id);
+  restart_check(epoch);
+
+  if (is_direct_head(epoch)) {
+    struct addr_info* info = find_map_addr_info(pool_id, dest);
+    if (!info) goto map_error;
+
+    store_head(info, epoch, src, dest);
+    return true;
+  }
 
   struct addr_info* info = get_map_addr_info(pool_id, dest);
   if (!info) goto map_error;
+
+  // Lazy writes are checked by the readers when they validate.
+  if (g_lazy) {
+    store_lazy(info, epoch, src);
+    return true;
+  }
   
-  yarn_word_t read_flags = store_to_wbuf(info, epoch, src, dest);
-  dep_violation_check (epoch, read_flags);
+  store_to_wbuf(info, epoch, src, dest);
+
+  // A doomed epoch will be rolled back along with anyone that read its buffered values so
+  // there's no point in triggering more rollbacks. Unordered writes are checked on commit.
+  if (!g_unordered && !is_epoch_aborted(epoch)) {
+    dep_violation_check(info, epoch, *((yarn_word_t*) src));
+  }
 
   return true;
 
@@ -290,12 +672,32 @@ bool yarn_dep_store_fast (yarn_word_t pool_id,
   alignment_check(src);
 
   const yarn_word_t epoch = get_epoch(pool_id);
+  restart_check(epoch);
+
+  if (is_direct_head(epoch)) {
+    struct addr_info* info = find_index_addr_info(pool_id, index_id, dest);
+    if (!info) goto index_error;
+
+    store_head(info, epoch, src, dest);
+    return true;
+  }
 
   struct addr_info* info = get_index_addr_info(pool_id, index_id, dest);
   if (!info) goto index_error;
+
+  // Lazy writes are checked by the readers when they validate.
+  if (g_lazy) {
+    store_lazy(info, epoch, src);
+    return true;
+  }
   
-  yarn_word_t read_flags = store_to_wbuf(info, epoch, src, dest);
-  dep_violation_check (epoch, read_flags);
+  store_to_wbuf(info, epoch, src, dest);
+
+  // A doomed epoch will be rolled back along with anyone that read its buffered values so
+  // there's no point in triggering more rollbacks. Unordered writes are checked on commit.
+  if (!g_unordered && !is_epoch_aborted(epoch)) {
+    dep_violation_check(info, epoch, *((yarn_word_t*) src));
+  }
 
   return true;
 
@@ -312,11 +714,32 @@ bool yarn_dep_load (yarn_word_t pool_id, const void* src, void* dest) {
   alignment_check(src);
 
   const yarn_word_t epoch = get_epoch(pool_id);
+  restart_check(epoch);
+
+  if (is_direct_head(epoch)) {
+    struct addr_info* info = NULL;
+    if (has_buffered_info(epoch)) {
+      info = find_map_addr_info(pool_id, src);
+      if (!info) goto map_error;
+    }
+
+    load_head(info, epoch, src, dest);
+    return true;
+  }
 
   struct addr_info* info = get_map_addr_info(pool_id, src);
   if (!info) goto map_error;
   
-  load_from_wbuf(info, epoch, src, dest);
+  if (g_unordered) {
+    load_unordered(info, epoch, src, dest);
+  }
+  else if (g_lazy) {
+    load_lazy(info, epoch, src, dest);
+  }
+  else {
+    sync_load(info, epoch);
+    load_from_wbuf(info, epoch, src, dest);
+  }
      
   return true;
   
@@ -333,11 +756,32 @@ bool yarn_dep_load_fast (yarn_word_t pool_id,
   alignment_check(src);
 
   const yarn_word_t epoch = get_epoch(pool_id);
+  restart_check(epoch);
+
+  if (is_direct_head(epoch)) {
+    struct addr_info* info = NULL;
+    if (has_buffered_info(epoch)) {
+      info = find_index_addr_info(pool_id, index_id, src);
+      if (!info) goto index_error;
+    }
+
+    load_head(info, epoch, src, dest);
+    return true;
+  }
 
   struct addr_info* info = get_index_addr_info(pool_id, index_id, src);
   if (!info) goto index_error;
   
-  load_from_wbuf(info, epoch, src, dest);
+  if (g_unordered) {
+    load_unordered(info, epoch, src, dest);
+  }
+  else if (g_lazy) {
+    load_lazy(info, epoch, src, dest);
+  }
+  else {
+    sync_load(info, epoch);
+    load_from_wbuf(info, epoch, src, dest);
+  }
  
   return true;
   
@@ -347,193 +791,532 @@ bool yarn_dep_load_fast (yarn_word_t pool_id,
 }
 
 
+bool yarn_dep_produce (yarn_word_t pool_id, 
+		       yarn_word_t index_id, 
+		       const void* src, 
+		       void* dest) 
+{
+  if (!yarn_dep_store_fast(pool_id, index_id, src, dest)) {
+    return false;
+  }
 
+  const yarn_word_t epoch = get_epoch(pool_id);
+  yarn_atomic_var* producers = get_producer_flags();
+  if (!is_flag_set(producers, epoch)) {
+    set_flag(producers, epoch);
+  }
 
+  // set_flag is a full barrier so the value is visible before the flag.
+  set_flag(get_channel_flags(index_id), epoch);
+  return true;
+}
 
-void yarn_dep_commit (yarn_word_t epoch) {
-  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
-  const yarn_word_t epoch_mask = YARN_BIT_MASK(epoch, g_epoch_max);
+bool yarn_dep_consume (yarn_word_t pool_id, 
+		       yarn_word_t index_id, 
+		       const void* src, 
+		       void* dest) 
+{
+  const yarn_word_t epoch = get_epoch(pool_id);
 
-  struct addr_info* info = NULL;
-  while ((info = info_list_pop(epoch)) != NULL) {
-    YARN_CHECK_RET0(pthread_mutex_lock(&info->commit_lock));
-    
-    yarn_word_t flags = yarn_readv(&info->flags);
-    yarn_word_t write_flags;
-    {
-      yarn_word_t read_flags;
-      yarn_bit_unpack(flags, &read_flags, &write_flags);
-    }
+  if (!g_unordered && !is_direct_head(epoch)) {
+    wait_channel(index_id, epoch);
+  }
 
-    if (write_flags & epoch_mask) {
+  return yarn_dep_load_fast(pool_id, index_id, src, dest);
+}
 
-      // Write the value to memory only if no newer value was already written.
-      if (yarn_timestamp_comp(epoch, yarn_readv(&info->last_commit)) > 0) {
 
-	*((yarn_word_t* volatile) info->addr) = info->write_buffer[epoch_index];
-	yarn_mem_barrier();
-	yarn_writev(&info->last_commit, epoch);
 
-	DBG {
-	  yarn_word_t rb_mask = ~yarn_epoch_rollback_flags();
-	  yarn_word_t val =  info->write_buffer[epoch_index];
-	  printf("[%3zu] WRITTING -> {"YARN_SHEX"}=%zu"
-		 "\t\t\t\t\t\t\t\trb_mask="YARN_SHEX", old_flags="YARN_SHEX"\n",
-		 epoch, YARN_AHEX((uintptr_t)info->addr), val, YARN_AHEX(rb_mask),
-		 YARN_AHEX(flags));
-	}
-      }
-    }
 
-    clear_flags(info, epoch);
-    
-    YARN_CHECK_RET0(pthread_mutex_unlock(&info->commit_lock));
-  }
 
-}
+/*
+Large write sets are split by address and published so that idle threads can help with
+the commit through yarn_dep_commit_help. We still wait for the helpers to finish before
+returning so that the epoch can be marked as committed by the caller.
+ */
+void yarn_dep_commit (yarn_word_t epoch) {
+  clear_channels(epoch);
 
+  struct commit_job* job = &g_commit_jobs[YARN_BIT_INDEX(epoch, g_epoch_max)];
 
-void yarn_dep_rollback (yarn_word_t epoch) {
-  struct addr_info* info;
-  while ((info = info_list_pop(epoch)) != NULL) {    
-    
-    yarn_word_t old_flags = clear_flags(info, epoch);
-    (void) old_flags;
+  job->epoch = epoch;
+  for (yarn_word_t part = 0; part < YARN_DEP_COMMIT_PARTS; ++part) {
+    job->parts[part] = NULL;
+  }
 
-    DBG {
-      yarn_word_t rb_mask = ~yarn_epoch_rollback_flags();
-      printf("[%3zu] ROLLBACK -> {"YARN_SHEX"}"
-	     "\t\t\t\t\t\t\t\trb_mask="YARN_SHEX", old_flags="YARN_SHEX"\n",
-	     epoch, YARN_AHEX((uintptr_t) info->addr), YARN_AHEX(rb_mask),
-	     YARN_AHEX(old_flags));
-    }
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  yarn_word_t count = 0;
 
-  }  
-}
+  struct addr_info* info = NULL;
+  while ((info = info_list_pop(epoch)) != NULL) {
+    // Reuse the list pointers of the epoch to build the partitions.
+    const yarn_word_t part = 
+      (((uintptr_t) info->addr) / YARN_DEP_COMMIT_LINE) % YARN_DEP_COMMIT_PARTS;
+    info->info_list[epoch_index] = job->parts[part];
+    job->parts[part] = info;
+    count++;
+  }
 
+  if (count < YARN_DEP_COMMIT_SPLIT) {
+    for (yarn_word_t part = 0; part < YARN_DEP_COMMIT_PARTS; ++part) {
+      commit_part(job, part);
+    }
+    return;
+  }
 
+  yarn_writev(&job->parts_done, 0);
+  yarn_writev_barrier(&job->next_part, 0);
+  yarn_incv(&g_commit_pending);
 
-static inline size_t addr_info_size () {
-  size_t size = sizeof(struct addr_info);
-  size += sizeof(yarn_word_t) * g_epoch_max;
-  size += sizeof(struct addr_info*) * g_epoch_max;
-  return size;
-}
+  yarn_word_t part;
+  while ((part = yarn_get_and_incv(&job->next_part)) < YARN_DEP_COMMIT_PARTS) {
+    commit_part(job, part);
+    yarn_incv(&job->parts_done);
+  }
 
+  yarn_decv(&g_commit_pending);
 
-static inline yarn_word_t get_epoch(yarn_word_t pool_id) {
-  return *((yarn_word_t*)yarn_pstore_load(g_epoch_store, pool_id));
+  // The helpers only have a partition left to finish so don't bother parking.
+  while (yarn_readv(&job->parts_done) != YARN_DEP_COMMIT_PARTS) {
+    sched_yield();
+  }
+  yarn_mem_barrier();
 }
 
-
-static inline yarn_word_t index_to_epoch_after (yarn_word_t base_epoch, 
-						yarn_word_t index) 
-{
-  const yarn_word_t base_index = YARN_BIT_INDEX(base_epoch, g_epoch_max);
-  
-  if (base_index <= index) {
-    return base_epoch + (index - base_index);
+bool yarn_dep_commit_help (void) {
+  if (yarn_readv(&g_commit_pending) == 0) {
+    return false;
   }
-  else {
-    return base_epoch + (g_epoch_max - base_index) + index;
-  }
-}
 
+  bool helped = false;
 
-static inline yarn_word_t index_to_epoch_before (yarn_word_t base_epoch, 
-						 yarn_word_t index) 
-{
-  const yarn_word_t base_index = YARN_BIT_INDEX(base_epoch, g_epoch_max);
-  
-  if (base_index >= index) {
-    return base_epoch - (base_index - index);
-  }
-  else {
-    return base_epoch - base_index - (g_epoch_max - index);
+  for (yarn_word_t i = 0; i < g_epoch_max; ++i) {
+    struct commit_job* job = &g_commit_jobs[i];
+
+    // Cheap check to avoid hammering the counter of closed jobs.
+    if (yarn_readv(&job->next_part) >= YARN_DEP_COMMIT_PARTS) {
+      continue;
+    }
+
+    yarn_word_t part;
+    while ((part = yarn_get_and_incv(&job->next_part)) < YARN_DEP_COMMIT_PARTS) {
+      commit_part(job, part);
+      yarn_incv(&job->parts_done);
+      helped = true;
+    }
   }
-}
 
+  return helped;
+}
 
-static inline struct addr_info* get_index_addr_info (yarn_word_t pool_id,
-						     yarn_word_t index_id,
-						     const void* addr) 
-{
-  assert(index_id < g_info_index_size);
 
-  struct addr_info* info;
+static int addr_info_comp (const void* lhs, const void* rhs) {
+  uintptr_t lhs_addr = (uintptr_t) (*((struct addr_info**) lhs))->addr;
+  uintptr_t rhs_addr = (uintptr_t) (*((struct addr_info**) rhs))->addr;
 
-  if (g_info_index[index_id] == NULL) {
-    info = get_map_addr_info(pool_id, addr);
-    if (!info) goto acquire_error;
+  if (lhs_addr < rhs_addr) return -1;
+  if (lhs_addr > rhs_addr) return 1;
+  return 0;
+}
 
-    g_info_index[index_id] = info;
+/*
+Returns the batch buffer of the thread with room for at least size addr_info. The buffer
+is kept around for the next batches so it's only reallocated when a batch is bigger than
+any of the ones that came before.
+ */
+static struct batch_buffer* get_batch_buffer (yarn_word_t pool_id, yarn_word_t size) {
+  struct batch_buffer* buf = yarn_pstore_load(g_batch_store, pool_id);
+  if (buf && buf->capacity >= size) {
+    return buf;
   }
-  else {
-    info = g_info_index[index_id];
 
-    const yarn_word_t epoch = get_epoch(pool_id);
-    info_list_push_if_new(epoch, info);
+  yarn_word_t capacity = buf ? buf->capacity : YARN_DEP_BATCH_SIZE;
+  while (capacity < size) {
+    capacity *= 2;
   }
 
-  return info;
+  buf = realloc(buf, sizeof(struct batch_buffer) + capacity * sizeof(struct addr_info*));
+  if (!buf) goto alloc_error;
 
-  // release_addr_info(info);
- acquire_error:
+  buf->capacity = capacity;
+  yarn_pstore_store(g_batch_store, pool_id, buf);
+  return buf;
+
+ alloc_error:
+  // realloc leaves the old buffer alone so it's still in the store.
   perror(__FUNCTION__);
   return NULL;
 }
 
-
-static inline struct addr_info* get_map_addr_info (yarn_word_t pool_id, 
-						   const void* addr) 
+/*
+The write sets of the epochs are merged so that each address is only written once with 
+the value of the youngest epoch. The writes are also sorted by address to be nice with the
+cache and the prefetchers.
+ */
+void yarn_dep_commit_batch (yarn_word_t pool_id, 
+			    yarn_word_t first_epoch, 
+			    yarn_word_t count) 
 {
-  const yarn_word_t epoch = get_epoch(pool_id);
+  if (count == 1) {
+    yarn_dep_commit(first_epoch);
+    return;
+  }
 
-  struct addr_info* tmp_info = yarn_pmem_alloc(g_addr_info_alloc, pool_id);
-  if (!tmp_info) goto alloc_error;
+  for (yarn_word_t i = 0; i < count; ++i) {
+    clear_channels(first_epoch + i);
+  }
 
-  tmp_info->addr = (void*) addr; //! \todo const cast or remove all const qualifiers...
+  yarn_word_t size = 0;
+  for (yarn_word_t i = 0; i < count; ++i) {
+    const yarn_word_t index = YARN_BIT_INDEX(first_epoch + i, g_epoch_max);
+    for (struct addr_info* info = g_info_list[index]; info; info = info->info_list[index]) {
+      size++;
+    }
+  }
 
-  struct addr_info* info = (struct addr_info*) 
-      yarn_map_probe(g_dependency_map, (uintptr_t)addr, tmp_info);
-  
-  if (info != tmp_info) {
-    yarn_pmem_free(g_addr_info_alloc, pool_id, tmp_info);
-    tmp_info = NULL;
+  struct batch_buffer* buf = get_batch_buffer(pool_id, size);
+  if (!buf) goto alloc_error;
+  struct addr_info** infos = buf->infos;
 
-    info_list_push_if_new (epoch, info);
+  size = 0;
+  for (yarn_word_t i = 0; i < count; ++i) {
+    struct addr_info* info;
+    while ((info = info_list_pop(first_epoch + i)) != NULL) {
+      infos[size++] = info;
+    }
   }
-  else {
-    info_list_push(epoch, info);
+
+  qsort(infos, size, sizeof(struct addr_info*), addr_info_comp);
+
+  for (yarn_word_t i = 0; i < size; ++i) {
+    // Same addr_info used by multiple epochs.
+    if (i > 0 && infos[i] == infos[i-1]) {
+      continue;
+    }
+    commit_info_batch(infos[i], first_epoch, count);
   }
 
-  return info;
+  return;
 
  alloc_error:
   perror(__FUNCTION__);
-  return NULL;
+
+  // Still have to commit something.
+  for (yarn_word_t i = 0; i < count; ++i) {
+    yarn_dep_commit(first_epoch + i);
+  }
 }
 
 
+void yarn_dep_rollback (yarn_word_t epoch) {
+  clear_channels(epoch);
 
-static inline void info_list_push (yarn_word_t epoch, struct addr_info* info) {
-  const yarn_word_t index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  struct addr_info* info;
+  while ((info = info_list_pop(epoch)) != NULL) {    
+    
+    clear_flag(info->read_flags, epoch);
+    clear_flag(info->write_flags, epoch);
+    clear_flag(info->predict_flags, epoch);
+    clear_flag(info->violation_flags, epoch);
+    info->lazy_access[YARN_BIT_INDEX(epoch, g_epoch_max)] = 0;
 
-  info->info_list[index] = g_info_list[index];
-  g_info_list[index] = info;
+    DBG printf("[%3zu] ROLLBACK -> {"YARN_SHEX"}\n",
+	       epoch, YARN_AHEX((uintptr_t) info->addr));
+
+  }  
 }
 
-static inline void info_list_push_if_new (yarn_word_t epoch, struct addr_info* info) {
-  const yarn_word_t mask = YARN_BIT_MASK(epoch, g_epoch_max);
 
-  yarn_word_t read_flags;
-  yarn_word_t write_flags;
-  yarn_bit_unpack(yarn_readv(&info->flags), &read_flags, &write_flags);
+/*
+Every epoch older then the head is committed so the memory holds the values that the 
+predictions and the lazy loads should have returned. A wrong value means that the epoch 
+computed garbage so it's rolled back instead of committed.
+ */
+bool yarn_dep_validate (yarn_word_t epoch, bool is_first) {
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
 
-  if ((read_flags & mask) == 0 && (write_flags & mask) == 0) {
-    info_list_push(epoch, info);
+  if (yarn_readv(&g_predict_counts[epoch_index]) == 0) {
+    return true;
   }
-}
+  if (!is_first) {
+    return false;
+  }
+
+  struct addr_info* info = g_info_list[epoch_index];
+  for (; info != NULL; info = info->info_list[epoch_index]) {
+    if (!is_read_recorded(info, epoch)) {
+      continue;
+    }
+
+    const yarn_word_t value = *((yarn_word_t* volatile) info->addr);
+    if (value != info->predictions[epoch_index]) {
+      DBG printf("[%3zu] MISPREDICT -> {"YARN_SHEX"}=%zu, predicted=%zu\n",
+		 epoch, YARN_AHEX((uintptr_t) info->addr), 
+		 value, info->predictions[epoch_index]);
+
+      add_conflict(info);
+      yarn_epoch_do_rollback(epoch);
+      return false;
+    }
+  }
+
+  yarn_writev(&g_predict_counts[epoch_index], 0);
+  return true;
+}
+
+
+
+/*
+Unordered epochs are serialized in commit order so the last commit always wins.
+ */
+static inline void commit_info (struct addr_info* info, yarn_word_t epoch) {
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  bool is_written = false;
+
+  YARN_CHECK_RET0(pthread_mutex_lock(&info->commit_lock));
+    
+  if (is_write_buffered(info, epoch)) {
+    is_written = true;
+
+    // Write the value to memory only if no newer value was already written.
+    if (g_unordered || yarn_timestamp_comp(epoch, yarn_readv(&info->last_commit)) > 0) {
+      train_predictor(info, epoch, info->write_buffer[epoch_index]);
+
+      *((yarn_word_t* volatile) info->addr) = info->write_buffer[epoch_index];
+      yarn_mem_barrier();
+      yarn_writev(&info->last_commit, epoch);
+
+      DBG {
+	yarn_word_t val =  info->write_buffer[epoch_index];
+	printf("[%3zu] WRITTING -> {"YARN_SHEX"}=%zu\n",
+	       epoch, YARN_AHEX((uintptr_t)info->addr), val);
+      }
+    }
+  }
+
+  clear_flag(info->read_flags, epoch);
+  clear_flag(info->write_flags, epoch);
+  clear_flag(info->predict_flags, epoch);
+  clear_flag(info->violation_flags, epoch);
+  info->lazy_access[epoch_index] = 0;
+    
+  YARN_CHECK_RET0(pthread_mutex_unlock(&info->commit_lock));
+
+  if (g_unordered && is_written) {
+    invalidate_readers(info, epoch);
+  }
+}
+
+static inline void commit_info_batch (struct addr_info* info, 
+				      yarn_word_t first_epoch, 
+				      yarn_word_t count) 
+{
+  YARN_CHECK_RET0(pthread_mutex_lock(&info->commit_lock));
+
+  // Only the youngest write makes it to memory but the predictor has to see them all.
+  for (yarn_word_t i = 0; g_predict && i < count; ++i) {
+    const yarn_word_t epoch = first_epoch + i;
+    const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+    if (is_write_buffered(info, epoch) &&
+	yarn_timestamp_comp(epoch, yarn_readv(&info->last_commit)) > 0) 
+    {
+      train_predictor(info, epoch, info->write_buffer[epoch_index]);
+    }
+  }
+
+  // Look for the youngest write.
+  for (yarn_word_t i = count; i > 0; --i) {
+    const yarn_word_t epoch = first_epoch + i - 1;
+    if (!is_write_buffered(info, epoch)) {
+      continue;
+    }
+
+    if (yarn_timestamp_comp(epoch, yarn_readv(&info->last_commit)) > 0) {
+      const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+
+      *((yarn_word_t* volatile) info->addr) = info->write_buffer[epoch_index];
+      yarn_mem_barrier();
+      yarn_writev(&info->last_commit, epoch);
+
+      DBG printf("[%3zu] WRITTING -> {"YARN_SHEX"}=%zu (batch=%zu)\n",
+		 epoch, YARN_AHEX((uintptr_t)info->addr), 
+		 info->write_buffer[epoch_index], first_epoch);
+    }
+    break;
+  }
+
+  for (yarn_word_t i = 0; i < count; ++i) {
+    clear_flag(info->read_flags, first_epoch + i);
+    clear_flag(info->write_flags, first_epoch + i);
+    clear_flag(info->predict_flags, first_epoch + i);
+    clear_flag(info->violation_flags, first_epoch + i);
+    info->lazy_access[YARN_BIT_INDEX(first_epoch + i, g_epoch_max)] = 0;
+  }
+
+  YARN_CHECK_RET0(pthread_mutex_unlock(&info->commit_lock));
+}
+
+static inline void commit_part (struct commit_job* job, yarn_word_t part) {
+  const yarn_word_t epoch = job->epoch;
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+
+  struct addr_info* info = job->parts[part];
+  while (info != NULL) {
+    struct addr_info* next = info->info_list[epoch_index];
+    info->info_list[epoch_index] = NULL;
+
+    commit_info(info, epoch);
+    info = next;
+  }
+}
+
+static inline void reset_commit_jobs (void) {
+  for (yarn_word_t i = 0; i < g_epoch_max; ++i) {
+    yarn_writev(&g_commit_jobs[i].next_part, YARN_DEP_COMMIT_PARTS);
+    yarn_writev(&g_commit_jobs[i].parts_done, 0);
+  }
+  yarn_writev(&g_commit_pending, 0);
+}
+
+
+static inline size_t addr_info_size () {
+  size_t size = sizeof(struct addr_info);
+  size += sizeof(yarn_word_t) * g_epoch_max;
+  size += sizeof(struct addr_info*) * g_epoch_max;
+  size += sizeof(yarn_atomic_var) * g_epoch_words * 4;
+  size += sizeof(yarn_word_t) * g_epoch_max;
+  size += sizeof(uint8_t) * g_epoch_max;
+  return size;
+}
+
+
+static inline yarn_word_t get_epoch(yarn_word_t pool_id) {
+  return *((yarn_word_t*)yarn_pstore_load(g_epoch_store, pool_id));
+}
+
+
+static inline yarn_word_t index_to_epoch_after (yarn_word_t base_epoch, 
+						yarn_word_t index) 
+{
+  const yarn_word_t base_index = YARN_BIT_INDEX(base_epoch, g_epoch_max);
+  
+  if (base_index <= index) {
+    return base_epoch + (index - base_index);
+  }
+  else {
+    return base_epoch + (g_epoch_max - base_index) + index;
+  }
+}
+
+
+static inline yarn_word_t index_to_epoch_before (yarn_word_t base_epoch, 
+						 yarn_word_t index) 
+{
+  const yarn_word_t base_index = YARN_BIT_INDEX(base_epoch, g_epoch_max);
+  
+  if (base_index >= index) {
+    return base_epoch - (base_index - index);
+  }
+  else {
+    return base_epoch - base_index - (g_epoch_max - index);
+  }
+}
+
+
+/*
+Looks up the addr_info of an address without adding it to the info list of the epoch.
+ */
+static inline struct addr_info* find_index_addr_info (yarn_word_t pool_id,
+						      yarn_word_t index_id,
+						      const void* addr) 
+{
+  assert(index_id < g_info_index_size);
+
+  struct addr_info* info = g_info_index[index_id];
+
+  if (info == NULL) {
+    info = find_map_addr_info(pool_id, addr);
+    if (!info) goto acquire_error;
+
+    g_info_index[index_id] = info;
+  }
+
+  return info;
+
+ acquire_error:
+  perror(__FUNCTION__);
+  return NULL;
+}
+
+
+static inline struct addr_info* find_map_addr_info (yarn_word_t pool_id, 
+						    const void* addr) 
+{
+  struct addr_info* tmp_info = yarn_pmem_alloc(g_addr_info_alloc, pool_id);
+  if (!tmp_info) goto alloc_error;
+
+  tmp_info->addr = (void*) addr; //! \todo const cast or remove all const qualifiers...
+
+  struct addr_info* info = (struct addr_info*) 
+      yarn_map_probe(g_dependency_map, (uintptr_t)addr, tmp_info);
+  
+  if (info != tmp_info) {
+    yarn_pmem_free(g_addr_info_alloc, pool_id, tmp_info);
+    tmp_info = NULL;
+  }
+
+  return info;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  return NULL;
+}
+
+
+static inline struct addr_info* get_index_addr_info (yarn_word_t pool_id,
+						     yarn_word_t index_id,
+						     const void* addr) 
+{
+  struct addr_info* info = find_index_addr_info(pool_id, index_id, addr);
+  if (!info) return NULL;
+
+  info_list_push_if_new(get_epoch(pool_id), info);
+  return info;
+}
+
+
+static inline struct addr_info* get_map_addr_info (yarn_word_t pool_id, 
+						   const void* addr) 
+{
+  struct addr_info* info = find_map_addr_info(pool_id, addr);
+  if (!info) return NULL;
+
+  // A new info has no flags set so it always gets pushed.
+  info_list_push_if_new(get_epoch(pool_id), info);
+  return info;
+}
+
+
+
+static inline void info_list_push (yarn_word_t epoch, struct addr_info* info) {
+  const yarn_word_t index = YARN_BIT_INDEX(epoch, g_epoch_max);
+
+  info->info_list[index] = g_info_list[index];
+  g_info_list[index] = info;
+}
+
+static inline void info_list_push_if_new (yarn_word_t epoch, struct addr_info* info) {
+  if (g_lazy) {
+    if (info->lazy_access[YARN_BIT_INDEX(epoch, g_epoch_max)] == 0) {
+      info_list_push(epoch, info);
+    }
+  }
+  else if (!is_flag_set(info->read_flags, epoch) && 
+	   !is_flag_set(info->write_flags, epoch)) 
+  {
+    info_list_push(epoch, info);
+  }
+}
 
 
 static inline struct addr_info* info_list_pop (yarn_word_t epoch) {
@@ -552,34 +1335,27 @@ static inline struct addr_info* info_list_pop (yarn_word_t epoch) {
 
 
 
-static inline yarn_word_t store_to_wbuf (struct addr_info* info, 
-					 yarn_word_t epoch, 
-					 const void* src, 
-					 void* dest) 
+static inline void store_to_wbuf (struct addr_info* info, 
+				  yarn_word_t epoch, 
+				  const void* src, 
+				  void* dest) 
 {
   (void) dest;
 
   const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
 
+  if (g_checkpoints[epoch_index].count > 0) {
+    undo_log_push(epoch, info);
+  }
+
   // This must be an atomic write.
   info->write_buffer[epoch_index] = *((yarn_word_t* volatile) src);
-  yarn_word_t flags = set_write_flag(info, epoch);
 
-  DBG {
-    yarn_word_t rb_mask = ~yarn_epoch_rollback_flags();
-    printf("[%3zu] STORE    -> {"YARN_SHEX"}=%zu"
-	   "\t\t\t\t\t\t\t\trb_mask="YARN_SHEX", flags="YARN_SHEX"\n",
-	   epoch, YARN_AHEX((uintptr_t)info->addr), info->write_buffer[epoch_index], 
-	   YARN_AHEX(rb_mask), YARN_AHEX(flags));
-  }
+  // Acts as a full barrier which orders the write flag with the read flags check.
+  set_flag(info->write_flags, epoch);
 
-  yarn_word_t read_flags;
-  {
-    yarn_word_t write_flags;
-    yarn_bit_unpack(flags, &read_flags, &write_flags);
-  }
-
-  return read_flags;
+  DBG printf("[%3zu] STORE    -> {"YARN_SHEX"}=%zu\n",
+	     epoch, YARN_AHEX((uintptr_t)info->addr), info->write_buffer[epoch_index]);
 }
 
 static inline void load_from_wbuf (struct addr_info* info, 
@@ -588,195 +1364,869 @@ static inline void load_from_wbuf (struct addr_info* info,
 				   void* dest)
 {
 
-  const yarn_word_t flags = set_read_flag(info, epoch);
-  yarn_word_t read_flags;
-  yarn_word_t write_flags;
-  yarn_bit_unpack(flags, &read_flags, &write_flags);
-
-  const yarn_word_t rollback_mask = ~yarn_epoch_rollback_flags();
-  write_flags &= rollback_mask;
+  // Acts as a full barrier which orders the read flag with the write flags check.
+  set_flag(info->read_flags, epoch);
 
   const yarn_word_t first_epoch = yarn_epoch_first();
   const yarn_word_t first_index = YARN_BIT_INDEX(first_epoch, g_epoch_max);
-  const yarn_word_t last_epoch = epoch+1;
   const yarn_word_t last_index = YARN_BIT_INDEX(epoch+1, g_epoch_max);
 
+  // Look for the latest write that precedes the current epoch.
+  yarn_word_t read_index;
+  yarn_word_t read_epoch;
+  bool found;
 
-  yarn_word_t masked_flags;
-  yarn_word_t mask;
+  while (true) {
+    if (first_index < last_index) {
+      found = find_last_flag(info->write_flags, first_index, last_index, &read_index);
+    }
+    else {
+      found = find_last_flag(info->write_flags, 0, last_index, &read_index) ||
+	find_last_flag(info->write_flags, first_index, g_epoch_max, &read_index);
+    }
 
-  if (first_index < last_index) {
-    // Must use the epochs here (the index might be equal but the epochs might not).
-    mask = yarn_bit_mask_range(first_epoch, last_epoch, g_epoch_max);
-    masked_flags = write_flags & mask;
-  }
-  else {
-    mask = yarn_bit_mask_range(0, last_index, g_epoch_max);
-    masked_flags = write_flags & mask;
-    if (masked_flags == 0) {
-      yarn_word_t second_mask = yarn_bit_mask_range(first_index, g_epoch_max, g_epoch_max);
-      mask |= second_mask;
-      masked_flags = write_flags & second_mask;
+    if (!found) {
+      break;
     }
-  }
 
-  // Read the earliest write in the buffer.
-  yarn_word_t read_epoch;
-  if (masked_flags) {
-    const yarn_word_t read_index = yarn_bit_log2(masked_flags);
+    // If the writer got rolled back in the meantime then look for an older write.
     read_epoch = index_to_epoch_before(epoch, read_index);
+    if (read_epoch == epoch || yarn_epoch_add_forward(epoch, read_epoch)) {
+      break;
+    }
+  }
 
+  if (found) {
     *((yarn_word_t* volatile) dest) = info->write_buffer[read_index];
 
-    DBG {
-      printf("[%3zu] LOAD     -> {"YARN_SHEX"}=%zu - BUF[%3zu]"
-	     "\t\tfirst_e=%zu, (%zu, %zu), mask="YARN_SHEX", rb_mask="YARN_SHEX
-	     ", flags="YARN_SHEX"\n",
-	     epoch, YARN_AHEX((uintptr_t)info->addr),
-	     info->write_buffer[read_index], read_epoch, 
-	     first_epoch, first_index, last_index,
-	     YARN_AHEX(mask), YARN_AHEX(rollback_mask), YARN_AHEX(flags));
-    }
-
+    DBG printf("[%3zu] LOAD     -> {"YARN_SHEX"}=%zu - BUF[%3zu]"
+	       "\t\tfirst_e=%zu, (%zu, %zu)\n",
+	       epoch, YARN_AHEX((uintptr_t)info->addr),
+	       info->write_buffer[read_index], read_epoch, 
+	       first_epoch, first_index, last_index);
   }
 
   // No value in the buffer or the buffer was comitted -> go to memory.
-  if(!masked_flags || 
-     yarn_timestamp_comp(read_epoch, yarn_readv(&info->last_commit)) <= 0) 
-  {
+  if(!found || yarn_timestamp_comp(read_epoch, yarn_readv(&info->last_commit)) <= 0) {
+
+    // Unless memory is likely to be stale and we have a better guess.
+    yarn_word_t value;
+    if (predict_value(info, epoch, &value)) {
+      *((yarn_word_t* volatile) dest) = value;
+      return;
+    }
 
     *((yarn_word_t* volatile) dest) = *((yarn_word_t* volatile) src);
 
     DBG {
       yarn_word_t t_val = *((yarn_word_t* volatile) src);
       printf("[%3zu] LOAD     -> {"YARN_SHEX"}=%zu - MEM"
-	     "\t\tfirst_e=%zu, (%zu, %zu), mask="YARN_SHEX", rb_mask="YARN_SHEX
-	     ", flags="YARN_SHEX"\n",
+	     "\t\tfirst_e=%zu, (%zu, %zu)\n",
 	     epoch, YARN_AHEX((uintptr_t)info->addr), t_val, 
-	     first_epoch, first_index, last_index,
-	     YARN_AHEX(mask), YARN_AHEX(rollback_mask), YARN_AHEX(flags));
+	     first_epoch, first_index, last_index);
     }
   }
 }
 
 
 
-static inline void dep_violation_check (yarn_word_t epoch, yarn_word_t read_flags) {
+/*
+Unordered epochs never see the buffered values of other epochs. The read flag is still set
+so that the epoch can be rolled back if someone commits a write to the address.
+ */
+static inline void load_unordered (struct addr_info* info, 
+				   yarn_word_t epoch, 
+				   const void* src, 
+				   void* dest)
+{
+  // Acts as a full barrier which orders the read flag with the read of the memory. Pairs 
+  // with the barrier in commit_info so that either we see the committed value or the 
+  // commit sees our read flag.
+  set_flag(info->read_flags, epoch);
+
+  if (is_flag_set(info->write_flags, epoch)) {
+    const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+    *((yarn_word_t* volatile) dest) = info->write_buffer[epoch_index];
+  }
+  else {
+    *((yarn_word_t* volatile) dest) = *((yarn_word_t* volatile) src);
+  }
 
-  const yarn_word_t first_epoch = epoch+1;
-  const yarn_word_t last_epoch = yarn_epoch_last();
-  if (first_epoch >= last_epoch) {
-    return;
+  DBG printf("[%3zu] LOAD     -> {"YARN_SHEX"}=%zu - UNORDERED\n",
+	     epoch, YARN_AHEX((uintptr_t)src), *((yarn_word_t*) dest));
+}
+
+
+
+/*
+Lazy epochs only ever read memory and their own writes. The first value read from an 
+address that the epoch didn't write is recorded and returned for the later loads so that
+the epoch has a consistent view of the address. yarn_dep_validate checks the 
+recorded values against memory once every older epoch is committed. None of this touches
+the flags that are shared with the other epochs so their stores don't have to look for
+us and we don't have to look for them.
+ */
+static inline void load_lazy (struct addr_info* info, 
+			      yarn_word_t epoch, 
+			      const void* src, 
+			      void* dest)
+{
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  const uint8_t access = info->lazy_access[epoch_index];
+
+  if (access & YARN_DEP_LAZY_WRITE) {
+    *((yarn_word_t* volatile) dest) = info->write_buffer[epoch_index];
+  }
+  else if (access & YARN_DEP_LAZY_READ) {
+    *((yarn_word_t* volatile) dest) = info->predictions[epoch_index];
+  }
+  else {
+    const yarn_word_t value = *((yarn_word_t* volatile) src);
+    info->predictions[epoch_index] = value;
+    info->lazy_access[epoch_index] = access | YARN_DEP_LAZY_READ;
+    yarn_incv(&g_predict_counts[epoch_index]);
+
+    *((yarn_word_t* volatile) dest) = value;
+  }
+
+  DBG printf("[%3zu] LOAD     -> {"YARN_SHEX"}=%zu - LAZY\n",
+	     epoch, YARN_AHEX((uintptr_t)src), *((yarn_word_t*) dest));
+}
+
+/*
+The value stays in the write buffer of the epoch, without a write flag, until the epoch
+is committed.
+ */
+static inline void store_lazy (struct addr_info* info, 
+			       yarn_word_t epoch, 
+			       const void* src)
+{
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+
+  if (g_checkpoints[epoch_index].count > 0) {
+    undo_log_push(epoch, info);
+  }
+
+  info->write_buffer[epoch_index] = *((yarn_word_t* volatile) src);
+  info->lazy_access[epoch_index] |= YARN_DEP_LAZY_WRITE;
+
+  DBG printf("[%3zu] STORE    -> {"YARN_SHEX"}=%zu - LAZY\n",
+	     epoch, YARN_AHEX((uintptr_t)info->addr), info->write_buffer[epoch_index]);
+}
+
+// Returns true if the epoch wrote to the address and the value wasn't committed yet.
+static inline bool is_write_buffered (struct addr_info* info, yarn_word_t epoch) {
+  if (g_lazy) {
+    return info->lazy_access[YARN_BIT_INDEX(epoch, g_epoch_max)] & YARN_DEP_LAZY_WRITE;
   }
+  return is_flag_set(info->write_flags, epoch);
+}
+
+// Returns true if the epoch read a value that yarn_dep_validate has to check.
+static inline bool is_read_recorded (struct addr_info* info, yarn_word_t epoch) {
+  if (g_lazy) {
+    return info->lazy_access[YARN_BIT_INDEX(epoch, g_epoch_max)] & YARN_DEP_LAZY_READ;
+  }
+  return is_flag_set(info->predict_flags, epoch);
+}
 
-  const yarn_word_t rollback_mask = ~yarn_epoch_rollback_flags();  
-  read_flags &= rollback_mask;
+
+
+/*
+The oldest executing epoch can't be rolled back because only older epochs can trigger a
+rollback. It can therefore write straight to memory instead of buffering its writes
+which leaves very little to do when it commits. A pending rollback means that the epoch
+executed before it became the head and it must not touch memory.
+
+Epochs past the stop epoch can also become the head but they are never committed. The
+stop is set before the previous epoch is done so it can't show up after the check. The
+head of an unordered loop can be rolled back by any commit so it's left alone. So is an 
+epoch that still has values to validate since yarn_dep_validate can roll it back.
+ */
+static inline bool is_direct_head (yarn_word_t epoch) {
+  if (!g_direct_head || g_unordered || yarn_epoch_first() != epoch) {
+    return false;
+  }
+  if (yarn_readv(&g_predict_counts[YARN_BIT_INDEX(epoch, g_epoch_max)]) != 0) {
+    return false;
+  }
+  return yarn_epoch_get_status(epoch) == yarn_epoch_executing && 
+    !yarn_epoch_is_past_stop(epoch);
+}
+
+/*
+An epoch that became the head mid-execution may have buffered writes that its loads 
+still need to see. Only the owner of the epoch touches the list so no sync is required.
+ */
+static inline bool has_buffered_info (yarn_word_t epoch) {
+  return g_info_list[YARN_BIT_INDEX(epoch, g_epoch_max)] != NULL;
+}
+
+static inline void store_head (struct addr_info* info, 
+			       yarn_word_t epoch, 
+			       const void* src, 
+			       void* dest) 
+{
+  // Keep going through the buffer or the commit would overwrite the new value.
+  if (g_lazy && is_write_buffered(info, epoch)) {
+    store_lazy(info, epoch, src);
+  }
+  else if (is_write_buffered(info, epoch)) {
+    store_to_wbuf(info, epoch, src, dest);
+  }
+  else {
+    train_predictor(info, epoch, *((yarn_word_t* volatile) src));
+    *((yarn_word_t* volatile) dest) = *((yarn_word_t* volatile) src);
+
+    // No write flag is set so this is how sync_load knows that we wrote the address.
+    yarn_writev(&info->head_store, epoch);
+
+    // Orders the write with the read flags check. Pairs with the read flag set in 
+    // load_from_wbuf so that a younger epoch either sees the value or gets rolled back.
+    yarn_mem_barrier();
+
+    DBG printf("[%3zu] STORE    -> {"YARN_SHEX"}=%zu - HEAD\n",
+	       epoch, YARN_AHEX((uintptr_t)info->addr), *((yarn_word_t*) dest));
+  }
+
+  // Lazy readers will find the new value in memory when they validate.
+  if (!g_lazy) {
+    dep_violation_check(info, epoch, *((yarn_word_t*) src));
+  }
+}
+
+/*
+No older epoch is left so the only values that can't be found in memory are the ones the
+epoch buffered itself. No read flag is set since no one can invalidate the read.
+ */
+static inline void load_head (struct addr_info* info, 
+			      yarn_word_t epoch, 
+			      const void* src, 
+			      void* dest)
+{
+  if (info != NULL && is_write_buffered(info, epoch)) {
+    const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+    *((yarn_word_t* volatile) dest) = info->write_buffer[epoch_index];
+  }
+  else {
+    *((yarn_word_t* volatile) dest) = *((yarn_word_t* volatile) src);
+  }
+
+  DBG printf("[%3zu] LOAD     -> {"YARN_SHEX"}=%zu - HEAD\n",
+	     epoch, YARN_AHEX((uintptr_t)src), *((yarn_word_t*) dest));
+}
+
+
+
+/*!
+Looks for the earliest epoch within [first_epoch, last_epoch) that has its flag set.
+ */
+static inline bool find_first_epoch (yarn_atomic_var* flags, 
+				     yarn_word_t first_epoch, 
+				     yarn_word_t last_epoch,
+				     yarn_word_t* epoch)
+{
+  if (first_epoch >= last_epoch) {
+    return false;
+  }
 
   const yarn_word_t first_index = YARN_BIT_INDEX(first_epoch, g_epoch_max);
   const yarn_word_t last_index = YARN_BIT_INDEX(last_epoch, g_epoch_max);
 
-  yarn_word_t flags;
+  yarn_word_t index;
+  bool found;
+
   if (first_index < last_index) {
-    // Must use the epochs here (the index might be equal but the epochs might not).
-    flags = read_flags & yarn_bit_mask_range(first_epoch, last_epoch, g_epoch_max);
+    found = find_first_flag(flags, first_index, last_index, &index);
   }
   else {
-    flags = read_flags & yarn_bit_mask_range(first_index, g_epoch_max, g_epoch_max);
-    if (flags == 0) {
-      flags = read_flags & yarn_bit_mask_range(0, last_index, g_epoch_max);
+    found = find_first_flag(flags, first_index, g_epoch_max, &index) ||
+      find_first_flag(flags, 0, last_index, &index);
+  }
+
+  if (found) {
+    *epoch = index_to_epoch_after(first_epoch, index);
+  }
+  return found;
+}
+
+
+static inline void dep_violation_check (struct addr_info* info, 
+					yarn_word_t epoch, 
+					yarn_word_t value) 
+{
+  yarn_word_t first_epoch = epoch+1;
+  yarn_word_t last_epoch = yarn_epoch_last();
+  yarn_word_t rollback_epoch;
+
+  // Rolling back the earliest read also rolls back everything that follows it. Readers
+  // that correctly predicted the value are left to yarn_dep_validate.
+  if (yarn_epoch_get_rollback_mode() != yarn_epoch_rollback_selective) {
+    while (find_first_epoch(info->read_flags, first_epoch, last_epoch, &rollback_epoch)) {
+      if (is_predicted(info, rollback_epoch, epoch, value)) {
+	first_epoch = rollback_epoch+1;
+	continue;
+      }
+
+      add_conflict(info);
+      add_violation(info, rollback_epoch);
+      DBG printf("[%3zu] VIOLATION-> [%3zu]\n", epoch, rollback_epoch);
+      break;
+    }
+    return;
+  }
+
+  // Selective rollbacks don't cascade so every stale read has to be rolled back. The
+  // reads that follow the next write to the address saw that write so they're safe.
+  yarn_word_t write_epoch;
+  if (find_first_epoch(info->write_flags, first_epoch, last_epoch, &write_epoch)) {
+    last_epoch = write_epoch+1;
+  }
+
+  while (find_first_epoch(info->read_flags, first_epoch, last_epoch, &rollback_epoch)) {
+    if (!is_predicted(info, rollback_epoch, epoch, value)) {
+      add_conflict(info);
+      add_violation(info, rollback_epoch);
+      DBG printf("[%3zu] VIOLATION-> [%3zu]\n", epoch, rollback_epoch);
     }
+
+    first_epoch = rollback_epoch+1;
+  }
+}
+
+
+// The count is only a heuristic so the races on the update are harmless.
+static inline void add_conflict (struct addr_info* info) {
+  const yarn_word_t conflicts = yarn_readv(&info->conflicts);
+  if (conflicts < YARN_DEP_SYNC_MAX) {
+    yarn_writev(&info->conflicts, conflicts + 1);
   }
+}
 
-  if (flags == 0) {
+/*
+The address is flagged before the rollback so that the reader finds it once it notices 
+that it's being rolled back. See restart_epoch.
+ */
+static inline void add_violation (struct addr_info* info, yarn_word_t epoch) {
+  set_flag(info->violation_flags, epoch);
+  yarn_epoch_do_partial_rollback(epoch);
+}
+
+
+
+static inline void reset_checkpoints (yarn_word_t epoch) {
+  struct checkpoint_set* set = &g_checkpoints[YARN_BIT_INDEX(epoch, g_epoch_max)];
+  set->count = 0;
+  set->is_restartable = true;
+  set->undo_size = 0;
+}
+
+/*
+A rollback caused by a write to an address that the epoch first accessed after one of its
+checkpoints only invalidates the work done since that checkpoint. Once the epoch notices
+the rollback, we look for the earliest of those addresses, throw away everything that 
+was done since the checkpoint that precedes it and resume the execution from there. 
+
+The work is thrown away while the epoch is still flagged as rolled back so no one can read
+the values being undone. If the restart fails then the epoch was rolled back for another 
+reason and it will be executed again from scratch. Either way, we only try once.
+
+Readers of the writes that are kept skipped them while the epoch was flagged. With 
+selective rollbacks they could have been dispatched in the meantime so the writes are 
+checked again. Otherwise, nothing past the epoch could be handed out.
+ */
+static inline void restart_epoch (yarn_word_t epoch, struct checkpoint_set* set) {
+  set->is_restartable = false;
+
+  const yarn_word_t gen = yarn_epoch_rollback_gen(epoch);
+
+  yarn_word_t restart = 0;
+  if (!find_restart_point(epoch, set, &restart)) {
     return;
-  }    
+  }
 
-  yarn_word_t rollback_index = yarn_bit_trailing_zeros(flags);
-  yarn_word_t rollback_epoch = index_to_epoch_after(epoch, rollback_index);
-  yarn_epoch_do_rollback(rollback_epoch);
+  undo_checkpoint(epoch, set, restart);
+  if (!yarn_epoch_restart(epoch, gen)) {
+    return;
+  }
 
-  DBG printf("[%3zu] VIOLATION-> [%3zu]\n", epoch, rollback_epoch);
+  if (yarn_epoch_get_rollback_mode() == yarn_epoch_rollback_selective) {
+    const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+    struct addr_info* info = g_info_list[epoch_index];
+    for (; info != NULL; info = info->info_list[epoch_index]) {
+      if (is_flag_set(info->write_flags, epoch)) {
+	dep_violation_check(info, epoch, info->write_buffer[epoch_index]);
+      }
+    }
+  }
+
+  DBG printf("[%3zu] RESTART  -> %zu\n", epoch, restart);
+
+  set->is_restartable = true;
+  longjmp(set->checkpoints[restart].context, 1);
 }
 
+static inline void restart_check (yarn_word_t epoch) {
+  struct checkpoint_set* set = &g_checkpoints[YARN_BIT_INDEX(epoch, g_epoch_max)];
+  if (set->count > 0 && set->is_restartable && is_epoch_aborted(epoch)) {
+    restart_epoch(epoch, set);
+  }
+}
 
+/*
+Walks the info list from the latest access to the earliest while keeping track of the 
+latest checkpoint that was taken before the current address was first accessed. Fails if
+an address that caused the rollback was accessed before the first checkpoint or if none
+of the addresses caused the rollback.
+ */
+static inline bool find_restart_point (yarn_word_t epoch, 
+				       struct checkpoint_set* set,
+				       yarn_word_t* restart)
+{
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  yarn_word_t count = set->count;
+  bool found = false;
 
+  struct addr_info* info = g_info_list[epoch_index];
+  for (; info != NULL; info = info->info_list[epoch_index]) {
+    while (count > 0 && set->checkpoints[count-1].watermark == info) {
+      count--;
+    }
 
+    if (!is_flag_set(info->violation_flags, epoch)) {
+      continue;
+    }
+    if (count == 0) {
+      return false;
+    }
 
-static inline yarn_word_t set_write_flag (struct addr_info* info, yarn_word_t epoch) {
-  yarn_word_t old_flags;
-  yarn_word_t new_flags;
-  do {
-    old_flags = yarn_readv(&info->flags);
-    
-    yarn_word_t read_flags;
-    yarn_word_t write_flags;
-    yarn_bit_unpack(old_flags, &read_flags, &write_flags);
+    *restart = count-1;
+    found = true;
+  }
+
+  return found;
+}
+
+static inline void undo_checkpoint (yarn_word_t epoch, 
+				    struct checkpoint_set* set, 
+				    yarn_word_t restart)
+{
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  const struct checkpoint* checkpoint = &set->checkpoints[restart];
 
-    yarn_word_t mask = YARN_BIT_MASK(epoch, g_epoch_max);
-    if (write_flags & mask) {
-      return old_flags;
+  for (size_t i = set->undo_size; i > checkpoint->undo_size; --i) {
+    const struct undo_entry* entry = &set->undo[i-1];
+    if (entry->is_written) {
+      entry->info->write_buffer[epoch_index] = entry->value;
+    }
+    else if (g_lazy) {
+      entry->info->lazy_access[epoch_index] &= ~YARN_DEP_LAZY_WRITE;
     }
     else {
-      write_flags |= mask;
+      clear_flag(entry->info->write_flags, epoch);
     }
+  }
+  set->undo_size = checkpoint->undo_size;
 
-    new_flags = yarn_bit_pack(read_flags, write_flags);
-  } while (yarn_casv(&info->flags, old_flags, new_flags) != old_flags);
+  while (g_info_list[epoch_index] != checkpoint->watermark) {
+    struct addr_info* info = info_list_pop(epoch);
 
-  return new_flags;
+    if (is_read_recorded(info, epoch)) {
+      yarn_decv(&g_predict_counts[epoch_index]);
+    }
+
+    clear_flag(info->read_flags, epoch);
+    clear_flag(info->write_flags, epoch);
+    clear_flag(info->predict_flags, epoch);
+    clear_flag(info->violation_flags, epoch);
+    info->lazy_access[epoch_index] = 0;
+  }
+
+  // The values produced after the checkpoint will be produced again.
+  clear_channels(epoch);
+  set->count = restart+1;
 }
 
-static inline yarn_word_t set_read_flag (struct addr_info* info, yarn_word_t epoch) {
-  yarn_word_t old_flags;
-  yarn_word_t new_flags;
-  do {
-    old_flags = yarn_readv(&info->flags);
-    
-    yarn_word_t read_flags;
-    yarn_word_t write_flags;
-    yarn_bit_unpack(old_flags, &read_flags, &write_flags);
+/*
+Addresses with no flags set were just pushed on the info list by this access so they're
+dropped on a restart and don't need an entry. If the log can't grow then the epoch can no
+longer be restarted.
+ */
+static inline void undo_log_push (yarn_word_t epoch, struct addr_info* info) {
+  struct checkpoint_set* set = &g_checkpoints[YARN_BIT_INDEX(epoch, g_epoch_max)];
+
+  const bool is_written = is_write_buffered(info, epoch);
+  const bool is_read = g_lazy ? 
+    is_read_recorded(info, epoch) : is_flag_set(info->read_flags, epoch);
+  if (!is_written && !is_read) {
+    return;
+  }
+
+  if (set->undo_size == set->undo_capacity) {
+    const size_t capacity = 
+      set->undo_capacity ? set->undo_capacity * 2 : YARN_DEP_UNDO_SIZE;
+    struct undo_entry* undo = 
+      (struct undo_entry*) realloc(set->undo, capacity * sizeof(struct undo_entry));
+    if (!undo) goto alloc_error;
+
+    set->undo = undo;
+    set->undo_capacity = capacity;
+  }
+
+  struct undo_entry* entry = &set->undo[set->undo_size++];
+  entry->info = info;
+  entry->is_written = is_written;
+  entry->value = info->write_buffer[YARN_BIT_INDEX(epoch, g_epoch_max)];
+  return;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  set->is_restartable = false;
+}
+
+/*
+Loop counters, running pointers and accumulators are usually written once per epoch with
+a regular delta. If the previous epoch is still executing, it's about to write a new 
+value so instead of reading the stale one from memory we extrapolate from the last 
+committed value. The same prediction is returned for every load of the epoch so that the 
+epoch has a consistent view of the address.
+ */
+static inline bool predict_value (struct addr_info* info, 
+				  yarn_word_t epoch, 
+				  yarn_word_t* value) 
+{
+  if (!g_predict) {
+    return false;
+  }
+
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+
+  if (is_flag_set(info->predict_flags, epoch)) {
+    *value = info->predictions[epoch_index];
+    return true;
+  }
+
+  if (info->pred_hits < YARN_DEP_PREDICT_THRESHOLD || !is_executing(epoch-1)) {
+    return false;
+  }
+
+  // The fields can be torn by a concurrent commit but that's just a bad prediction.
+  const yarn_word_t pred_epoch = info->pred_epoch;
+  if (yarn_timestamp_comp(pred_epoch, epoch) >= 0) {
+    return false;
+  }
+  *value = info->pred_value + info->pred_stride * (epoch - 1 - pred_epoch);
+
+  // Publish the value before the flag. Pairs with the check in dep_violation_check.
+  info->predictions[epoch_index] = *value;
+  set_flag(info->predict_flags, epoch);
+  yarn_incv(&g_predict_counts[epoch_index]);
+
+  DBG printf("[%3zu] PREDICT  -> {"YARN_SHEX"}=%zu\n",
+	     epoch, YARN_AHEX((uintptr_t)info->addr), *value);
+
+  return true;
+}
+
+/*
+Returns true if a write doesn't invalidate the prediction of the epoch. The prediction is 
+for the value of the previous epoch so any older write should eventually be overwritten.
+ */
+static inline bool is_predicted (struct addr_info* info, 
+				 yarn_word_t epoch, 
+				 yarn_word_t writer,
+				 yarn_word_t value) 
+{
+  if (!is_flag_set(info->predict_flags, epoch)) {
+    return false;
+  }
+
+  const yarn_word_t epoch_index = YARN_BIT_INDEX(epoch, g_epoch_max);
+  return writer+1 != epoch || info->predictions[epoch_index] == value;
+}
+
+/*
+Called for each write that makes it to memory, in epoch order, either with the commit lock
+held or by the head. A gap in the epochs is fine as long as the value is still on the 
+stride but multiple writes by the same epoch throw off the predictor.
+ */
+static inline void train_predictor (struct addr_info* info, 
+				    yarn_word_t epoch, 
+				    yarn_word_t value) 
+{
+  if (!g_predict) {
+    return;
+  }
+
+  const yarn_word_t gap = epoch - info->pred_epoch;
 
-    yarn_word_t mask = YARN_BIT_MASK(epoch, g_epoch_max);
-    if (read_flags & mask) {
-      return old_flags;
+  if (value == info->pred_value + info->pred_stride * gap) {
+    if (info->pred_hits < YARN_DEP_PREDICT_MAX) {
+      info->pred_hits++;
     }
-    else {
-      read_flags |= mask;
+  }
+  else {
+    info->pred_hits = 0;
+    if (gap == 1) {
+      info->pred_stride = value - info->pred_value;
     }
+  }
+
+  info->pred_epoch = epoch;
+  info->pred_value = value;
+}
 
-    new_flags = yarn_bit_pack(read_flags, write_flags);
-  } while (yarn_casv(&info->flags, old_flags, new_flags) != old_flags);
 
-  return new_flags;
+/*
+Returns true if the producer is still executing. Once the producer is committed its slot 
+can be reused by a younger epoch so first is checked after the status.
+ */
+static inline bool is_executing (yarn_word_t producer) {
+  return yarn_epoch_get_status(producer) == yarn_epoch_executing &&
+    yarn_timestamp_comp(producer, yarn_epoch_first()) >= 0;
 }
 
-static inline yarn_word_t clear_flags (struct addr_info* info, yarn_word_t epoch) {
-  yarn_word_t old_flags;
-  yarn_word_t new_flags;
+/*
+Returns true if the producer wrote to the address. The head writes straight to memory 
+without a write flag so its last direct store is also checked.
+ */
+static inline bool has_written (struct addr_info* info, yarn_word_t producer) {
+  return is_flag_set(info->write_flags, producer) || 
+    yarn_readv(&info->head_store) == producer;
+}
 
-  yarn_word_t read_flags;
-  yarn_word_t write_flags;
+// Returns true if the producer is still executing and didn't write to the address yet.
+static inline bool is_producing (struct addr_info* info, yarn_word_t producer) {
+  return !has_written(info, producer) && is_executing(producer);
+}
 
-  yarn_word_t mask;
+/*
+An address that keeps causing rollbacks is most likely about to be written by one of the 
+older epochs so, instead of reading a stale value, we wait until each older epoch either 
+wrote the address or is done. The load then picks up the forwarded value. 
 
-  do {
-    old_flags = yarn_readv(&info->flags);
-    
-    yarn_bit_unpack(old_flags, &read_flags, &write_flags);
+Only executing epochs are waited on and the head never waits so someone is always making
+progress. The accesses are still tracked so a late write is caught like any other
+violation. If we had to wait on an older epoch and none of them wrote the address, the 
+wait was for nothing and the conflict count is lowered. Epochs that are done or already
+committed say nothing about whether the heuristic is useful so they leave the count alone.
+ */
+static inline void sync_load (struct addr_info* info, yarn_word_t epoch) {
+  if (yarn_readv(&info->conflicts) < YARN_DEP_SYNC_THRESHOLD) {
+    return;
+  }
+  // No need to wait on a value that we can predict.
+  if (g_predict && info->pred_hits >= YARN_DEP_PREDICT_THRESHOLD) {
+    return;
+  }
+  if (is_flag_set(info->write_flags, epoch)) {
+    return;
+  }
+
+  bool is_waited = false;
+  bool is_written = false;
 
-    mask = YARN_BIT_MASK(epoch, g_epoch_max);
-    read_flags &= ~mask;
-    write_flags &= ~mask;
+  for (yarn_word_t producer = yarn_epoch_first(); 
+       yarn_timestamp_comp(producer, epoch) < 0; 
+       ++producer)
+  {
+    while (is_producing(info, producer)) {
+      if (is_epoch_aborted(epoch)) {
+	return;
+      }
+      is_waited = true;
+      sched_yield();
+    }
+    is_written = is_written || has_written(info, producer);
+  }
 
-    new_flags = yarn_bit_pack(read_flags, write_flags);
-  } while (yarn_casv(&info->flags, old_flags, new_flags) != old_flags);
+  if (is_waited && !is_written) {
+    const yarn_word_t conflicts = yarn_readv(&info->conflicts);
+    if (conflicts > 0) {
+      yarn_writev(&info->conflicts, conflicts - 1);
+    }
+  }
+}
 
-  DBG printf("[%3zu] CLEAR    -> old_flags="YARN_SHEX", new_flags="YARN_SHEX
-	     ", rf="YARN_SHEX", wf="YARN_SHEX", mask="YARN_SHEX"\n",
-	     epoch, YARN_AHEX(old_flags), YARN_AHEX(new_flags),
-	     YARN_AHEX(read_flags), YARN_AHEX(write_flags), YARN_AHEX(mask));
 
-  return old_flags;
+static inline yarn_atomic_var* get_channel_flags (yarn_word_t index_id) {
+  assert(index_id < g_info_index_size);
+  return &g_channel_flags[index_id * g_epoch_words];
+}
+
+static inline yarn_atomic_var* get_producer_flags (void) {
+  return &g_channel_flags[g_info_index_size * g_epoch_words];
+}
+
+static inline bool alloc_channels (yarn_word_t index_size) {
+  const size_t count = (index_size + 1) * g_epoch_words;
+
+  yarn_atomic_var* flags = 
+    (yarn_atomic_var*) realloc(g_channel_flags, count * sizeof(yarn_atomic_var));
+  if (!flags) {
+    return false;
+  }
+
+  g_channel_flags = flags;
+  for (size_t i = 0; i < count; ++i) {
+    yarn_writev(&g_channel_flags[i], 0);
+  }
+  return true;
+}
+
+/*
+Called once the epoch is committed or rolled back, before its slot can be reused. Most
+loops never use the channels so the indexes are only scanned if the epoch produced 
+something.
+ */
+static inline void clear_channels (yarn_word_t epoch) {
+  yarn_atomic_var* producers = get_producer_flags();
+  if (!is_flag_set(producers, epoch)) {
+    return;
+  }
+  clear_flag(producers, epoch);
+
+  for (yarn_word_t index_id = 0; index_id < g_info_index_size; ++index_id) {
+    yarn_atomic_var* flags = get_channel_flags(index_id);
+    if (is_flag_set(flags, epoch)) {
+      clear_flag(flags, epoch);
+    }
+  }
+}
+
+/*
+The consumer only needs the value of the previous epoch so it waits until that epoch 
+produced the value or stopped executing. The waits are expected to be short so we spin 
+for a while before yielding. Like sync_load, the load is still tracked so if the 
+producer writes the value again later the consumer gets rolled back as usual.
+ */
+static inline void wait_channel (yarn_word_t index_id, yarn_word_t epoch) {
+  const yarn_word_t producer = epoch - 1;
+  yarn_atomic_var* flags = get_channel_flags(index_id);
+
+  for (size_t spins = 0; 
+       !is_flag_set(flags, producer) && is_executing(producer); 
+       ++spins)
+  {
+    if (is_epoch_aborted(epoch)) {
+      return;
+    }
+    if (spins >= YARN_DEP_CHANNEL_SPIN) {
+      sched_yield();
+    }
+  }
+}
+
+
+/*
+A commit makes every read of the address by an unordered epoch stale, whether the reader
+comes before or after the committing epoch. Only the readers are rolled back since they're
+free to be serialized after the commit.
+ */
+static inline void invalidate_readers (struct addr_info* info, yarn_word_t epoch) {
+  const yarn_word_t last_epoch = yarn_epoch_last();
+  yarn_word_t reader = yarn_epoch_first();
+
+  while (find_first_epoch(info->read_flags, reader, last_epoch, &reader)) {
+    if (reader != epoch) {
+      yarn_epoch_do_rollback(reader);
+      DBG printf("[%3zu] CONFLICT -> [%3zu]\n", epoch, reader);
+    }
+    reader++;
+  }
+}
+
+
+
+/*!
+Scans the words of a flag bitfield for the lowest set bit within 
+[first_index, last_index) that doesn't belong to a rolled back epoch.
+ */
+static inline bool find_first_flag (yarn_atomic_var* flags, 
+				    yarn_word_t first_index, 
+				    yarn_word_t last_index,
+				    yarn_word_t* index)
+{
+  if (first_index >= last_index) {
+    return false;
+  }
+
+  const yarn_word_t last_word = (last_index-1) / YARN_WORD_BIT_SIZE;
+  for (yarn_word_t word = first_index / YARN_WORD_BIT_SIZE; word <= last_word; ++word) {
+    yarn_word_t masked_flags = yarn_readv(&flags[word]);
+    masked_flags &= ~yarn_epoch_rollback_flags(word);
+    masked_flags &= yarn_bit_mask_range_word(first_index, last_index, g_epoch_max, word);
+
+    if (masked_flags) {
+      *index = word * YARN_WORD_BIT_SIZE + yarn_bit_trailing_zeros(masked_flags);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*!
+Scans the words of a flag bitfield for the highest set bit within 
+[first_index, last_index) that doesn't belong to a rolled back epoch.
+ */
+static inline bool find_last_flag (yarn_atomic_var* flags, 
+				   yarn_word_t first_index, 
+				   yarn_word_t last_index,
+				   yarn_word_t* index)
+{
+  if (first_index >= last_index) {
+    return false;
+  }
+
+  const yarn_word_t first_word = first_index / YARN_WORD_BIT_SIZE;
+  for (yarn_word_t word = (last_index-1) / YARN_WORD_BIT_SIZE + 1; word > first_word; --word) {
+    yarn_word_t masked_flags = yarn_readv(&flags[word-1]);
+    masked_flags &= ~yarn_epoch_rollback_flags(word-1);
+    masked_flags &= yarn_bit_mask_range_word(first_index, last_index, g_epoch_max, word-1);
+
+    if (masked_flags) {
+      *index = (word-1) * YARN_WORD_BIT_SIZE + yarn_bit_log2(masked_flags);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+
+static inline bool is_flag_set (yarn_atomic_var* flags, yarn_word_t epoch) {
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(epoch, g_epoch_max);
+  return (yarn_readv(&flags[YARN_BIT_WORD(epoch, g_epoch_max)]) & mask) != 0;
+}
+
+static inline void set_flag (yarn_atomic_var* flags, yarn_word_t epoch) {
+  yarn_atomic_var* flag = &flags[YARN_BIT_WORD(epoch, g_epoch_max)];
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(epoch, g_epoch_max);
+
+  yarn_word_t old_flags;
+  yarn_word_t new_flags;
+  do {
+    old_flags = yarn_readv(flag);
+    if (old_flags & mask) {
+      yarn_mem_barrier();
+      return;
+    }
+    new_flags = old_flags | mask;
+  } while (yarn_casv(flag, old_flags, new_flags) != old_flags);
+}
+
+static inline void clear_flag (yarn_atomic_var* flags, yarn_word_t epoch) {
+  yarn_atomic_var* flag = &flags[YARN_BIT_WORD(epoch, g_epoch_max)];
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(epoch, g_epoch_max);
+
+  yarn_word_t old_flags;
+  yarn_word_t new_flags;
+  do {
+    old_flags = yarn_readv(flag);
+    new_flags = old_flags & ~mask;
+  } while (yarn_casv(flag, old_flags, new_flags) != old_flags);
 }
 
 
@@ -793,30 +2243,18 @@ static inline void alignment_check (const void* addr) {
 
 
 static inline void dump_info(struct addr_info* info) {
-  yarn_word_t flags = yarn_readv(&info->flags);
-  printf("INFO["YARN_SHEX"] -> commit=%zu, flags="YARN_SHEX"\n", 
-	 YARN_AHEX((uintptr_t)info->addr), yarn_readv(&info->last_commit), 
-	 YARN_AHEX(flags));
-
-  
-  /*
   printf("INFO["YARN_SHEX"] -> commit=%zu", 
-	 YARN_AHEX((uintptr_t)info->addr), info->last_commit);
+	 YARN_AHEX((uintptr_t)info->addr), yarn_readv(&info->last_commit));
 
-  printf(", writef=");
-  dump_flags(info->write_flags);
   printf(", readf=");
-  dump_flags(info->read_flags);
-  */
-  /*
-  printf (", wbuf={");
-  for (yarn_word_t i = 0; i < g_epoch_max; ++i) {
-    if ((info->write_flags & YARN_BIT_MASK(i)) != 0) {
-      printf("%zu -> "YARN_SHEX", ", i, YARN_AHEX(info->write_buffer[i]));
-    }
+  for (yarn_word_t i = 0; i < g_epoch_words; ++i) {
+    dump_flags(yarn_readv(&info->read_flags[i]));
+  }
+  printf(", writef=");
+  for (yarn_word_t i = 0; i < g_epoch_words; ++i) {
+    dump_flags(yarn_readv(&info->write_flags[i]));
   }
-  printf("}\n");
-  */
+  printf("\n");
 }
 
 static inline void dump_flags(yarn_word_t f) {
@@ -826,7 +2264,7 @@ static inline void dump_flags(yarn_word_t f) {
   while (f != 0) {
 
     b = yarn_bit_log2(f);
-    f = YARN_BIT_CLEAR(f, b, g_epoch_max);
+    f = YARN_BIT_CLEAR(f, b, YARN_WORD_BIT_SIZE);
 
     printf("%zu", b);
     if (f != 0) printf(",");
@@ -17,11 +17,13 @@ the epochs to infinity and still keep the comparaison coherent.
 #include "timestamp.h"
 #include "atomic.h"
 #include "bits.h"
+#include "park.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <sched.h>
 
 #define YARN_DBG 0
 #include "dbg.h"
@@ -30,11 +32,26 @@ the epochs to infinity and still keep the comparaison coherent.
 
 struct epoch_info {
   yarn_atomic_var status;
+
+  // Sequence number of the slot. See SEQ_FREE and SEQ_CLAIMED.
+  yarn_atomic_var seq;
+
+  // Bumped by every rollback that hits the epoch while it's executing. Only written with
+  // g_rollback_lock held. See yarn_epoch_restart.
+  yarn_atomic_var rollback_gen;
+  yarn_atomic_var is_partial;
+
   void* task;
 };
 
+// The slot can be claimed by the epoch.
+#define SEQ_FREE(epoch) ((epoch)*2)
+// The slot was claimed by the epoch.
+#define SEQ_CLAIMED(epoch) ((epoch)*2+1)
+
 
 static yarn_word_t g_epoch_max;
+static yarn_word_t g_epoch_words;
 
 static struct epoch_info* g_epoch_list;
 
@@ -43,20 +60,58 @@ static yarn_atomic_var g_epoch_first;
 static yarn_atomic_var g_epoch_next;
 static yarn_atomic_var g_epoch_next_commit;
 
-// Bitfield that keeps track of the all the rolledback epochs.
-static yarn_atomic_var g_rollback_flag;
+// Multi-word bitfield that keeps track of the all the rolledback epochs.
+static yarn_atomic_var* g_rollback_flag;
+
+// Number of epochs currently in the rollback status.
+static yarn_atomic_var g_rollback_count;
+
+static enum yarn_epoch_rollback_mode g_rollback_mode;
 
-// Prevents a call to rollback from being executed while calling next.
-// Still allows multiple calls the next at the same time but with only one
-// active for a given epoch.
+// Multi-word bitfields (g_epoch_words per epoch) of the epochs that each epoch read a
+// buffered value from. Only used for selective rollbacks.
+static yarn_atomic_var* g_forward_flags;
+
+// Prevents multiple rollbacks from being executed at the same time.
 static pthread_mutex_t g_rollback_lock;
 
-static pthread_mutex_t g_next_lock;
-static pthread_cond_t g_next_cond;
+// Where the threads wait when no epochs can be handed out by next.
+static struct yarn_park g_next_park;
+
+// Gives the threads something to do before they get parked.
+static yarn_epoch_idle_t g_idle;
+
+// Gets the last word on whether a done epoch can be committed.
+static yarn_epoch_validate_t g_validate;
 
 // Indicates an epoch that stops the calculations.
 static yarn_atomic_var g_epoch_stop;
 
+// Number of epochs that can be handed out past g_epoch_first.
+static yarn_atomic_var g_epoch_depth;
+static bool g_depth_adaptive;
+
+// Sliding window used to measure the rollback ratio. See update_window.
+static yarn_atomic_var g_depth_commits;
+static yarn_atomic_var g_depth_rollbacks;
+// Number of rollbacks triggered within the window, regardless of how many epochs each hit.
+static yarn_atomic_var g_depth_violations;
+
+// Epochs before this bound are executed one at a time. See update_watchdog.
+static bool g_watchdog;
+static yarn_atomic_var g_serial_end;
+static yarn_word_t g_serial_length;
+
+// Predicted end bound of the loop or 0 if unknown. See yarn_epoch_set_end_hint.
+static yarn_word_t g_epoch_end_hint;
+
+// Declared dependence distance or 0 if unknown. See yarn_epoch_set_distance.
+static yarn_word_t g_dep_distance;
+
+// Epochs are committed in any order. See yarn_epoch_claim_commit.
+static bool g_unordered;
+static pthread_mutex_t g_commit_lock;
+
 
 
 static inline bool is_stop_set(yarn_word_t stop_epoch);
@@ -82,27 +137,42 @@ bool yarn_epoch_init(void) {
   ret = pthread_mutex_init(&g_rollback_lock, NULL);
   if (ret) goto rollback_lock_error;
 
-  ret = pthread_mutex_init(&g_next_lock, NULL);
-  if (ret) goto next_lock_error;
+  ret = pthread_mutex_init(&g_commit_lock, NULL);
+  if (ret) goto commit_lock_error;
 
-  ret = pthread_cond_init(&g_next_cond, NULL);
-  if (ret) goto next_cond_error;
+  yarn_park_init(&g_next_park);
 
   g_epoch_max = yarn_epoch_max();
+  g_epoch_words = YARN_BIT_WORDS(g_epoch_max);
 
   g_epoch_list = malloc(g_epoch_max * sizeof(struct epoch_info));
   if (!g_epoch_list) goto alloc_error;
 
+  g_rollback_flag = malloc(g_epoch_words * sizeof(yarn_atomic_var));
+  if (!g_rollback_flag) goto flag_alloc_error;
+
+  g_forward_flags = malloc(g_epoch_max * g_epoch_words * sizeof(yarn_atomic_var));
+  if (!g_forward_flags) goto forward_alloc_error;
+
+  g_rollback_mode = yarn_epoch_rollback_all;
+  g_depth_adaptive = false;
+  g_watchdog = false;
+  g_unordered = false;
+  g_dep_distance = 0;
+  g_idle = NULL;
+  g_validate = NULL;
   yarn_epoch_reset();
 
   return true;
  
-  //free(g_epoch_list);
+  //free(g_forward_flags);
+ forward_alloc_error:
+  free(g_rollback_flag);
+ flag_alloc_error:
+  free(g_epoch_list);
  alloc_error:
-  pthread_mutex_destroy(&g_next_lock);
- next_cond_error:
-  pthread_cond_destroy(&g_next_cond);
- next_lock_error:
+  pthread_mutex_destroy(&g_commit_lock);
+ commit_lock_error:
   pthread_mutex_destroy(&g_rollback_lock);
  rollback_lock_error:
   perror(__FUNCTION__);
@@ -114,37 +184,61 @@ bool yarn_epoch_reset(void) {
 
   for (size_t i = 0; i < g_epoch_max; ++i) {
     yarn_writev(&g_epoch_list[i].status, yarn_epoch_commit);
+    yarn_writev(&g_epoch_list[i].seq, SEQ_FREE(i));
+    yarn_writev(&g_epoch_list[i].rollback_gen, 0);
+    yarn_writev(&g_epoch_list[i].is_partial, false);
     g_epoch_list[i].task = NULL;
   }
 
   yarn_writev(&g_epoch_first, 0);
   yarn_writev(&g_epoch_next, 0);
   yarn_writev(&g_epoch_next_commit, 0);
-  yarn_writev(&g_rollback_flag, 0);
+  for (size_t i = 0; i < g_epoch_words; ++i) {
+    yarn_writev(&g_rollback_flag[i], 0);
+  }
+  for (size_t i = 0; i < g_epoch_max * g_epoch_words; ++i) {
+    yarn_writev(&g_forward_flags[i], 0);
+  }
+  yarn_writev(&g_rollback_count, 0);
   yarn_writev(&g_epoch_stop, -1);  
 
+  yarn_writev(&g_epoch_depth, g_epoch_max);
+  yarn_writev(&g_depth_commits, 0);
+  yarn_writev(&g_depth_rollbacks, 0);
+  yarn_writev(&g_depth_violations, 0);
+
+  yarn_writev(&g_serial_end, 0);
+  g_serial_length = YARN_EPOCH_SERIAL_MIN;
+
+  g_epoch_end_hint = 0;
+
   return true;
 }
 
 void yarn_epoch_destroy(void) {
+  free(g_forward_flags);
+  free(g_rollback_flag);
   free(g_epoch_list);
-  pthread_cond_destroy(&g_next_cond);
-  pthread_mutex_destroy(&g_next_lock);
+  pthread_mutex_destroy(&g_commit_lock);
   pthread_mutex_destroy(&g_rollback_lock);
 }
 
 
 
 /*
-Since dep uses bitfields to store the read and write flags we're bounded by the size
-of yarn_word_t. Also, dep packs both the read and write flags within the same word
-so we can only use half the size of yarn_word_t.
+dep stores the read and write flags in multi-word bitfields so we're no longer bounded by
+the size of yarn_word_t. The size is rounded up to a power of two so that the epoch
+indexes can be computed with a mask instead of a modulo.
  */
 yarn_word_t yarn_epoch_max(void) {
-  yarn_word_t max_size = YARN_WORD_BIT_SIZE / 2;
   yarn_word_t optimal_size = yarn_tpool_size()*2;
 
-  return optimal_size < max_size ? optimal_size : max_size;
+  yarn_word_t size = 2;
+  while (size < optimal_size && size < YARN_EPOCH_MAX_SIZE) {
+    size <<= 1;
+  }
+
+  return size;
 }
 
 
@@ -156,86 +250,246 @@ yarn_word_t yarn_epoch_last(void) {
   return yarn_readv(&g_epoch_next);
 }
 
-static inline bool inc_epoch_next (yarn_word_t* next_epoch) {
-  int attempts = 0;
-  (void) attempts; // Warning suppression.
+static inline yarn_atomic_var* get_forward_flags (yarn_word_t epoch) {
+  return &g_forward_flags[get_epoch_index(epoch) * g_epoch_words];
+}
+
+static inline bool is_rollback_flag_set (yarn_word_t epoch) {
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(epoch, g_epoch_max);
+  return (yarn_readv(&g_rollback_flag[YARN_BIT_WORD(epoch, g_epoch_max)]) & mask) != 0;
+}
 
-  yarn_word_t cur_next;
-  bool retry = false;
+static inline void set_rollback_flag(yarn_word_t epoch) {
+  yarn_atomic_var* flag = &g_rollback_flag[YARN_BIT_WORD(epoch, g_epoch_max)];
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(epoch, g_epoch_max);
+
+  // Update the rollbackflag.
+  yarn_word_t old_flag;
+  yarn_word_t new_flag;
   do {
-    //assert(attempts++ <= 20);
+    old_flag = yarn_readv(flag);
+    new_flag = old_flag | mask;
+  } while (yarn_casv(flag, old_flag, new_flag) != old_flag);
+  
+}
 
-    cur_next = yarn_readv(&g_epoch_next);
-    yarn_word_t first = yarn_readv(&g_epoch_first);
-    retry = false;
 
-    // If we've reached our own tail then spin until it unblocks.
-    // Note that if this happens then there's something wrong with the thread scheduling
-    // or one of the threads is taking forever to finish.
-    // So something has gone wrong and yield can alleviate scheduling issues.
-    if (cur_next != first && get_epoch_index(cur_next) == get_epoch_index(first)) {
-      retry = true;
+/*
+Last step of the dispatch of a claimed epoch.
+ */
+static inline void publish_epoch (struct epoch_info* info, 
+				  yarn_word_t epoch, 
+				  enum yarn_epoch_status status) 
+{
+  // The flag can be cleared by a yarn_epoch_rollback_done that raced with a later 
+  // rollback so make sure it's set until the epoch is done cleaning up. Otherwise its
+  // stale writes could be forwarded and a selective rollback couldn't tell it apart.
+  if (status == yarn_epoch_rollback) {
+    yarn_decv(&g_rollback_count);
+    if (!is_rollback_flag_set(epoch)) {
+      set_rollback_flag(epoch);
     }
+  }
 
-    struct epoch_info* info = get_epoch_info(cur_next);
-    if (!retry) {
-      enum yarn_epoch_status status = yarn_readv(&info->status);
-      if (status == yarn_epoch_pending_rollback) {
-	retry = true;
-      }
+  if (g_rollback_mode == yarn_epoch_rollback_selective) {
+    yarn_atomic_var* forward_flags = get_forward_flags(epoch);
+    for (yarn_word_t i = 0; i < g_epoch_words; ++i) {
+      yarn_writev(&forward_flags[i], 0);
     }
+  }
 
-    if (!retry) {
+  yarn_writev_barrier(&info->status, yarn_epoch_executing);
+
+  DBG printf("[%zu] - EXECUTING - old_status=%d\n", epoch, status);
+  assert(status == yarn_epoch_commit || status == yarn_epoch_rollback);
+}
+
+
+/*
+Selective rollbacks leave the rolled back epochs behind g_epoch_next so they have to be
+picked up before we move on to new epochs. Goes through the window and claims the 
+earliest epoch that is ready to be executed again.
+ */
+static inline bool claim_rollback_epoch (yarn_word_t* next_epoch, 
+					 enum yarn_epoch_status* old_status) 
+{
+  if (g_rollback_mode != yarn_epoch_rollback_selective) {
+    return false;
+  }
+  if (yarn_readv(&g_rollback_count) == 0) {
+    return false;
+  }
+
+  const yarn_word_t next = yarn_readv(&g_epoch_next);
+  const yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
+  const bool stop_set = is_stop_set(stop_epoch);
+
+  for (yarn_word_t epoch = yarn_readv(&g_epoch_first); 
+       yarn_timestamp_comp(epoch, next) < 0; 
+       ++epoch)
+  {
+    if (stop_set && yarn_timestamp_comp(epoch, stop_epoch) >= 0) {
+      break;
+    }
+    if (!is_rollback_flag_set(epoch)) {
+      continue;
+    }
+
+    struct epoch_info* info = get_epoch_info(epoch);
+    if (yarn_casv(&info->seq, SEQ_FREE(epoch), SEQ_CLAIMED(epoch)) != SEQ_FREE(epoch)) {
+      continue;
+    }
+
+    const enum yarn_epoch_status status = yarn_readv(&info->status);
+    if (status != yarn_epoch_rollback) {
+      yarn_writev_barrier(&info->seq, SEQ_FREE(epoch));
+      continue;
+    }
+
+    publish_epoch(info, epoch, status);
+
+    *old_status = status;
+    *next_epoch = epoch;
+    return true;
+  }
+
+  return false;
+}
+
+
+/*
+Usually we're waiting for the oldest epoch to commit so see if we can help it along. If 
+the idle function did anything then the state probably changed so don't park.
+ */
+static inline void wait_next (yarn_word_t park_token) {
+  if (g_idle && g_idle()) {
+    return;
+  }
+  yarn_park_wait(&g_next_park, park_token);
+}
+
+
+/*
+Lock-free dispatch of the epochs. An epoch is handed out in 3 steps:
+- The slot is claimed by moving its seq from SEQ_FREE to SEQ_CLAIMED.
+- g_epoch_next is moved past the epoch.
+- The executing status is published.
+The slot claim guarantees that only one thread can move g_epoch_next past a given epoch
+and since rollback only touches the epochs before g_epoch_next, the status of a claimed
+slot can't change under our feet. If g_epoch_next moved (rollback) then the claim is
+dropped and we try again.
+
+Threads are only parked if the ring is full, if the epoch is pending a rollback, if the
+stop epoch was reached, if we're past the predicted end of the loop or if the epoch 
+depends on one that is still executing.
+ */
+static inline yarn_word_t get_depth (yarn_word_t first) {
+  if (yarn_timestamp_comp(first, yarn_readv(&g_serial_end)) < 0) {
+    return 1;
+  }
+  return yarn_readv(&g_epoch_depth);
+}
+
+static inline bool inc_epoch_next (yarn_word_t* next_epoch, 
+				   enum yarn_epoch_status* old_status) 
+{
+  while (true) {
+    const yarn_word_t park_token = yarn_park_token(&g_next_park);
+
+    if (claim_rollback_epoch(next_epoch, old_status)) {
+      return true;
+    }
+
+    const yarn_word_t cur_next = yarn_readv(&g_epoch_next);
+    const yarn_word_t first = yarn_readv(&g_epoch_first);
+
+    // Must come before the depth check which can drop below the number of epochs that
+    // are already handed out and would keep us from ever noticing the stop.
+    {
       const yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
-      const yarn_word_t first_epoch = yarn_readv(&g_epoch_first);
 
       if (is_stop_set(stop_epoch) && yarn_timestamp_comp(cur_next, stop_epoch) >= 0) {
-	if (stop_epoch == first_epoch) {
+	if (stop_epoch == yarn_readv(&g_epoch_first)) {
 	  return false;
 	}
-	else {
-	  retry = true;
-	}
+	wait_next(park_token);
+	continue;
       }
     }
 
-    if (retry) {
-      YARN_CHECK_RET0(pthread_cond_wait(&g_next_cond, &g_next_lock));
+    // If we've reached our own tail then wait for a commit to free up a slot.
+    if (cur_next != first && get_epoch_index(cur_next) == get_epoch_index(first)) {
+      wait_next(park_token);
       continue;
     }
-    
-    enum yarn_epoch_status status = yarn_readv(&info->status);
-    (void) status; // warning suppression.
-    DBG printf("\t\t\t\t\t\t[%zu] - INC - status=%d\n", cur_next, status);
 
-  } while (retry || yarn_casv(&g_epoch_next, cur_next, cur_next+1) != cur_next);
+    // We're not allowed to speculate that far ahead.
+    if (cur_next - first >= get_depth(first)) {
+      wait_next(park_token);
+      continue;
+    }
 
-  *next_epoch = cur_next;
-  return true;
-}
+    // Epochs past the predicted end would most likely be thrown away so wait until we
+    // know for sure. A bad prediction costs us the time to drain the epochs before it.
+    // Must come after the stop check or we'd wait forever on a shorter loop.
+    if (g_epoch_end_hint != 0 && 
+	yarn_timestamp_comp(cur_next, g_epoch_end_hint) >= 0 &&
+	yarn_timestamp_comp(first, g_epoch_end_hint) < 0)
+    {
+      wait_next(park_token);
+      continue;
+    }
 
-bool yarn_epoch_next(yarn_word_t* next_epoch, enum yarn_epoch_status* old_status) {
+    // The epoch would most likely read the writes of an epoch that is still executing
+    // so wait until they're buffered and can be forwarded. Only executing epochs are 
+    // waited on since the others need a thread to be dispatched again.
+    if (g_dep_distance != 0 && cur_next - first >= g_dep_distance) {
+      struct epoch_info* dep_info = get_epoch_info(cur_next - g_dep_distance);
+      if (yarn_readv(&dep_info->status) == yarn_epoch_executing) {
+	wait_next(park_token);
+	continue;
+      }
+    }
 
-  YARN_CHECK_RET0(pthread_mutex_lock(&g_next_lock));
+    struct epoch_info* info = get_epoch_info(cur_next);
 
-  bool ret = inc_epoch_next(next_epoch);
-  if (ret) {
-    struct epoch_info* info = get_epoch_info(*next_epoch);
+    // Either the slot is in the middle of a commit or rollback or someone else is 
+    // claiming it. Either way, it shouldn't take long.
+    if (yarn_casv(&info->seq, SEQ_FREE(cur_next), SEQ_CLAIMED(cur_next)) != 
+	SEQ_FREE(cur_next)) 
+    {
+      sched_yield();
+      continue;
+    }
 
-    *old_status = yarn_readv(&info->status);
-    yarn_writev(&info->status, yarn_epoch_executing);
-        
-    DBG printf("[%zu] - EXECUTING - old_status=%d\n", *next_epoch, *old_status);
-    assert(*old_status == yarn_epoch_commit || *old_status == yarn_epoch_rollback);
-    
+    const enum yarn_epoch_status status = yarn_readv(&info->status);
+    if (status == yarn_epoch_pending_rollback) {
+      yarn_writev_barrier(&info->seq, SEQ_FREE(cur_next));
+      wait_next(park_token);
+      continue;
+    }
+
+    if (yarn_casv(&g_epoch_next, cur_next, cur_next+1) != cur_next) {
+      yarn_writev_barrier(&info->seq, SEQ_FREE(cur_next));
+      continue;
+    }
+
+    publish_epoch(info, cur_next, status);
+
+    *old_status = status;
+    *next_epoch = cur_next;
+    return true;
   }
-  else {
+}
+
+bool yarn_epoch_next(yarn_word_t* next_epoch, enum yarn_epoch_status* old_status) {
+  bool ret = inc_epoch_next(next_epoch, old_status);
+
+  if (!ret) {
     // We're done so wakeup anyone still waiting.
-    YARN_CHECK_RET0(pthread_cond_broadcast(&g_next_cond));
+    yarn_park_wake_all(&g_next_park);
   }
 
-  YARN_CHECK_RET0(pthread_mutex_unlock(&g_next_lock));
-
   return ret;
 }
 
@@ -270,6 +524,11 @@ void yarn_epoch_stop(yarn_word_t stop_epoch) {
 	 new_stop, old_stop, is_set);
 }
 
+bool yarn_epoch_is_past_stop(yarn_word_t epoch) {
+  const yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
+  return is_stop_set(stop_epoch) && yarn_timestamp_comp(epoch, stop_epoch) >= 0;
+}
+
 static inline void rollback_stop (yarn_word_t rollback_epoch) {
   yarn_word_t old_stop;
   yarn_word_t new_stop;
@@ -320,7 +579,18 @@ static inline void update_stop () {
 
 
 
-static inline bool set_rollback_status (struct epoch_info* info, yarn_word_t epoch) {
+/*
+A selective rollback leaves alone an epoch that was handed out again but didn't call
+yarn_epoch_rollback_done yet. It hasn't read anything so there's nothing to rollback and 
+rolling it back anyway would lose its rollback flag when yarn_epoch_rollback_done is 
+called. The check has to be made along with the status update or the epoch could be 
+handed out in between.
+ */
+static inline bool set_rollback_status (struct epoch_info* info, 
+					yarn_word_t epoch, 
+					bool is_selective,
+					bool is_partial) 
+{
   bool skip_epoch = false;
   enum yarn_epoch_status old_status;
   enum yarn_epoch_status new_status;
@@ -332,14 +602,18 @@ static inline bool set_rollback_status (struct epoch_info* info, yarn_word_t epo
     switch (old_status) {
 
     case yarn_epoch_commit:
-      // There's a small window in next() between when the g_epoch_next is 
-      // incremented and when the commit status is set to executing.
-      // In that window the epoch will have a valid commit state.
+      // wait_for_claim() takes care of the window in next() between when the
+      // g_epoch_next is incremented and when the executing status is published.
+      // So the epoch was already committed.
     case yarn_epoch_rollback:
     case yarn_epoch_pending_rollback:
       skip_epoch = true;
       break;
     case yarn_epoch_executing:
+      if (is_selective && is_rollback_flag_set(epoch)) {
+	skip_epoch = true;
+	break;
+      }
       new_status = yarn_epoch_pending_rollback;
       break;
       
@@ -357,6 +631,22 @@ static inline bool set_rollback_status (struct epoch_info* info, yarn_word_t epo
 
   } while(yarn_casv(&info->status, old_status, new_status) != old_status);
 
+  if (!skip_epoch && new_status == yarn_epoch_rollback) {
+    yarn_incv(&g_rollback_count);
+  }
+
+  // The epoch can only be restarted if every rollback that hit it was partial.
+  if (!skip_epoch && old_status == yarn_epoch_executing) {
+    yarn_incv(&info->rollback_gen);
+    yarn_writev(&info->is_partial, is_partial);
+  }
+  else if (old_status == yarn_epoch_pending_rollback) {
+    yarn_incv(&info->rollback_gen);
+    if (!is_partial) {
+      yarn_writev(&info->is_partial, false);
+    }
+  }
+
   DBG {
     if (!skip_epoch) {
       printf("[%zu] - DO_ROLLBACK - old_status=%d, new_status=%d\n", 
@@ -367,63 +657,260 @@ static inline bool set_rollback_status (struct epoch_info* info, yarn_word_t epo
   return skip_epoch;
 }
 
-static inline void set_rollback_flag(yarn_word_t epoch) {
-  // Update the rollbackflag.
-  yarn_word_t old_flag;
-  yarn_word_t new_flag;
+/*
+Moves g_epoch_next back to the rollback epoch and returns the old value. 
+Once this is done, none of the epochs in the rollback range can be claimed by next.
+ */
+static inline yarn_word_t rollback_next(yarn_word_t new_next) {
+  yarn_word_t old_next;
   do {
-    old_flag = yarn_readv(&g_rollback_flag);
-    new_flag = YARN_BIT_SET(old_flag, epoch, g_epoch_max);
-  } while (yarn_casv(&g_rollback_flag, old_flag, new_flag) != old_flag);
-  
+    old_next = yarn_readv(&g_epoch_next);
+    if (yarn_timestamp_comp(old_next, new_next) <= 0) {
+      break;
+    }
+  } while (yarn_casv(&g_epoch_next, old_next, new_next) != old_next);
+
+  return old_next;
 }
 
-static inline bool rollback_next(yarn_word_t old_next, yarn_word_t new_next) {
-  if (yarn_timestamp_comp(old_next, new_next) <= 0) {
-    return true;
+/*
+Waits for next to publish the executing status of a claimed epoch.
+This only spans a few instructions in next so we don't bother parking.
+ */
+static inline void wait_for_claim (struct epoch_info* info, yarn_word_t epoch) {
+  while (yarn_readv(&info->seq) == SEQ_CLAIMED(epoch)) {
+    enum yarn_epoch_status status = yarn_readv(&info->status);
+    if (status != yarn_epoch_commit && status != yarn_epoch_rollback) {
+      break;
+    }
+    sched_yield();
   }
-  return yarn_casv(&g_epoch_next, old_next, new_next) == old_next;
 }
 
-void yarn_epoch_do_rollback(yarn_word_t start) {  
+static inline bool rollback_epoch (yarn_word_t epoch, bool is_selective, bool is_partial) {
+  struct epoch_info* info = get_epoch_info(epoch);
 
-  // Supporting multiple rollbacks at once is a headache that I don't want.
-  YARN_CHECK_RET0(pthread_mutex_lock(&g_rollback_lock));
-  YARN_CHECK_RET0(pthread_mutex_lock(&g_next_lock));
+  wait_for_claim(info, epoch);
+      
+  bool skip_epoch = set_rollback_status(info, epoch, is_selective, is_partial);
+  if(!skip_epoch) {
+    set_rollback_flag(epoch);
 
-  yarn_word_t epoch = start;
-  yarn_word_t old_next = yarn_readv(&g_epoch_next);
+    // The epoch can now be handed out again by next.
+    yarn_writev_barrier(&info->seq, SEQ_FREE(epoch));
+  }
+
+  return !skip_epoch;
+}
+
+static inline yarn_word_t rollback_all (yarn_word_t start, bool is_partial) {
+  yarn_word_t old_next = rollback_next(start);
+  yarn_word_t count = 0;
 
   // Every epoch following next are beyond last or have a rollback status
-  while(yarn_timestamp_comp(epoch, old_next) < 0) {
-    struct epoch_info* info = get_epoch_info(epoch);
-      
-    bool skip_epoch = set_rollback_status(info, epoch);
-    if(!skip_epoch) {
-      set_rollback_flag(epoch);
+  for (yarn_word_t epoch = start; yarn_timestamp_comp(epoch, old_next) < 0; ++epoch) {
+    if (rollback_epoch(epoch, false, is_partial && epoch == start)) {
+      count++;
     }
-      
-    epoch++;
   }
 
-  rollback_next(old_next, start);
   rollback_stop(start);
+  return count;
+}
+
+/*
+Returns true if the epoch read a buffered value from an epoch that is being rolled back.
+ */
+static inline bool is_forward_rollback (yarn_word_t epoch, yarn_word_t first) {
+  yarn_atomic_var* forward_flags = get_forward_flags(epoch);
+
+  for (yarn_word_t i = 0; i < g_epoch_words; ++i) {
+    yarn_word_t flags = yarn_readv(&forward_flags[i]);
+    flags &= yarn_readv(&g_rollback_flag[i]);
+    flags &= yarn_bit_mask_range_word(first, epoch, g_epoch_max, i);
+
+    if (flags) {
+      return true;
+    }
+  }
 
-  YARN_CHECK_RET0(pthread_cond_broadcast(&g_next_cond));
+  return false;
+}
 
-  YARN_CHECK_RET0(pthread_mutex_unlock(&g_next_lock));
+/*
+Only rolls back the start epoch and the epochs that read a value buffered by a rolled
+back epoch. Values can only be forwarded to later epochs so a single pass in epoch order
+is enough to get the transitive closure. The other epochs are left untouched and the
+g_epoch_next cursor doesn't move.
+
+g_epoch_next is re-read on every iteration because new epochs can read a buffered value
+before we get to its rollback flag. Once we're past next, every rollback flag is set and
+yarn_epoch_add_forward will take care of the late readers.
+ */
+static inline yarn_word_t rollback_selective (yarn_word_t start, bool is_partial) {
+  const yarn_word_t first = yarn_readv(&g_epoch_first);
+  yarn_word_t count = 0;
+
+  for (yarn_word_t epoch = start; 
+       yarn_timestamp_comp(epoch, yarn_readv(&g_epoch_next)) < 0; 
+       ++epoch) 
+  {
+    if (epoch != start && !is_forward_rollback(epoch, first)) {
+      continue;
+    }
+
+    if (rollback_epoch(epoch, true, is_partial && epoch == start)) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/*
+Unordered epochs never read each other's writes so only the start epoch is rolled back. If
+it's the epoch that set the stop then the stop is dropped and the epochs that were held 
+back by it are executed again since they might be part of the loop after all. The stop is
+dropped first so that an epoch that finishes during the scan is free to commit.
+ */
+static inline yarn_word_t rollback_unordered (yarn_word_t start) {
+  yarn_word_t count = rollback_selective(start, false);
+
+  const yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
+  if (!is_stop_set(stop_epoch) || stop_epoch != start+1) {
+    return count;
+  }
+
+  rollback_stop(start);
+
+  for (yarn_word_t epoch = start+1; 
+       yarn_timestamp_comp(epoch, yarn_readv(&g_epoch_next)) < 0; 
+       ++epoch)
+  {
+    if (yarn_epoch_get_status(epoch) == yarn_epoch_done && 
+	rollback_epoch(epoch, true, false)) 
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+static void do_rollback(yarn_word_t start, bool force_all, bool is_partial) {
+
+  // Supporting multiple rollbacks at once is a headache that I don't want.
+  YARN_CHECK_RET0(pthread_mutex_lock(&g_rollback_lock));
+
+  // We don't keep track of which epoch set the stop so if it might be rolled back, 
+  // fallback to the regular rollback which will also reset the stop.
+  const yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
+  bool is_stop_affected = 
+    is_stop_set(stop_epoch) && yarn_timestamp_comp(stop_epoch, start) > 0;
+
+  yarn_word_t count;
+  if (g_unordered) {
+    count = rollback_unordered(start);
+  }
+  else if (!force_all && 
+	   g_rollback_mode == yarn_epoch_rollback_selective && !is_stop_affected) 
+  {
+    count = rollback_selective(start, is_partial);
+  }
+  else {
+    count = rollback_all(start, is_partial);
+  }
+
+  if (g_depth_adaptive || g_watchdog) {
+    yarn_writev(&g_depth_rollbacks, yarn_readv(&g_depth_rollbacks) + count);
+    if (count > 0) {
+      yarn_writev(&g_depth_violations, yarn_readv(&g_depth_violations) + 1);
+    }
+  }
+
+  yarn_park_wake_all(&g_next_park);
+
+  YARN_CHECK_RET0(pthread_mutex_unlock(&g_rollback_lock));
+
+}
+
+void yarn_epoch_do_rollback(yarn_word_t start) {
+  do_rollback(start, false, false);
+}
+
+void yarn_epoch_do_rollback_all(yarn_word_t start) {
+  do_rollback(start, true, false);
+}
+
+void yarn_epoch_do_partial_rollback(yarn_word_t start) {
+  do_rollback(start, false, true);
+}
+
+
+yarn_word_t yarn_epoch_rollback_gen(yarn_word_t epoch) {
+  return yarn_readv(&get_epoch_info(epoch)->rollback_gen);
+}
+
+/*
+Undoes the rollback of an epoch that is still executing. A pending epoch keeps its slot
+free for next so we have to claim it again and, if the rollback moved g_epoch_next back
+to the epoch, move the cursor past it like next would. Nothing can be handed out past a
+rolled back epoch so the cursor can't be any further back. Holding the rollback lock
+keeps the status and the generation from changing under our feet.
+ */
+bool yarn_epoch_restart(yarn_word_t epoch, yarn_word_t gen) {
+  struct epoch_info* info = get_epoch_info(epoch);
+  bool is_restarted = false;
+
+  YARN_CHECK_RET0(pthread_mutex_lock(&g_rollback_lock));
+
+  if (yarn_readv(&info->status) != yarn_epoch_pending_rollback ||
+      yarn_readv(&info->rollback_gen) != gen ||
+      !yarn_readv(&info->is_partial))
+  {
+    goto restart_error;
+  }
+
+  // next only holds the slot for a few instructions before noticing the status.
+  while (yarn_casv(&info->seq, SEQ_FREE(epoch), SEQ_CLAIMED(epoch)) != SEQ_FREE(epoch)) {
+    sched_yield();
+  }
+
+  const yarn_word_t next = yarn_readv(&g_epoch_next);
+  if (yarn_timestamp_comp(next, epoch) < 0) {
+    yarn_writev_barrier(&info->seq, SEQ_FREE(epoch));
+    goto restart_error;
+  }
+  if (next == epoch) {
+    yarn_writev(&g_epoch_next, epoch+1);
+  }
+
+  yarn_writev_barrier(&info->status, yarn_epoch_executing);
+  yarn_epoch_rollback_done(epoch);
+  is_restarted = true;
+
+  DBG printf("[%zu] - RESTART - next=%zu\n", epoch, next);
+
+ restart_error:
   YARN_CHECK_RET0(pthread_mutex_unlock(&g_rollback_lock));
 
+  if (is_restarted) {
+    yarn_park_wake_all(&g_next_park);
+  }
+  return is_restarted;
 }
 
 
 void yarn_epoch_rollback_done(yarn_word_t epoch) {
+  yarn_atomic_var* flag = &g_rollback_flag[YARN_BIT_WORD(epoch, g_epoch_max)];
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(epoch, g_epoch_max);
+
   yarn_word_t old_flag;
   yarn_word_t new_flag;
   do {
-    old_flag = yarn_readv(&g_rollback_flag);
-    new_flag = YARN_BIT_CLEAR(old_flag, epoch, g_epoch_max);
-  } while (yarn_casv(&g_rollback_flag, old_flag, new_flag) != old_flag);
+    old_flag = yarn_readv(flag);
+    new_flag = old_flag & ~mask;
+  } while (yarn_casv(flag, old_flag, new_flag) != old_flag);
 
   DBG printf("[---] ROLLBACK -> CLEAR [%3zu] - flag="YARN_SHEX"\n", 
 	 epoch, YARN_AHEX(new_flag));
@@ -432,8 +919,29 @@ void yarn_epoch_rollback_done(yarn_word_t epoch) {
 
 
 bool yarn_epoch_get_next_commit(yarn_word_t* epoch, void** task) {
+  yarn_word_t count;
+  if (!yarn_epoch_get_commit_batch(epoch, &count, 1)) {
+    return false;
+  }
+
+  struct epoch_info* info = get_epoch_info(*epoch);
+  *task = info->task;
+  info->task = NULL;
+
+  return true;
+}
+
+/*
+Grabs the longest run of done epochs that follows g_epoch_next_commit. Once an epoch is
+done, it can't be rolled back unless a previous epoch is still executing. Since every epoch
+before the run is either committed or being committed, the run is stable.
+ */
+bool yarn_epoch_get_commit_batch(yarn_word_t* first_epoch, 
+				 yarn_word_t* count, 
+				 yarn_word_t max_count) 
+{
   yarn_word_t to_commit;
-  struct epoch_info* info;
+  yarn_word_t n;
 
   // increment first if it has the correct status.
   do {
@@ -441,33 +949,180 @@ bool yarn_epoch_get_next_commit(yarn_word_t* epoch, void** task) {
     to_commit = yarn_readv(&g_epoch_next_commit);
     yarn_mem_barrier();
     yarn_word_t next = yarn_readv(&g_epoch_next);
+    yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
+    bool stop_set = is_stop_set(stop_epoch);
 
-    // We can tolerate false positives on this check.    
-    if (to_commit == next) {
-      return false;
-    }
+    for (n = 0; n < max_count; ++n) {
+      yarn_word_t epoch = to_commit + n;
 
-    info = get_epoch_info(to_commit);
-    enum yarn_epoch_status status = yarn_readv(&info->status);
-    if (status != yarn_epoch_done) {
-      return false;
+      // We can tolerate false positives on this check.    
+      if (epoch == next) {
+	break;
+      }
+
+      enum yarn_epoch_status status = yarn_epoch_get_status(epoch);
+      if (status != yarn_epoch_done) {
+	break;
+      }
+
+      if (stop_set && stop_epoch == epoch) {
+	break;
+      }
+
+      // Might roll back the epoch which is fine since it's not part of the batch yet.
+      const bool is_first = n == 0 && epoch == yarn_readv(&g_epoch_first);
+      if (g_validate && !g_validate(epoch, is_first)) {
+	break;
+      }
     }
 
-    yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);    
-    if (is_stop_set(stop_epoch) && stop_epoch == to_commit) {
+    if (n == 0) {
       return false;
     }
       
-  } while (yarn_casv(&g_epoch_next_commit, to_commit, to_commit+1) != to_commit);
+  } while (yarn_casv(&g_epoch_next_commit, to_commit, to_commit+n) != to_commit);
 
-  *task = info->task;
-  info->task = NULL;
+  for (yarn_word_t i = 0; i < n; ++i) {
+    assert(yarn_epoch_get_status(to_commit + i) == yarn_epoch_done);
+  }
 
-  *epoch = to_commit;
-  
-  assert(yarn_readv(&info->status) == yarn_epoch_done);
+  *first_epoch = to_commit;
+  *count = n;
+
+  return true;
+}
+
+/*
+If more then a quarter of the work was thrown away then we're speculating too far ahead 
+and the depth is halved, down to 1 which is equivalent to a sequential execution. If 
+nothing was rolled back then the depth is doubled back up to g_epoch_max.
+ */
+static inline void update_depth (yarn_word_t rollbacks) {
+  if (!g_depth_adaptive) {
+    return;
+  }
+
+  yarn_word_t depth = yarn_readv(&g_epoch_depth);
+
+  if (rollbacks*4 > YARN_EPOCH_DEPTH_WINDOW) {
+    depth = depth > 1 ? depth / 2 : 1;
+  }
+  else if (rollbacks == 0) {
+    depth = depth < g_epoch_max ? depth * 2 : g_epoch_max;
+  }
+
+  yarn_writev(&g_epoch_depth, depth);
+
+  DBG printf("[---] DEPTH - depth=%zu, rollbacks=%zu\n", depth, rollbacks);
+}
+
+/*
+Unlike the adaptive depth, the watchdog reacts to a single bad window. When nearly every 
+commit is preceded by a rollback we're slower then a sequential execution so the next 
+g_serial_length epochs are executed one at a time. Since the head epoch can't be rolled
+back, that's about as fast as running the loop without yarn. Once they're committed, the
+next window acts as a probe to see if speculation pays off again.
+
+Violations are counted instead of squashed epochs. A single violation can squash every
+epoch in flight so the number of squashed epochs grows with the number of threads and
+would make a healthy loop on a wide machine look like a storm.
+ */
+static inline void update_watchdog (yarn_word_t violations) {
+  if (!g_watchdog) {
+    return;
+  }
+
+  const yarn_word_t first = yarn_readv(&g_epoch_first);
+
+  // Part of the window was executed sequentially so there's nothing to measure.
+  const yarn_word_t window_start = first - YARN_EPOCH_DEPTH_WINDOW;
+  if (yarn_timestamp_comp(window_start, yarn_readv(&g_serial_end)) < 0) {
+    return;
+  }
+
+  if (violations >= YARN_EPOCH_STORM_RATIO * YARN_EPOCH_DEPTH_WINDOW) {
+    yarn_writev(&g_serial_end, first + g_serial_length);
+    DBG printf("[---] STORM - violations=%zu, serial_end=%zu\n", 
+	       violations, first + g_serial_length);
+
+    if (g_serial_length < YARN_EPOCH_SERIAL_MAX) {
+      g_serial_length *= 2;
+    }
+  }
+  else if (violations*4 <= YARN_EPOCH_DEPTH_WINDOW) {
+    g_serial_length = YARN_EPOCH_SERIAL_MIN;
+  }
+}
+
+/*
+Once every YARN_EPOCH_DEPTH_WINDOW commits, compares the number of squashed epochs with
+the number of committed epochs. Note that the counters are only approximate but it's only
+a heuristic.
+ */
+static inline void update_window () {
+  if (!g_depth_adaptive && !g_watchdog) {
+    return;
+  }
+
+  if (yarn_get_and_incv(&g_depth_commits) != YARN_EPOCH_DEPTH_WINDOW-1) {
+    return;
+  }
+
+  update_depth(yarn_readv(&g_depth_rollbacks));
+  update_watchdog(yarn_readv(&g_depth_violations));
+
+  yarn_writev(&g_depth_rollbacks, 0);
+  yarn_writev(&g_depth_violations, 0);
+  yarn_writev_barrier(&g_depth_commits, 0);
+}
+
+/*
+Unordered epochs are serialized in the order in which they commit so the commits are done
+one at a time. This lets the committing epoch roll back the readers of its writes before 
+anyone else gets to commit. The epoch that set the stop still has to wait for every epoch
+before it or it would end the loop while some of them are still missing. The lock is 
+released by yarn_epoch_commit_done.
+ */
+bool yarn_epoch_claim_commit(yarn_word_t epoch) {
+  assert(g_unordered);
+
+  YARN_CHECK_RET0(pthread_mutex_lock(&g_commit_lock));
+
+  if (yarn_epoch_get_status(epoch) != yarn_epoch_done) {
+    goto no_claim;
+  }
+
+  const yarn_word_t stop_epoch = yarn_readv(&g_epoch_stop);
+  if (is_stop_set(stop_epoch)) {
+    if (yarn_timestamp_comp(epoch, stop_epoch) >= 0) {
+      goto no_claim;
+    }
+    if (epoch+1 == stop_epoch && epoch != yarn_readv(&g_epoch_first)) {
+      goto no_claim;
+    }
+  }
 
   return true;
+
+ no_claim:
+  YARN_CHECK_RET0(pthread_mutex_unlock(&g_commit_lock));
+  return false;
+}
+
+/*
+Unordered epochs skip g_epoch_next_commit so we rely on the seq which is only moved to the
+next lap once the epoch is committed. The status can't be used because it's also 
+yarn_epoch_commit for epochs that were never handed out.
+ */
+static inline bool is_first_committed (yarn_word_t first) {
+  if (g_unordered) {
+    return yarn_readv(&get_epoch_info(first)->seq) == SEQ_FREE(first + g_epoch_max);
+  }
+
+  if (first == yarn_readv(&g_epoch_next_commit)) {
+    return false;
+  }
+  return yarn_epoch_get_status(first) == yarn_epoch_commit;
 }
 
 void yarn_epoch_commit_done(yarn_word_t epoch) {
@@ -480,20 +1135,13 @@ void yarn_epoch_commit_done(yarn_word_t epoch) {
   (void) old_status; // Warning supression.
 
   yarn_writev_barrier(&info->status, yarn_epoch_commit);
+  yarn_writev_barrier(&info->seq, SEQ_FREE(epoch + g_epoch_max));
 
   // Move the g_epoch_first as far as we can
   yarn_word_t old_first;
-  yarn_word_t old_commit;
   while(true) {
     old_first = yarn_readv(&g_epoch_first);
-
-    old_commit = yarn_readv(&g_epoch_next_commit);
-    if (old_first == old_commit) {
-      break;
-    }
-
-    enum yarn_epoch_status status = yarn_epoch_get_status(old_first);
-    if (status != yarn_epoch_commit) {
+    if (!is_first_committed(old_first)) {
       break;
     }
     
@@ -502,10 +1150,13 @@ void yarn_epoch_commit_done(yarn_word_t epoch) {
   }
 
   update_stop();
+  update_window();
+
+  if (g_unordered) {
+    YARN_CHECK_RET0(pthread_mutex_unlock(&g_commit_lock));
+  }
 
-  YARN_CHECK_RET0(pthread_mutex_lock(&g_next_lock));
-  YARN_CHECK_RET0(pthread_cond_signal(&g_next_cond));
-  YARN_CHECK_RET0(pthread_mutex_unlock(&g_next_lock));
+  yarn_park_wake_all(&g_next_park);
 }
 
 void yarn_epoch_set_done(yarn_word_t epoch) {
@@ -535,6 +1186,16 @@ void yarn_epoch_set_done(yarn_word_t epoch) {
 
   DBG printf("[%zu] - DONE - old_status=%d, new_status=%d\n", 
 	     epoch, old_status, new_status);
+
+  // Next might be waiting on our pending rollback.
+  if (new_status == yarn_epoch_rollback) {
+    yarn_incv(&g_rollback_count);
+    yarn_park_wake_all(&g_next_park);
+  }
+  // Or on our writes if a dependence distance was declared.
+  else if (g_dep_distance != 0) {
+    yarn_park_wake_all(&g_next_park);
+  }
 }
 
  
@@ -553,6 +1214,69 @@ void yarn_epoch_set_task (yarn_word_t epoch, void* task) {
 }
 
 
-yarn_word_t yarn_epoch_rollback_flags(void) {
-  return yarn_readv(&g_rollback_flag);
+void yarn_epoch_set_rollback_mode(enum yarn_epoch_rollback_mode mode) {
+  g_rollback_mode = mode;
+}
+
+enum yarn_epoch_rollback_mode yarn_epoch_get_rollback_mode(void) {
+  return g_rollback_mode;
+}
+
+void yarn_epoch_set_adaptive_depth(bool adaptive) {
+  g_depth_adaptive = adaptive;
+}
+
+yarn_word_t yarn_epoch_depth(void) {
+  return get_depth(yarn_readv(&g_epoch_first));
+}
+
+void yarn_epoch_set_watchdog(bool enable) {
+  g_watchdog = enable;
+}
+
+void yarn_epoch_set_unordered(bool enable) {
+  g_unordered = enable;
+}
+
+void yarn_epoch_set_end_hint(yarn_word_t end) {
+  g_epoch_end_hint = end;
+}
+
+void yarn_epoch_set_distance(yarn_word_t distance) {
+  g_dep_distance = distance;
+}
+
+void yarn_epoch_set_idle(yarn_epoch_idle_t idle) {
+  g_idle = idle;
+}
+
+void yarn_epoch_set_validate(yarn_epoch_validate_t validate) {
+  g_validate = validate;
+}
+
+bool yarn_epoch_add_forward(yarn_word_t epoch, yarn_word_t from_epoch) {
+  if (g_rollback_mode != yarn_epoch_rollback_selective) {
+    return true;
+  }
+
+  // Only the thread executing the epoch writes to its forward flags.
+  yarn_atomic_var* flag = &get_forward_flags(epoch)[YARN_BIT_WORD(from_epoch, g_epoch_max)];
+  const yarn_word_t mask = YARN_BIT_WORD_MASK(from_epoch, g_epoch_max);
+  
+  const yarn_word_t old_flag = yarn_readv(flag);
+  if ((old_flag & mask) == 0) {
+    yarn_writev(flag, old_flag | mask);
+  }
+
+  // Pairs with the rollback flag CAS in rollback_selective. Either we see the rollback
+  // flag or the rollback sees our forward flag.
+  yarn_mem_barrier();
+
+  return !is_rollback_flag_set(from_epoch);
+}
+
+
+yarn_word_t yarn_epoch_rollback_flags(yarn_word_t word_index) {
+  assert(word_index < g_epoch_words);
+  return yarn_readv(&g_rollback_flag[word_index]);
 }
@@ -4,9 +4,8 @@
 
 Keeper of the one and only speculative timeline.
 
-\warning yarn_epoch is not guaranteed to work correctly if 
-\code yarn_tpool_size() <= sizeof(yarn_word_t)-1 \endcode. If we ever enter an
-era of 30+ core CPUs then this class will need to be updated so that it works better.
+The number of active epochs is bounded by \c YARN_EPOCH_MAX_SIZE. If the thread pool is
+larger then half that value then some threads will have to wait for a free epoch.
  */
 
 
@@ -17,6 +16,20 @@ era of 30+ core CPUs then this class will need to be updated so that it works be
 #include "yarn/types.h"
 
 
+//! Upper bound for the value returned by yarn_epoch_max(). Must be a power of two.
+#define YARN_EPOCH_MAX_SIZE 512
+
+//! Number of commits between each adjustment of the adaptive depth.
+#define YARN_EPOCH_DEPTH_WINDOW 32
+
+//! Violations per commit within a window after which the watchdog kicks in.
+#define YARN_EPOCH_STORM_RATIO 1
+
+//! Bounds for the number of epochs executed sequentially after a rollback storm.
+#define YARN_EPOCH_SERIAL_MIN 128
+#define YARN_EPOCH_SERIAL_MAX 16384
+
+
 enum yarn_epoch_status {
   //! Currently executing.
   yarn_epoch_executing = 1,
@@ -35,6 +48,15 @@ enum yarn_epoch_status {
 };
 
 
+enum yarn_epoch_rollback_mode {
+  //! Rolls back every epoch that follows the violation.
+  yarn_epoch_rollback_all = 0,
+
+  //! Only rolls back the violating epoch and the epochs that read its buffered writes.
+  yarn_epoch_rollback_selective = 1
+};
+
+
 //! \warning Not thread safe.
 bool yarn_epoch_init(void);
 //! \warning Not thread safe.
@@ -42,7 +64,7 @@ bool yarn_epoch_reset(void);
 //! \warning Not thread safe.
 void yarn_epoch_destroy(void);
 
-//! Returns the maximum number epochs that can be active at any one time.
+//! Returns the maximum number epochs that can be active at any one time (power of two).
 yarn_word_t yarn_epoch_max(void);
 
 //! Bounds for the active epochs.
@@ -60,13 +82,50 @@ bool yarn_epoch_next(yarn_word_t* next_epoch, enum yarn_epoch_status* old_status
 bool yarn_epoch_is_finished();
 void yarn_epoch_stop(yarn_word_t epoch);
 
+//! Returns true if the epoch comes after the stop epoch and will never be committed.
+bool yarn_epoch_is_past_stop(yarn_word_t epoch);
+
 /*!
 Contrary to what the name might suggests, these don't do the actual commits and rollback.
 They only update or prepare the epoch data structures.
 */
 void yarn_epoch_do_rollback(yarn_word_t start);
+//! Rolls back every epoch that follows start regardless of the rollback mode.
+void yarn_epoch_do_rollback_all(yarn_word_t start);
 void yarn_epoch_rollback_done(yarn_word_t epoch);
+
+/*!
+Same as yarn_epoch_do_rollback but the start epoch only needs to redo part of its work so
+the thread executing it may take it back through yarn_epoch_restart. The other epochs hit 
+by the rollback are rolled back as usual.
+*/
+void yarn_epoch_do_partial_rollback(yarn_word_t start);
+
+//! Returns a counter that changes whenever a rollback hits the epoch.
+yarn_word_t yarn_epoch_rollback_gen(yarn_word_t epoch);
+
+/*!
+Called by the thread executing an epoch that is pending a rollback to cancel the rollback
+and keep executing the epoch. gen must have been read through yarn_epoch_rollback_gen 
+before looking at what caused the rollback. Returns false if the epoch was hit by another
+rollback since then or by a rollback that wasn't partial in which case the epoch must be 
+rolled back as usual.
+*/
+bool yarn_epoch_restart(yarn_word_t epoch, yarn_word_t gen);
 bool yarn_epoch_get_next_commit(yarn_word_t* epoch, void** task);
+/*!
+Same as yarn_epoch_get_next_commit but returns a run of up to max_count consecutive 
+epochs that are ready to be committed. The tasks are left in the epochs.
+*/
+bool yarn_epoch_get_commit_batch(yarn_word_t* first_epoch, 
+				 yarn_word_t* count, 
+				 yarn_word_t max_count);
+/*!
+Claims a done epoch for commit in unordered mode. Returns false if the epoch isn't ready
+or can't be committed yet. A claimed epoch must be passed to yarn_epoch_commit_done once
+its writes are committed and no other epoch can be claimed in the meantime.
+*/
+bool yarn_epoch_claim_commit(yarn_word_t epoch);
 void yarn_epoch_commit_done(yarn_word_t epoch);
 void yarn_epoch_set_done(yarn_word_t epoch);
 
@@ -80,11 +139,87 @@ any ways so it's up to the client to set and free them as nessecary.
 void* yarn_epoch_get_task (yarn_word_t epoch);
 void yarn_epoch_set_task (yarn_word_t epoch, void* task);
 
+//! \warning Not thread safe. Defaults to yarn_epoch_rollback_all.
+void yarn_epoch_set_rollback_mode(enum yarn_epoch_rollback_mode mode);
+enum yarn_epoch_rollback_mode yarn_epoch_get_rollback_mode(void);
+
+/*!
+When enabled, the number of epochs that can be active at once is adjusted according to 
+the rate of rollbacks. Conflict heavy loops will gradually be executed sequentially.
+\warning Not thread safe. Disabled by default.
+*/
+void yarn_epoch_set_adaptive_depth(bool adaptive);
+
+//! Returns the number of epochs that can currently be active (between 1 and max).
+yarn_word_t yarn_epoch_depth(void);
+
+/*!
+When enabled, a window with YARN_EPOCH_STORM_RATIO violations per commit causes the 
+epochs to be executed one at a time for a while before speculation is attempted again. A 
+violation counts once no matter how many epochs it rolls back. Each consecutive storm 
+doubles the length of the sequential execution.
+\warning Not thread safe. Disabled by default.
+*/
+void yarn_epoch_set_watchdog(bool enable);
+
+/*!
+When enabled, epochs are committed as soon as they're done through 
+yarn_epoch_claim_commit instead of yarn_epoch_get_commit_batch and a rollback never 
+cascades to other epochs. Requires yarn_epoch_rollback_selective.
+\warning Not thread safe. Disabled by default.
+*/
+void yarn_epoch_set_unordered(bool enable);
+
+/*!
+Epochs at or past end are only dispatched once every epoch before end was committed 
+which avoids speculating past the predicted end of a loop. 0 disables the hint.
+\warning Not thread safe. Cleared by yarn_epoch_reset.
+*/
+void yarn_epoch_set_end_hint(yarn_word_t end);
+
+/*!
+Declares that each epoch reads what the epoch distance before it wrote. An epoch is only
+dispatched once that epoch is done so the epochs execute in waves of distance epochs. The
+accesses are still tracked so a wrong distance is caught like any other violation. 0
+disables the hint.
+\warning Not thread safe. Disabled by default.
+*/
+void yarn_epoch_set_distance(yarn_word_t distance);
+
+//! Returns true if any work was done.
+typedef bool (*yarn_epoch_idle_t)(void);
+
+/*!
+Function called by next before waiting for an epoch to become available. 
+\warning Not thread safe. NULL by default.
+*/
+void yarn_epoch_set_idle(yarn_epoch_idle_t idle);
+
+/*!
+Returns false if the epoch can't be committed yet. is_first is true if every epoch before
+it is committed.
+*/
+typedef bool (*yarn_epoch_validate_t)(yarn_word_t epoch, bool is_first);
+
+/*!
+Function called by yarn_epoch_get_commit_batch on each done epoch before it's added to the
+batch. 
+\warning Not thread safe. NULL by default.
+*/
+void yarn_epoch_set_validate(yarn_epoch_validate_t validate);
+
+/*!
+Records that epoch read a value buffered by from_epoch so that a selective rollback of
+from_epoch also rolls back epoch. Returns false if from_epoch is being rolled back in 
+which case the buffered value shouldn't be used.
+*/
+bool yarn_epoch_add_forward(yarn_word_t epoch, yarn_word_t from_epoch);
+
 /*!
-Returns a bitfield with the bit sets for every epoch that is in a rollback state.
-Follows the conventions defined in bits.h
+Returns a word of the multi-word bitfield with the bit sets for every epoch that is in a 
+rollback state. Follows the conventions defined in bits.h
 */
-yarn_word_t yarn_epoch_rollback_flags(void);
+yarn_word_t yarn_epoch_rollback_flags(yarn_word_t word_index);
 
 
 #endif // YARN_EPOCH_H_
@@ -0,0 +1,459 @@
+/*!
+\author Rémi Attab
+\license FreeBSD (see the LICENSE file).
+
+
+ */
+
+
+#include "inspect.h"
+
+#include "tpool.h"
+#include "atomic.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// Number of inspectors whose schedule is remembered. Must be a power of two.
+#define YARN_INSPECT_CACHE_SIZE 16
+
+// Iterations grabbed at once by a thread to keep the counter from becoming a hot spot.
+#define YARN_INSPECT_CHUNK 16
+
+// Initial number of accesses that a thread buffer can hold.
+#define YARN_INSPECT_BUFFER_SIZE 256
+
+
+struct access {
+  uintptr_t addr;
+  bool is_write;
+};
+
+// Accesses recorded by a single thread. Those of an iteration are always contiguous.
+struct access_buffer {
+  yarn_word_t size;
+  yarn_word_t capacity;
+  bool is_error;
+  struct access* accesses;
+};
+
+static struct access_buffer* g_buffers;
+static yarn_word_t g_buffer_count;
+
+// Where the accesses of each iteration were recorded.
+struct iter_accesses {
+  yarn_word_t pool_id;
+  yarn_word_t first;
+  yarn_word_t size;
+};
+
+struct inspect_task {
+  yarn_inspector_t inspector;
+  void* data;
+  yarn_word_t count;
+  yarn_atomic_var next;
+  struct iter_accesses* iters;
+};
+
+// Last wave, plus one, to write and to read an address. 0 if it wasn't accessed yet.
+struct addr_state {
+  uintptr_t addr;
+  yarn_word_t write_wave;
+  yarn_word_t read_wave;
+};
+
+struct wave_task {
+  yarn_executor_t executor;
+  void* data;
+  const yarn_word_t* iterations;
+  yarn_word_t count;
+  yarn_atomic_var next;
+};
+
+// Last schedule built for an inspector. Collisions just overwrite.
+struct cache_entry {
+  yarn_inspector_t inspector;
+  void* data;
+  yarn_word_t count;
+  void* key;
+  size_t key_size;
+  struct yarn_schedule* schedule;
+};
+
+static struct cache_entry g_cache[YARN_INSPECT_CACHE_SIZE];
+
+
+
+static void schedule_destroy (struct yarn_schedule* s) {
+  if (!s) {
+    return;
+  }
+  free(s->order);
+  free(s->offsets);
+  free(s);
+}
+
+static void cache_entry_clear (struct cache_entry* entry) {
+  schedule_destroy(entry->schedule);
+  free(entry->key);
+  memset(entry, 0, sizeof(struct cache_entry));
+}
+
+static struct cache_entry* get_cache_entry (yarn_inspector_t inspector) {
+  const uintptr_t key = (uintptr_t) inspector;
+  return &g_cache[(key >> 4) & (YARN_INSPECT_CACHE_SIZE-1)];
+}
+
+static bool is_cache_hit (const struct cache_entry* entry,
+			  yarn_inspector_t inspector,
+			  void* data,
+			  yarn_word_t count,
+			  const void* key,
+			  size_t key_size)
+{
+  return key &&
+    entry->schedule &&
+    entry->inspector == inspector &&
+    entry->data == data &&
+    entry->count == count &&
+    entry->key_size == key_size &&
+    memcmp(entry->key, key, key_size) == 0;
+}
+
+
+void yarn_inspect_destroy (void) {
+  for (size_t i = 0; i < YARN_INSPECT_CACHE_SIZE; ++i) {
+    cache_entry_clear(&g_cache[i]);
+  }
+
+  for (yarn_word_t i = 0; i < g_buffer_count; ++i) {
+    free(g_buffers[i].accesses);
+  }
+  free(g_buffers);
+  g_buffers = NULL;
+  g_buffer_count = 0;
+}
+
+static bool reset_buffers (void) {
+  if (!g_buffers) {
+    g_buffer_count = yarn_tpool_size();
+    g_buffers = calloc(g_buffer_count, sizeof(struct access_buffer));
+    if (!g_buffers) goto alloc_error;
+  }
+
+  for (yarn_word_t i = 0; i < g_buffer_count; ++i) {
+    g_buffers[i].size = 0;
+    g_buffers[i].is_error = false;
+  }
+
+  return true;
+
+ alloc_error:
+  g_buffer_count = 0;
+  perror(__FUNCTION__);
+  return false;
+}
+
+static void record (yarn_word_t pool_id, const void* addr, bool is_write) {
+  struct access_buffer* buf = &g_buffers[pool_id];
+
+  if (buf->size == buf->capacity) {
+    yarn_word_t capacity = buf->capacity ? buf->capacity * 2 : YARN_INSPECT_BUFFER_SIZE;
+    struct access* accesses = realloc(buf->accesses, capacity * sizeof(struct access));
+    if (!accesses) {
+      buf->is_error = true;
+      return;
+    }
+    buf->accesses = accesses;
+    buf->capacity = capacity;
+  }
+
+  buf->accesses[buf->size++] = (struct access) {
+    .addr = (uintptr_t) addr,
+    .is_write = is_write
+  };
+}
+
+void yarn_inspect_read (yarn_word_t pool_id, const void* addr) {
+  record(pool_id, addr, false);
+}
+
+void yarn_inspect_write (yarn_word_t pool_id, const void* addr) {
+  record(pool_id, addr, true);
+}
+
+
+static bool inspect_worker (yarn_word_t pool_id, void* task) {
+  struct inspect_task* t = (struct inspect_task*) task;
+  struct access_buffer* buf = &g_buffers[pool_id];
+
+  while (true) {
+    const yarn_word_t first = yarn_get_and_incv(&t->next) * YARN_INSPECT_CHUNK;
+    if (first >= t->count) {
+      break;
+    }
+
+    const yarn_word_t last = first + YARN_INSPECT_CHUNK < t->count ?
+      first + YARN_INSPECT_CHUNK : t->count;
+
+    for (yarn_word_t i = first; i < last; ++i) {
+      const yarn_word_t start = buf->size;
+      t->inspector(pool_id, t->data, i);
+      if (buf->is_error) goto alloc_error;
+
+      t->iters[i] = (struct iter_accesses) {
+	.pool_id = pool_id, .first = start, .size = buf->size - start
+      };
+    }
+  }
+
+  return true;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  return false;
+}
+
+
+// fmix from MurmurHash3. See the hash function of map.c.
+static inline size_t hash (uintptr_t h, size_t mask) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return (size_t) h & mask;
+}
+
+// Linear probing. The table is always at least twice as big as the number of accesses.
+static struct addr_state* get_state (struct addr_state* table, size_t mask, uintptr_t addr) {
+  size_t pos = hash(addr, mask);
+  while (table[pos].addr != addr && table[pos].addr != 0) {
+    pos = (pos + 1) & mask;
+  }
+  table[pos].addr = addr;
+  return &table[pos];
+}
+
+/*
+Assigns each iteration to the wave that follows every earlier iteration it conflicts
+with: reads go after the last write to the address and writes go after both the last
+write and every read of the address. Returns the number of waves.
+ */
+static yarn_word_t compute_waves (const struct iter_accesses* iters,
+				  yarn_word_t count,
+				  struct addr_state* table,
+				  size_t mask,
+				  yarn_word_t* waves)
+{
+  yarn_word_t wave_count = 0;
+
+  for (yarn_word_t i = 0; i < count; ++i) {
+    const struct access* accesses = &g_buffers[iters[i].pool_id].accesses[iters[i].first];
+
+    yarn_word_t wave = 0;
+    for (yarn_word_t j = 0; j < iters[i].size; ++j) {
+      const struct addr_state* state = get_state(table, mask, accesses[j].addr);
+      if (state->write_wave > wave) {
+	wave = state->write_wave;
+      }
+      if (accesses[j].is_write && state->read_wave > wave) {
+	wave = state->read_wave;
+      }
+    }
+
+    for (yarn_word_t j = 0; j < iters[i].size; ++j) {
+      struct addr_state* state = get_state(table, mask, accesses[j].addr);
+      if (accesses[j].is_write) {
+	state->write_wave = wave + 1;
+      }
+      else if (state->read_wave < wave + 1) {
+	state->read_wave = wave + 1;
+      }
+    }
+
+    waves[i] = wave;
+    if (wave + 1 > wave_count) {
+      wave_count = wave + 1;
+    }
+  }
+
+  return wave_count;
+}
+
+static struct yarn_schedule* build_schedule (yarn_inspector_t inspector,
+					     void* data,
+					     yarn_word_t count,
+					     yarn_word_t thread_count)
+{
+  bool ret;
+
+  ret = reset_buffers();
+  if (!ret) goto buffer_error;
+
+  struct inspect_task task = {
+    .inspector = inspector, .data = data, .count = count
+  };
+  yarn_writev(&task.next, 0);
+
+  task.iters = calloc(count ? count : 1, sizeof(struct iter_accesses));
+  if (!task.iters) goto iters_alloc_error;
+
+  ret = yarn_tpool_exec(inspect_worker, (void*) &task, thread_count);
+  if (!ret) goto inspect_error;
+
+  yarn_word_t access_count = 0;
+  for (yarn_word_t i = 0; i < count; ++i) {
+    access_count += task.iters[i].size;
+  }
+
+  size_t capacity = 16;
+  while (capacity < access_count * 2) {
+    capacity *= 2;
+  }
+
+  struct addr_state* table = calloc(capacity, sizeof(struct addr_state));
+  if (!table) goto table_alloc_error;
+
+  yarn_word_t* waves = malloc((count ? count : 1) * sizeof(yarn_word_t));
+  if (!waves) goto waves_alloc_error;
+
+  const yarn_word_t wave_count = compute_waves(task.iters, count, table, capacity-1, waves);
+
+  struct yarn_schedule* s = calloc(1, sizeof(struct yarn_schedule));
+  if (!s) goto schedule_alloc_error;
+
+  s->count = count;
+  s->wave_count = wave_count;
+  s->offsets = calloc(wave_count + 1, sizeof(yarn_word_t));
+  if (!s->offsets) goto offsets_alloc_error;
+  s->order = malloc((count ? count : 1) * sizeof(yarn_word_t));
+  if (!s->order) goto order_alloc_error;
+
+  // Counting sort which keeps the iterations of a wave in their original order.
+  for (yarn_word_t i = 0; i < count; ++i) {
+    s->offsets[waves[i] + 1]++;
+  }
+  for (yarn_word_t w = 0; w < wave_count; ++w) {
+    s->offsets[w + 1] += s->offsets[w];
+  }
+  for (yarn_word_t i = 0; i < count; ++i) {
+    s->order[s->offsets[waves[i]]++] = i;
+  }
+  for (yarn_word_t w = wave_count; w > 0; --w) {
+    s->offsets[w] = s->offsets[w-1];
+  }
+  s->offsets[0] = 0;
+
+  free(waves);
+  free(table);
+  free(task.iters);
+
+  return s;
+
+ order_alloc_error:
+  free(s->offsets);
+ offsets_alloc_error:
+  free(s);
+ schedule_alloc_error:
+  free(waves);
+ waves_alloc_error:
+  free(table);
+ table_alloc_error:
+ inspect_error:
+  free(task.iters);
+ iters_alloc_error:
+ buffer_error:
+  perror(__FUNCTION__);
+  return NULL;
+}
+
+
+const struct yarn_schedule* yarn_inspect (yarn_inspector_t inspector,
+					  void* data,
+					  yarn_word_t count,
+					  yarn_word_t thread_count,
+					  const void* key,
+					  size_t key_size)
+{
+  struct cache_entry* entry = get_cache_entry(inspector);
+  if (is_cache_hit(entry, inspector, data, count, key, key_size)) {
+    return entry->schedule;
+  }
+
+  cache_entry_clear(entry);
+
+  struct yarn_schedule* s = build_schedule(inspector, data, count, thread_count);
+  if (!s) goto schedule_error;
+
+  if (key) {
+    entry->key = malloc(key_size ? key_size : 1);
+    if (!entry->key) goto key_alloc_error;
+    memcpy(entry->key, key, key_size);
+  }
+
+  entry->inspector = inspector;
+  entry->data = data;
+  entry->count = count;
+  entry->key_size = key_size;
+  entry->schedule = s;
+
+  return s;
+
+ key_alloc_error:
+  schedule_destroy(s);
+ schedule_error:
+  perror(__FUNCTION__);
+  return NULL;
+}
+
+
+static bool wave_worker (yarn_word_t pool_id, void* task) {
+  struct wave_task* t = (struct wave_task*) task;
+
+  while (true) {
+    const yarn_word_t i = yarn_get_and_incv(&t->next);
+    if (i >= t->count) {
+      break;
+    }
+
+    enum yarn_ret ret = t->executor(pool_id, t->data, t->iterations[i]);
+    if (ret == yarn_ret_error) goto exec_error;
+  }
+
+  return true;
+
+ exec_error:
+  perror(__FUNCTION__);
+  return false;
+}
+
+bool yarn_inspect_exec (const struct yarn_schedule* s,
+			yarn_executor_t executor,
+			void* data,
+			yarn_word_t thread_count)
+{
+  for (yarn_word_t w = 0; w < s->wave_count; ++w) {
+    struct wave_task task = {
+      .executor = executor,
+      .data = data,
+      .iterations = &s->order[s->offsets[w]],
+      .count = s->offsets[w+1] - s->offsets[w]
+    };
+    yarn_writev(&task.next, 0);
+
+    // No point in waking up the whole pool for a handful of iterations.
+    const yarn_word_t threads = thread_count < task.count ? thread_count : task.count;
+    bool ret = yarn_tpool_exec(wave_worker, (void*) &task, threads);
+    if (!ret) goto exec_error;
+  }
+
+  return true;
+
+ exec_error:
+  perror(__FUNCTION__);
+  return false;
+}
@@ -0,0 +1,58 @@
+/*!
+\author Rémi Attab
+\license FreeBSD (see the LICENSE file).
+
+
+Inspector/executor scheduling for yarn_exec_inspect. The inspector pass records the
+addresses touched by each iteration and every iteration is then assigned to the first
+wave that comes after all the iterations it conflicts with. The iterations of a wave are
+independent and can be executed in any order.
+
+Schedules are cached by inspector so that loops whose index arrays don't change between
+invocations only pay for the inspection once.
+
+ */
+
+
+#ifndef YARN_INSPECT_H_
+#define YARN_INSPECT_H_
+
+
+#include "yarn.h"
+#include "yarn/types.h"
+
+
+struct yarn_schedule {
+  yarn_word_t count;
+  yarn_word_t wave_count;
+
+  // Iterations sorted by wave. Wave w is order[offsets[w]] up to order[offsets[w+1]].
+  yarn_word_t* offsets;
+  yarn_word_t* order;
+};
+
+
+/*!
+Returns the schedule of the loop, either from the cache if the inspector was last called
+with the same data, the same count and an identical key or by running the inspector on 
+every iteration.
+The schedule is owned by the cache and stays valid until the next call.
+*/
+const struct yarn_schedule* yarn_inspect (yarn_inspector_t inspector,
+					  void* data,
+					  yarn_word_t count,
+					  yarn_word_t thread_count,
+					  const void* key,
+					  size_t key_size);
+
+//! Executes the waves of the schedule one after the other. thread_count can't be 0.
+bool yarn_inspect_exec (const struct yarn_schedule* schedule,
+			yarn_executor_t executor,
+			void* data,
+			yarn_word_t thread_count);
+
+//! Frees the cached schedules and the access buffers.
+void yarn_inspect_destroy (void);
+
+
+#endif // YARN_INSPECT_H_
@@ -0,0 +1,44 @@
+/*!
+\author Rémi Attab
+\license FreeBSD (see the LICENSE file).
+
+
+ */
+
+
+#include "park.h"
+
+#include "helper.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+void yarn_park_init(struct yarn_park* p) {
+  p->seq = 0;
+  yarn_writev_barrier(&p->waiters, 0);
+}
+
+
+void yarn_park_wait(struct yarn_park* p, yarn_word_t token) {
+  yarn_incv(&p->waiters);
+
+  // Returns right away if the seq was changed since the token was taken.
+  syscall(SYS_futex, &p->seq, FUTEX_WAIT_PRIVATE, (int) token, NULL, NULL, 0);
+
+  yarn_decv(&p->waiters);
+}
+
+
+void yarn_park_wake_all(struct yarn_park* p) {
+  __sync_add_and_fetch(&p->seq, 1);
+
+  if (yarn_readv(&p->waiters) > 0) {
+    syscall(SYS_futex, &p->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+
+extern inline yarn_word_t yarn_park_token(struct yarn_park* p);
@@ -0,0 +1,50 @@
+/*!
+\author Rémi Attab
+\license FreeBSD (see the LICENSE file).
+
+
+Futex based parking spot for threads that have to wait on a lock-free condition.
+
+Waiters must grab a token via yarn_park_token before checking their condition and only
+call yarn_park_wait if the condition still blocks. Wakers must update the condition
+before calling yarn_park_wake_all. The token guarantees that a wake that happens between
+the check and the wait is never lost. Spurious wakeups are possible so the condition
+should always be rechecked after a wait.
+
+ */
+
+
+#ifndef YARN_PARK_H_
+#define YARN_PARK_H_
+
+
+#include "yarn/types.h"
+#include "atomic.h"
+
+
+struct yarn_park {
+  // Futex word. Incremented on every wake.
+  volatile int seq;
+
+  // Used to avoid the wake syscall when no one is parked.
+  yarn_atomic_var waiters;
+};
+
+
+void yarn_park_init(struct yarn_park* p);
+
+//! Must be called before the condition is checked.
+inline yarn_word_t yarn_park_token(struct yarn_park* p) {
+  yarn_word_t token = (yarn_word_t) p->seq;
+  yarn_mem_barrier();
+  return token;
+}
+
+//! Blocks until yarn_park_wake_all is called after the token was taken.
+void yarn_park_wait(struct yarn_park* p, yarn_word_t token);
+
+//! Wakes up every thread that is currently parked.
+void yarn_park_wake_all(struct yarn_park* p);
+
+
+#endif // YARN_PARK_H_
@@ -0,0 +1,128 @@
+/*!
+\author Rémi Attab
+\license FreeBSD (see the LICENSE file).
+
+
+ */
+
+
+#include "task_queue.h"
+
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+
+// The slot can be filled with the task.
+#define SLOT_FREE(n) ((n)*2)
+// The slot holds the task.
+#define SLOT_FULL(n) ((n)*2+1)
+
+
+static inline struct task_slot* get_slot (struct yarn_task_queue* q, yarn_word_t n) {
+  return &q->slots[n % q->capacity];
+}
+
+
+struct yarn_task_queue* yarn_task_queue_init (yarn_word_t capacity) {
+  if (capacity == 0) {
+    capacity = 1;
+  }
+
+  struct yarn_task_queue* q = 
+    malloc(sizeof(struct yarn_task_queue) + capacity * sizeof(struct task_slot));
+  if (!q) goto alloc_error;
+
+  q->capacity = capacity;
+  yarn_writev(&q->count, 0);
+  yarn_writev(&q->is_closed, false);
+  yarn_park_init(&q->park);
+
+  for (yarn_word_t i = 0; i < capacity; ++i) {
+    yarn_writev(&q->slots[i].seq, SLOT_FREE(i));
+    q->slots[i].task = NULL;
+  }
+  yarn_mem_barrier();
+
+  return q;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  return NULL;
+}
+
+void yarn_task_queue_destroy (struct yarn_task_queue* q) {
+  free(q);
+}
+
+
+bool yarn_task_submit (struct yarn_task_queue* q, void* task) {
+  // NULL is how yarn_task_queue_get reports a closed queue.
+  if (!task) {
+    errno = EINVAL;
+    return false;
+  }
+  if (yarn_readv(&q->is_closed)) {
+    return false;
+  }
+
+  const yarn_word_t n = yarn_readv(&q->count);
+  struct task_slot* slot = get_slot(q, n);
+
+  // Backpressure: wait for the epoch that used the slot to be committed.
+  while (true) {
+    const yarn_word_t token = yarn_park_token(&q->park);
+    if (yarn_readv(&slot->seq) == SLOT_FREE(n)) {
+      break;
+    }
+    yarn_park_wait(&q->park, token);
+  }
+
+  slot->task = task;
+  yarn_writev_barrier(&slot->seq, SLOT_FULL(n));
+  yarn_writev_barrier(&q->count, n+1);
+
+  yarn_park_wake_all(&q->park);
+  return true;
+}
+
+void yarn_task_close (struct yarn_task_queue* q) {
+  yarn_writev_barrier(&q->is_closed, true);
+  yarn_park_wake_all(&q->park);
+}
+
+
+void* yarn_task_queue_get (struct yarn_task_queue* q, yarn_word_t epoch) {
+  struct task_slot* slot = get_slot(q, epoch);
+
+  while (true) {
+    const yarn_word_t token = yarn_park_token(&q->park);
+
+    if (yarn_readv(&slot->seq) == SLOT_FULL(epoch)) {
+      yarn_mem_barrier();
+      return slot->task;
+    }
+
+    // count is written after the slot so if we see the close, we see the last task.
+    if (yarn_readv(&q->is_closed) && epoch >= yarn_readv(&q->count)) {
+      return NULL;
+    }
+
+    yarn_park_wait(&q->park, token);
+  }
+}
+
+void yarn_task_queue_release (struct yarn_task_queue* q, yarn_word_t epoch) {
+  struct task_slot* slot = get_slot(q, epoch);
+
+  // Epochs past the end of the queue never had a slot.
+  if (yarn_readv(&slot->seq) != SLOT_FULL(epoch)) {
+    return;
+  }
+
+  slot->task = NULL;
+  yarn_writev_barrier(&slot->seq, SLOT_FREE(epoch + q->capacity));
+  yarn_park_wake_all(&q->park);
+}
@@ -0,0 +1,55 @@
+/*!
+\author Rémi Attab
+\license FreeBSD (see the LICENSE file).
+
+
+Bounded queue of ordered tasks for yarn_exec_tasks. The n-th submitted task is executed
+by epoch n and its slot is only released once the epoch is committed so that rolled back
+epochs can get their task back. The producer is blocked while the queue is full.
+
+Only a single producer is supported.
+
+ */
+
+
+#ifndef YARN_TASK_QUEUE_H_
+#define YARN_TASK_QUEUE_H_
+
+
+#include "yarn.h"
+#include "yarn/types.h"
+#include "atomic.h"
+#include "park.h"
+
+
+struct task_slot {
+  // Either SLOT_FREE or SLOT_FULL of the task number that owns the slot.
+  yarn_atomic_var seq;
+  void* task;
+};
+
+struct yarn_task_queue {
+  yarn_word_t capacity;
+
+  // Number of tasks submitted so far.
+  yarn_atomic_var count;
+  yarn_atomic_var is_closed;
+
+  // Where both the producer and the consumers wait.
+  struct yarn_park park;
+
+  struct task_slot slots[];
+};
+
+
+/*!
+Returns the task of the given epoch or NULL if the queue was closed before the task was
+submitted. Blocks until either happens.
+*/
+void* yarn_task_queue_get(struct yarn_task_queue* q, yarn_word_t epoch);
+
+//! Frees up the slot of a committed epoch.
+void yarn_task_queue_release(struct yarn_task_queue* q, yarn_word_t epoch);
+
+
+#endif // YARN_TASK_QUEUE_H_
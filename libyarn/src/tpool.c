@@ -13,17 +13,27 @@ Implementation details of threads.h
 #include "atomic.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <pthread.h>
 #include <sched.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 
 struct pool_thread {
   pthread_t thread;
+
+  // Only accessed by the thread itself.
+  pid_t tid;
+  bool is_high;
 };
 
+//! Amount by which the nice value is lowered for high priority threads.
+#define YARN_TPOOL_NICE_BOOST 5
+
 
 //! The one and only thread pool.
 static struct pool_thread* g_pool = NULL;
@@ -43,6 +53,11 @@ static pthread_mutex_t g_pool_task_lock;
 static pthread_cond_t g_pool_task_cond;
 static pthread_barrier_t g_pool_task_barrier;
 
+// Nice value of the process when the pool was created.
+static int g_pool_nice;
+// Cleared once we're refused a priority boost.
+static yarn_atomic_var g_pool_can_boost;
+
 
 static inline void* worker_launcher (void* param);
 
@@ -98,6 +113,11 @@ bool yarn_tpool_init (void) {
 
   yarn_writev(&g_pool_destroy, false);
 
+  // -1 is a valid nice value so errno is the only way to detect an error.
+  errno = 0;
+  g_pool_nice = getpriority(PRIO_PROCESS, 0);
+  yarn_writev(&g_pool_can_boost, errno == 0);
+
   yarn_word_t pool_id = 0;
   for (; pool_id < g_pool_size; ++pool_id) {
 
@@ -203,11 +223,39 @@ bool yarn_tpool_exec (yarn_worker_t worker, void* task, yarn_word_t thread_count
 
 
 
+bool yarn_tpool_set_priority (yarn_word_t pool_id, bool is_high) {
+  struct pool_thread* pool_thread = &g_pool[pool_id];
+
+  if (pool_thread->is_high == is_high) {
+    return false;
+  }
+  if (is_high && !yarn_readv(&g_pool_can_boost)) {
+    return false;
+  }
+
+  // Linux applies the nice value to a single thread if we give it a thread id.
+  const int nice = is_high ? g_pool_nice - YARN_TPOOL_NICE_BOOST : g_pool_nice;
+  if (setpriority(PRIO_PROCESS, pool_thread->tid, nice)) {
+    if (errno == EPERM || errno == EACCES) {
+      yarn_writev(&g_pool_can_boost, false);
+    }
+    return false;
+  }
+
+  pool_thread->is_high = is_high;
+  return true;
+}
+
+
+
 static inline void* worker_launcher (void* param) {
   const yarn_word_t pool_id = (yarn_word_t) param;
 
   int ret = 0;
 
+  g_pool[pool_id].tid = (pid_t) syscall(SYS_gettid);
+  g_pool[pool_id].is_high = false;
+
   while (!yarn_readv(&g_pool_destroy)) {
 
     struct pool_task* task = NULL;
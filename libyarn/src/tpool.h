@@ -36,5 +36,12 @@ bool yarn_tpool_exec (yarn_worker_t worker, void* task, yarn_word_t thread_count
 yarn_word_t yarn_tpool_size ();
 bool yarn_tpool_is_done();
 
+/*!
+Raises or restores the scheduling priority of the calling pool thread. Raising the 
+priority usually requires privileges so after the first refusal, only restoring the 
+priority does anything. Returns true if the priority was changed.
+*/
+bool yarn_tpool_set_priority (yarn_word_t pool_id, bool is_high);
+
 
 #endif // YARN_TPOOL_H_
@@ -12,19 +12,125 @@ The main yarn header for the target programs.
 #include "epoch.h"
 #include "bits.h"
 #include "pmem.h"
+#include "atomic.h"
+#include "yarn/timer.h"
+#include "task_queue.h"
+#include "inspect.h"
+#include "helper.h"
 
+#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <errno.h>
+#include <pthread.h>
 
 
 struct task_info {
   yarn_executor_t executor;
+  yarn_range_executor_t range_executor;
+  yarn_nest_executor_t nest_executor;
+  yarn_task_executor_t task_executor;
   void* data;
+
+  struct yarn_task_queue* queue;
+
+  // Epoch of the first inner iteration of each outer iteration for yarn_exec_nest.
+  // nest_offsets[nest_outer_count] is the total number of iterations.
+  yarn_word_t* nest_offsets;
+  yarn_word_t nest_outer_count;
+
+  // End bound of each loop for yarn_exec_loops or LOOP_END_UNKNOWN.
+  const struct yarn_loop* loops;
+  yarn_word_t loop_count;
+  yarn_atomic_var* loop_ends;
+
+  // Executed by the first and second epoch of yarn_exec_call.
+  yarn_call_executor_t callee;
+  yarn_call_executor_t continuation;
+
+  // Walked by yarn_exec_list.
+  yarn_list_executor_t list_executor;
+  void* list_head;
+  size_t list_next_offset;
 };
 
+#define LOOP_END_UNKNOWN 0
+
+#define CALL_CALLEE_EPOCH 0
+#define CALL_CONTINUATION_EPOCH 1
+#define CALL_EPOCHS 2
+
+
+// Range of iterations that was assigned to an epoch by yarn_exec_range.
+struct epoch_range {
+  // Either RANGE_BUSY or RANGE_READY of the epoch that owns the range.
+  yarn_atomic_var tag;
+  yarn_word_t begin;
+  yarn_word_t end;
+};
+
+#define RANGE_READY(e) ((e)*2)
+#define RANGE_BUSY(e) ((e)*2+1)
+
+// Aim for epochs that are long enough to amortize the cost of next, commit and co.
+#define YARN_RANGE_TARGET_NS 20000
+#define YARN_RANGE_CHUNK_MAX 4096
+
+// Maximum number of epochs that are committed at once.
+#define YARN_COMMIT_BATCH_MAX 16
+
+// Number of executors whose trip count is remembered. Must be a power of two.
+#define YARN_TRIP_TABLE_SIZE 64
+
+// Number of epochs executed by the last call of an executor. Collisions just overwrite.
+struct trip_entry {
+  uintptr_t executor;
+  yarn_word_t epochs;
+};
+
+static struct trip_entry g_trip_table[YARN_TRIP_TABLE_SIZE];
+
+// Epochs between each measure of the processor time of a thread.
+#define YARN_SCHED_SAMPLE 32
+// Percentage of the wall time that a thread must run to not be considered preempted.
+#define YARN_SCHED_CPU_RATIO 75
+
+// Set if a thread recently spent a good chunk of an epoch waiting for a processor.
+static yarn_atomic_var g_is_oversubscribed;
+static bool g_fair_scheduling;
+
+// Epochs are committed as soon as they're done. See commit_unordered.
+static bool g_unordered;
+
+struct sched_sample {
+  yarn_word_t count;
+  yarn_time_t thread_start;
+  yarn_time_t system_start;
+};
+
+static struct epoch_range* g_range_list;
+static yarn_word_t g_range_max;
+
+// Predicted node of each epoch for yarn_exec_list. The last epoch of the window can
+// predict the node of the epoch that follows it so there's one more than the window.
+static void** g_list_nodes;
+static yarn_word_t g_list_max;
+// Last epoch whose node was predicted. Both are protected by g_list_lock.
+static yarn_word_t g_list_walk;
+static pthread_mutex_t g_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Number of iterations to give to the next new epoch.
+static yarn_atomic_var g_chunk_size;
+static bool g_chunk_adaptive;
+
 
 static bool g_is_init = false;
 static bool g_is_dep_init;
 
+// Set while the thread pool is executing a loop. Only one loop can execute at a time.
+static bool g_is_executing = false;
+
 static bool init_dep (size_t ws_size, yarn_word_t index_size) {
   if (g_is_dep_init) {
     bool ret = yarn_dep_global_reset(ws_size, index_size);
@@ -69,11 +175,22 @@ bool yarn_init (void) {
 
   if (!yarn_tpool_init()) goto tpool_error;  
   if (!yarn_epoch_init()) goto epoch_error;
+
+  g_range_max = yarn_epoch_max();
+  g_range_list = malloc(g_range_max * sizeof(struct epoch_range));
+  if (!g_range_list) goto range_alloc_error;
+
+  g_list_max = g_range_max * 2;
+  g_list_nodes = malloc(g_list_max * sizeof(void*));
+  if (!g_list_nodes) goto list_alloc_error;
   
   g_is_init = true;
 
   return true;
 
+ list_alloc_error:
+  free(g_range_list);
+ range_alloc_error:
   yarn_epoch_destroy();
  epoch_error:
   yarn_tpool_destroy();
@@ -89,6 +206,9 @@ void yarn_destroy(void) {
   }
 
   destroy_dep();
+  yarn_inspect_destroy();
+  free(g_list_nodes);
+  free(g_range_list);
   yarn_epoch_destroy();
   yarn_tpool_destroy();
 
@@ -96,15 +216,161 @@ void yarn_destroy(void) {
 }
 
 
-// Everytime we double the number of epoch we do an extra iteration per epoch.
-/* This won't work too well if you have 
-yarn_word_t epoch_task_count (yarn_word_t epoch) {
-  const yarn_word_t divider = 32;
+static void reset_range (const struct yarn_policy* policy) {
+  for (yarn_word_t i = 0; i < g_range_max; ++i) {
+    yarn_writev(&g_range_list[i].tag, -1);
+  }
+
+  g_chunk_adaptive = policy->chunk_size == 0;
+  yarn_writev(&g_chunk_size, g_chunk_adaptive ? 1 : policy->chunk_size);
+}
+
+/*
+Epochs are handed out in order so the range of a new epoch starts where the range of the
+previous epoch ends. Rolled back epochs keep the range they were first given.
+
+A rolled back epoch can be dispatched again while its stale execution is still looking for
+its range so only one of them gets to pick it.
+ */
+static void get_range (yarn_word_t epoch, yarn_word_t* begin, yarn_word_t* end) {
+  struct epoch_range* range = &g_range_list[YARN_BIT_INDEX(epoch, g_range_max)];
+
+  yarn_word_t tag = yarn_readv(&range->tag);
+
+  if (tag != RANGE_READY(epoch) && tag != RANGE_BUSY(epoch) &&
+      yarn_casv(&range->tag, tag, RANGE_BUSY(epoch)) == tag)
+  {
+    yarn_word_t first = 0;
+    if (epoch != 0) {
+      struct epoch_range* prev = 
+	&g_range_list[YARN_BIT_INDEX(epoch-1, g_range_max)];
+
+      // The previous epoch was handed out before us but might not be published yet.
+      while (yarn_readv(&prev->tag) != RANGE_READY(epoch-1)) {
+	sched_yield();
+      }
+      yarn_mem_barrier();
+      first = prev->end;
+    }
+
+    range->begin = first;
+    range->end = first + yarn_readv(&g_chunk_size);
+    yarn_writev_barrier(&range->tag, RANGE_READY(epoch));
+  }
+  else {
+    while (yarn_readv(&range->tag) != RANGE_READY(epoch)) {
+      sched_yield();
+    }
+    yarn_mem_barrier();
+  }
+
+  *begin = range->begin;
+  *end = range->end;
+}
+
+/*
+Aims for epochs that take YARN_RANGE_TARGET_NS to execute and halves the chunk size
+whenever an epoch has to be executed again. Smaller chunks means less work is thrown away
+on rollbacks. The updates are racy but it's only a heuristic.
+
+The executor doesn't say where it stopped in a range that ended early so the timing of
+those epochs is ignored. Epochs past the end of the loop would otherwise look like they
+executed a whole range for free and blow up the chunk size.
+ */
+static void update_chunk_size (yarn_word_t iterations, 
+			       yarn_time_t elapsed, 
+			       bool is_rollback,
+			       bool is_complete) 
+{
+  if (!g_chunk_adaptive) {
+    return;
+  }
+
+  yarn_word_t chunk_size = yarn_readv(&g_chunk_size);
+
+  if (is_rollback) {
+    chunk_size = chunk_size > 1 ? chunk_size / 2 : 1;
+  }
+  else if (!is_complete) {
+    return;
+  }
+  else {
+    yarn_word_t target = elapsed == 0 ? 
+      YARN_RANGE_CHUNK_MAX : (YARN_RANGE_TARGET_NS * iterations) / elapsed;
+
+    // Grow slowly to avoid overshooting because of a few cheap iterations.
+    chunk_size = (chunk_size*3 + target) / 4;
+    if (chunk_size < 1) {
+      chunk_size = 1;
+    }
+    if (chunk_size > YARN_RANGE_CHUNK_MAX) {
+      chunk_size = YARN_RANGE_CHUNK_MAX;
+    }
+  }
+
+  yarn_writev(&g_chunk_size, chunk_size);
+}
+
+static enum yarn_ret exec_range (yarn_word_t pool_id, 
+				 struct task_info* info, 
+				 yarn_word_t epoch,
+				 bool is_rollback) 
+{
+  yarn_word_t begin;
+  yarn_word_t end;
+  get_range(epoch, &begin, &end);
+
+  yarn_time_t start = yarn_timer_sample_thread();
+  enum yarn_ret ret = info->range_executor(pool_id, info->data, begin, end);
+  yarn_time_t elapsed = yarn_timer_diff(start, yarn_timer_sample_thread());
+
+  update_chunk_size(end - begin, elapsed, is_rollback, ret == yarn_ret_continue);
+  
+  return ret;
+}
+
+
+static struct trip_entry* get_trip_entry (yarn_executor_t executor) {
+  const uintptr_t key = (uintptr_t) executor;
+  return &g_trip_table[(key >> 4) & (YARN_TRIP_TABLE_SIZE-1)];
+}
+
+/*
+Returns the predicted end bound of the loop in epochs. The epoch that returns
+yarn_ret_break is part of the loop so the bound is one past it. Nested loops know
+exactly how many epochs they need so there's nothing to predict.
+ */
+static yarn_word_t predict_end (const struct task_info* info, 
+				const struct yarn_policy* policy) 
+{
+  if (info->nest_executor) {
+    return info->nest_offsets[info->nest_outer_count] + 1;
+  }
+  // Holding back the epoch that breaks doesn't cost a thing since we're done by then.
+  if (info->callee) {
+    return CALL_EPOCHS;
+  }
+  if (!info->executor) {
+    return 0;
+  }
+  if (policy->trip_count != 0) {
+    return policy->trip_count + 1;
+  }
+
+  const struct trip_entry* entry = get_trip_entry(info->executor);
+  return entry->executor == (uintptr_t) info->executor ? entry->epochs : 0;
+}
+
+// Every epoch up to the stop epoch was committed so first is the number of epochs.
+static void record_end (const struct task_info* info) {
+  if (!info->executor) {
+    return;
+  }
 
-  yarn_word_t rel_epoch = epoch - g_base_epoch;
-  return 1 + yarn_bit_log2(rel_epoch / divider);
+  struct trip_entry* entry = get_trip_entry(info->executor);
+  entry->executor = (uintptr_t) info->executor;
+  entry->epochs = yarn_epoch_first();
 }
-*/
 
 
 yarn_word_t yarn_thread_count() {
@@ -112,9 +378,326 @@ yarn_word_t yarn_thread_count() {
 }
 
 
+bool yarn_exec_has_started (void) {
+  return errno == ECANCELED;
+}
+
+
+/*
+Nested loops are flattened into a single sequence of epochs ordered by (outer, inner) so
+the inner iterations of different outer iterations can execute speculatively at the same
+time. The outer iteration of an epoch is found with a binary search in the offsets.
+ */
+static enum yarn_ret exec_nest (yarn_word_t pool_id, 
+				struct task_info* info, 
+				yarn_word_t epoch)
+{
+  const yarn_word_t* offsets = info->nest_offsets;
+
+  // Past the last iteration so there's nothing left to execute.
+  if (epoch >= offsets[info->nest_outer_count]) {
+    return yarn_ret_break;
+  }
+
+  // Looking for the last outer iteration that starts at or before epoch. 
+  // Empty inner loops share their offset with the next outer iteration.
+  yarn_word_t first = 0;
+  yarn_word_t last = info->nest_outer_count;
+  while (last - first > 1) {
+    const yarn_word_t mid = first + (last - first) / 2;
+    if (offsets[mid] <= epoch) {
+      first = mid;
+    }
+    else {
+      last = mid;
+    }
+  }
+
+  return info->nest_executor(pool_id, info->data, first, epoch - offsets[first]);
+}
+
+
+/*
+Rolled back epochs can end up in a different loop so any end that was set by a previous 
+execution of the epoch is dropped along with every epoch that used it.
+ */
+static void reset_loop_end (struct task_info* info, yarn_word_t epoch) {
+  for (yarn_word_t loop = 0; loop < info->loop_count-1; ++loop) {
+    if (yarn_casv(&info->loop_ends[loop], epoch+1, LOOP_END_UNKNOWN) == epoch+1) {
+      yarn_epoch_do_rollback_all(epoch+1);
+      return;
+    }
+  }
+}
+
+/*
+Only the earliest break of a loop counts. A later break was executed with a stale end and
+was already rolled back by whoever set the earlier one.
+ */
+static void set_loop_end (struct task_info* info, yarn_word_t loop, yarn_word_t end) {
+  yarn_atomic_var* loop_end = &info->loop_ends[loop];
+
+  yarn_word_t old_end;
+  do {
+    old_end = yarn_readv(loop_end);
+    if (old_end != LOOP_END_UNKNOWN && old_end <= end) {
+      return;
+    }
+  } while (yarn_casv(loop_end, old_end, end) != old_end);
+
+  // Every epoch that follows was executed as part of the wrong loop.
+  yarn_epoch_do_rollback_all(end);
+}
+
+/*
+The loops are laid out one after the other in the timeline and the epochs that follow the
+last known end are assumed to be part of that loop. This is the same assumption that is 
+made for a single loop. When a loop ends, the epochs that follow it are rolled back and 
+re-executed as part of the next loop. The epochs of the next loop are then free to 
+execute while the tail of the previous loop is being committed.
+ */
+static enum yarn_ret exec_loop (yarn_word_t pool_id, 
+				struct task_info* info, 
+				yarn_word_t epoch,
+				bool is_rollback)
+{
+  if (is_rollback) {
+    reset_loop_end(info, epoch);
+  }
+
+  yarn_word_t loop = 0;
+  yarn_word_t start = 0;
+  for (; loop < info->loop_count-1; ++loop) {
+    const yarn_word_t end = yarn_readv(&info->loop_ends[loop]);
+    if (end == LOOP_END_UNKNOWN || epoch < end) {
+      break;
+    }
+    start = end;
+  }
+
+  const struct yarn_loop* cur = &info->loops[loop];
+  enum yarn_ret ret = cur->executor(pool_id, cur->data, epoch - start);
+
+  // Only the last loop stops the timeline.
+  if (ret == yarn_ret_break && loop < info->loop_count-1) {
+    set_loop_end(info, loop, epoch+1);
+    return yarn_ret_continue;
+  }
+
+  return ret;
+}
+
+
+/*
+The callee is executed by the first epoch which is the head from the start so it's never 
+rolled back and it writes straight to memory if the direct head mode is enabled. The 
+continuation is the second epoch which commits once the callee is done.
+ */
+static enum yarn_ret exec_call (yarn_word_t pool_id, 
+				struct task_info* info, 
+				yarn_word_t epoch)
+{
+  enum yarn_ret ret;
+  if (epoch == CALL_CALLEE_EPOCH) {
+    ret = info->callee(pool_id, info->data);
+  }
+  else if (epoch == CALL_CONTINUATION_EPOCH) {
+    ret = info->continuation(pool_id, info->data);
+  }
+  else {
+    return yarn_ret_break;
+  }
+
+  // Only the epoch that follows the continuation ends the call.
+  return ret == yarn_ret_break ? yarn_ret_continue : ret;
+}
+
+
+static inline void** get_list_next (const struct task_info* info, void* node) {
+  return (void**) ((char*) node + info->list_next_offset);
+}
+
+static void reset_list (const struct task_info* info) {
+  g_list_nodes[0] = info->list_head;
+  g_list_walk = 0;
+}
+
+/*
+Walks ahead from the last predicted node without going through yarn_dep. The next pointers
+can be modified by epochs that are still executing so whatever we read here is only a 
+guess which is checked by check_list_next.
+
+Every epoch between the walk and the epoch being predicted was handed out so they all fit
+in g_list_nodes without stepping on each other.
+ */
+static void* predict_list_node (const struct task_info* info, yarn_word_t epoch) {
+  YARN_CHECK_RET0(pthread_mutex_lock(&g_list_lock));
+
+  for (; g_list_walk < epoch; ++g_list_walk) {
+    void* node = g_list_nodes[YARN_BIT_INDEX(g_list_walk, g_list_max)];
+    g_list_nodes[YARN_BIT_INDEX(g_list_walk+1, g_list_max)] = 
+      node ? *((void* volatile*) get_list_next(info, node)) : NULL;
+  }
+  void* node = g_list_nodes[YARN_BIT_INDEX(epoch, g_list_max)];
+
+  YARN_CHECK_RET0(pthread_mutex_unlock(&g_list_lock));
+  return node;
+}
+
+/*
+The epochs that follow a misprediction were all walked from the wrong node so the walk
+restarts from the right one and they're all rolled back. The rollback is issued before the
+lock is released so that the stale executions can't sneak their own next pointer in. They
+only ever see their pending rollback status and are ignored.
+ */
+static void check_list_next (yarn_word_t epoch, void* next) {
+  YARN_CHECK_RET0(pthread_mutex_lock(&g_list_lock));
+
+  if (yarn_epoch_get_status(epoch) != yarn_epoch_pending_rollback) {
+    void** predicted = &g_list_nodes[YARN_BIT_INDEX(epoch+1, g_list_max)];
+
+    if (g_list_walk == epoch) {
+      *predicted = next;
+      g_list_walk = epoch+1;
+    }
+    else if (*predicted != next) {
+      *predicted = next;
+      g_list_walk = epoch+1;
+      yarn_epoch_do_rollback_all(epoch+1);
+    }
+  }
+
+  YARN_CHECK_RET0(pthread_mutex_unlock(&g_list_lock));
+}
+
+/*
+Each epoch executes the node that it was predicted to get and then reads the real next 
+pointer through yarn_dep. If an earlier epoch later writes to that pointer, the epoch is
+rolled back like for any other violation and checks the pointer again.
+ */
+static enum yarn_ret exec_list (yarn_word_t pool_id, 
+				struct task_info* info, 
+				yarn_word_t epoch)
+{
+  void* node = predict_list_node(info, epoch);
+
+  // Predicted the end of the list.
+  if (!node) {
+    return yarn_ret_break;
+  }
+
+  enum yarn_ret ret = info->list_executor(pool_id, info->data, node);
+  if (ret != yarn_ret_continue) {
+    return ret;
+  }
+
+  // Any checkpoint taken by the executor went away with its frame.
+  yarn_dep_drop_checkpoints(pool_id);
+
+  void* next;
+  if (!yarn_dep_load(pool_id, get_list_next(info, node), &next)) {
+    return yarn_ret_error;
+  }
+
+  check_list_next(epoch, next);
+  return yarn_ret_continue;
+}
+
+
+static enum yarn_ret exec_queue_task (yarn_word_t pool_id, 
+				      struct task_info* info, 
+				      yarn_word_t epoch)
+{
+  void* task = yarn_task_queue_get(info->queue, epoch);
+
+  // The queue is closed and empty so there's nothing left to execute.
+  if (!task) {
+    return yarn_ret_break;
+  }
+
+  return info->task_executor(pool_id, info->data, task);
+}
+
+
+/*
+The head epoch bounds our throughput so its thread gets a higher priority. When we're 
+sharing the processors, the other epochs give theirs up since they're the most likely to
+be thrown away and the head might be waiting for one. Note that an epoch that becomes
+the head while executing isn't boosted until its next epoch.
+ */
+static void update_priority (yarn_word_t pool_id, yarn_word_t epoch) {
+  if (g_fair_scheduling) {
+    return;
+  }
+
+  if (epoch == yarn_epoch_first()) {
+    yarn_tpool_set_priority(pool_id, true);
+    return;
+  }
+
+  yarn_tpool_set_priority(pool_id, false);
+  if (yarn_readv(&g_is_oversubscribed)) {
+    sched_yield();
+  }
+}
+
+/*
+Once in a while, compares the processor time of an epoch with its wall time. A thread 
+that didn't get to run for most of its epoch was preempted by someone else. Timers are
+too expensive to sample every epoch.
+ */
+static bool sched_sample_begin (struct sched_sample* sample) {
+  if (++sample->count % YARN_SCHED_SAMPLE != 0) {
+    return false;
+  }
+
+  sample->system_start = yarn_timer_sample_system();
+  sample->thread_start = yarn_timer_sample_thread();
+  return true;
+}
+
+static void sched_sample_end (struct sched_sample* sample) {
+  yarn_time_t thread_time = 
+    yarn_timer_diff(sample->thread_start, yarn_timer_sample_thread());
+  yarn_time_t system_time = 
+    yarn_timer_diff(sample->system_start, yarn_timer_sample_system());
+
+  bool is_oversubscribed = thread_time * 100 < system_time * YARN_SCHED_CPU_RATIO;
+  if (is_oversubscribed != (bool) yarn_readv(&g_is_oversubscribed)) {
+    yarn_writev(&g_is_oversubscribed, is_oversubscribed);
+  }
+}
+
+
+static void commit_epoch (struct task_info* info, yarn_word_t epoch) {
+  yarn_dep_commit(epoch);
+  yarn_epoch_commit_done(epoch);
+  if (info->queue) {
+    yarn_task_queue_release(info->queue, epoch);
+  }
+}
+
+/*
+An unordered epoch doesn't have to wait for the epochs before it so it commits itself.
+The epoch that set the stop is the exception and is committed once it becomes the head so
+we also take a shot at the head in case it's been waiting on us.
+ */
+static void commit_unordered (struct task_info* info, yarn_word_t epoch) {
+  if (yarn_epoch_claim_commit(epoch)) {
+    commit_epoch(info, epoch);
+  }
+
+  const yarn_word_t first = yarn_epoch_first();
+  if (first != epoch && yarn_epoch_claim_commit(first)) {
+    commit_epoch(info, first);
+  }
+}
+
+
 bool pool_worker_simple (yarn_word_t pool_id, void* task) {
 
   struct task_info* info = (struct task_info*) task;
+  struct sched_sample sample = { .count = pool_id };
 
   while (true) {
     enum yarn_epoch_status old_status;
@@ -123,6 +706,11 @@ bool pool_worker_simple (yarn_word_t pool_id, void* task) {
       break;
     }
 
+    update_priority(pool_id, epoch);
+
+    // Waiting on an empty task queue would look like a preemption.
+    const bool is_sample = !info->queue && sched_sample_begin(&sample);
+
     if (old_status == yarn_epoch_rollback) {
       yarn_dep_rollback(epoch);
       yarn_epoch_rollback_done(epoch);
@@ -133,34 +721,77 @@ bool pool_worker_simple (yarn_word_t pool_id, void* task) {
       goto init_error;
     }
     
-    // In the simple format we have a one to one mapping of invar to epoch id.
-    //  Note that epoch ids are reseted back to 0 when we restart.
-    const yarn_word_t indvar = epoch;
-    enum yarn_ret exec_ret = info->executor(pool_id, info->data, indvar);
+    enum yarn_ret exec_ret;
+    if (info->range_executor) {
+      exec_ret = exec_range(pool_id, info, epoch, old_status == yarn_epoch_rollback);
+    }
+    else if (info->nest_executor) {
+      exec_ret = exec_nest(pool_id, info, epoch);
+    }
+    else if (info->task_executor) {
+      exec_ret = exec_queue_task(pool_id, info, epoch);
+    }
+    else if (info->loops) {
+      exec_ret = exec_loop(pool_id, info, epoch, old_status == yarn_epoch_rollback);
+    }
+    else if (info->callee) {
+      exec_ret = exec_call(pool_id, info, epoch);
+    }
+    else if (info->list_executor) {
+      exec_ret = exec_list(pool_id, info, epoch);
+    }
+    else {
+      // In the simple format we have a one to one mapping of invar to epoch id.
+      //  Note that epoch ids are reseted back to 0 when we restart.
+      const yarn_word_t indvar = epoch;
+      exec_ret = info->executor(pool_id, info->data, indvar);
+    }
     if (exec_ret == yarn_ret_break) {
       yarn_epoch_stop(epoch);
     }
+    else if (exec_ret == yarn_ret_abort) {
+      // Only valid if the epoch really is being rolled back or we'd commit garbage.
+      assert(yarn_epoch_get_status(epoch) == yarn_epoch_pending_rollback);
+    }
     else if (exec_ret == yarn_ret_error) {
       goto exec_error;
     }
+
+    if (is_sample) {
+      sched_sample_end(&sample);
+    }
     
     yarn_epoch_set_done(epoch);
     yarn_dep_thread_destroy(pool_id);
 
+    if (g_unordered) {
+      commit_unordered(info, epoch);
+      continue;
+    }
+
     yarn_word_t commit_epoch;
-    void* task;
-    while(yarn_epoch_get_next_commit(&commit_epoch, &task)) {
-      yarn_dep_commit(commit_epoch);
-      yarn_epoch_commit_done(commit_epoch);
+    yarn_word_t commit_count;
+    while(yarn_epoch_get_commit_batch(&commit_epoch, &commit_count, 
+				      YARN_COMMIT_BATCH_MAX)) 
+    {
+      yarn_dep_commit_batch(pool_id, commit_epoch, commit_count);
+      for (yarn_word_t i = 0; i < commit_count; ++i) {
+	yarn_epoch_commit_done(commit_epoch + i);
+	if (info->queue) {
+	  yarn_task_queue_release(info->queue, commit_epoch + i);
+	}
+      }
     }
 
   } // while;
 
+  yarn_tpool_set_priority(pool_id, false);
   return true;
 
  exec_error:
   yarn_dep_thread_destroy(pool_id);
  init_error:
+  yarn_tpool_set_priority(pool_id, false);
   perror(__FUNCTION__);
   return false;
 }
@@ -172,8 +803,29 @@ bool yarn_exec_simple (yarn_executor_t executor,
 		       yarn_word_t ws_size, 
 		       yarn_word_t index_size) 
 {
+  return yarn_exec_policy(executor, data, thread_count, ws_size, index_size, NULL);
+}
+
+
+static bool exec_task (struct task_info* info,
+		       yarn_word_t thread_count,
+		       yarn_word_t ws_size, 
+		       yarn_word_t index_size,
+		       const struct yarn_policy* policy)
+{
+  static const struct yarn_policy default_policy;
+  if (!policy) {
+    policy = &default_policy;
+  }
+
   bool ret;
 
+  // The runtime state is global so we can't start a loop from within an executor.
+  if (g_is_executing) {
+    errno = EDEADLK;
+    goto nested_error;
+  }
+
   bool del_on_exit = false;
   if (!g_is_init) {
     ret = yarn_init();
@@ -183,25 +835,266 @@ bool yarn_exec_simple (yarn_executor_t executor,
   }
 
 
+  // yarn_exec_call asks for a fixed number of threads which we might not have.
+  if (thread_count > yarn_tpool_size()) {
+    thread_count = yarn_tpool_size();
+  }
+
   ret = init_dep(ws_size, index_size);
   if (!ret) goto dep_alloc_error;
 
+  // The loop ends of yarn_exec_loops and the list walk rely on the epoch order.
+  g_unordered = policy->unordered && !info->loops && !info->list_executor;
+
+  // Unordered epochs don't forward values so a selective rollback only hits one epoch.
+  yarn_epoch_set_rollback_mode(policy->selective_rollback || g_unordered ? 
+			       yarn_epoch_rollback_selective : yarn_epoch_rollback_all);
+  yarn_epoch_set_adaptive_depth(policy->adaptive_depth);
+  yarn_epoch_set_watchdog(!policy->disable_watchdog);
+  yarn_epoch_set_unordered(g_unordered);
+  yarn_epoch_set_distance(policy->dep_distance);
+  yarn_epoch_set_idle(yarn_dep_commit_help);
+  yarn_epoch_set_validate(yarn_dep_validate);
+  yarn_dep_set_direct_head(!g_unordered);
+  yarn_dep_set_unordered(g_unordered);
+  yarn_dep_set_prediction(!g_unordered && !policy->disable_prediction);
+  yarn_dep_set_lazy(policy->lazy_detection && !g_unordered);
+
   ret = yarn_epoch_reset();
   if (!ret) goto epoch_reset_error;
 
-  struct task_info info = {executor, data};
-  ret = yarn_tpool_exec(pool_worker_simple, (void*) &info, thread_count);
+  yarn_epoch_set_end_hint(predict_end(info, policy));
+  reset_range(policy);
+  if (info->list_executor) {
+    reset_list(info);
+  }
+  g_fair_scheduling = policy->fair_scheduling;
+
+  g_is_executing = true;
+  ret = yarn_tpool_exec(pool_worker_simple, (void*) info, thread_count);
+  g_is_executing = false;
   if (!ret) goto exec_error;
 
+  record_end(info);
+
   if (del_on_exit) yarn_destroy();
 
   return true;
 
+  // The executors might have run so the caller can't fall back on a sequential execution.
  exec_error:
+  perror(__FUNCTION__);
+  if(del_on_exit) yarn_destroy();
+  errno = ECANCELED;
+  return false;
+
  epoch_reset_error:
  dep_alloc_error:
   if(del_on_exit) yarn_destroy();
  yarn_init_error:
+ nested_error:
+  perror(__FUNCTION__);
+  return false;
+}
+
+
+bool yarn_exec_policy (yarn_executor_t executor, 
+		       void* data, 
+		       yarn_word_t thread_count,
+		       yarn_word_t ws_size, 
+		       yarn_word_t index_size,
+		       const struct yarn_policy* policy)
+{
+  struct task_info info = { .executor = executor, .data = data };
+  return exec_task(&info, thread_count, ws_size, index_size, policy);
+}
+
+
+bool yarn_exec_range (yarn_range_executor_t executor, 
+		      void* data, 
+		      yarn_word_t thread_count,
+		      yarn_word_t ws_size, 
+		      yarn_word_t index_size,
+		      const struct yarn_policy* policy)
+{
+  struct task_info info = { .range_executor = executor, .data = data };
+  return exec_task(&info, thread_count, ws_size, index_size, policy);
+}
+
+
+bool yarn_exec_nest (yarn_nest_executor_t executor, 
+		     yarn_inner_count_t inner_count,
+		     void* data, 
+		     yarn_word_t outer_count,
+		     yarn_word_t thread_count,
+		     yarn_word_t ws_size, 
+		     yarn_word_t index_size,
+		     const struct yarn_policy* policy)
+{
+  yarn_word_t* offsets = malloc((outer_count+1) * sizeof(yarn_word_t));
+  if (!offsets) goto alloc_error;
+
+  offsets[0] = 0;
+  for (yarn_word_t outer = 0; outer < outer_count; ++outer) {
+    offsets[outer+1] = offsets[outer] + inner_count(data, outer);
+  }
+
+  struct task_info info = { 
+    .nest_executor = executor, 
+    .data = data, 
+    .nest_offsets = offsets, 
+    .nest_outer_count = outer_count
+  };
+  bool ret = exec_task(&info, thread_count, ws_size, index_size, policy);
+
+  free(offsets);
+  return ret;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  return false;
+}
+
+
+bool yarn_exec_tasks (yarn_task_executor_t executor, 
+		      void* data, 
+		      struct yarn_task_queue* queue,
+		      yarn_word_t thread_count,
+		      yarn_word_t ws_size, 
+		      yarn_word_t index_size,
+		      const struct yarn_policy* policy)
+{
+  struct task_info info = { 
+    .task_executor = executor, 
+    .data = data, 
+    .queue = queue 
+  };
+  return exec_task(&info, thread_count, ws_size, index_size, policy);
+}
+
+
+bool yarn_exec_loops (const struct yarn_loop* loops,
+		      yarn_word_t loop_count,
+		      yarn_word_t thread_count,
+		      yarn_word_t ws_size, 
+		      yarn_word_t index_size,
+		      const struct yarn_policy* policy)
+{
+  if (loop_count == 0) {
+    return true;
+  }
+
+  yarn_atomic_var* loop_ends = malloc(loop_count * sizeof(yarn_atomic_var));
+  if (!loop_ends) goto alloc_error;
+
+  for (yarn_word_t loop = 0; loop < loop_count; ++loop) {
+    yarn_writev(&loop_ends[loop], LOOP_END_UNKNOWN);
+  }
+
+  struct task_info info = { 
+    .loops = loops, 
+    .loop_count = loop_count,
+    .loop_ends = loop_ends
+  };
+  bool ret = exec_task(&info, thread_count, ws_size, index_size, policy);
+
+  free(loop_ends);
+  return ret;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  return false;
+}
+
+
+bool yarn_exec_call (yarn_call_executor_t callee,
+		     yarn_call_executor_t continuation,
+		     void* data,
+		     yarn_word_t ws_size, 
+		     yarn_word_t index_size)
+{
+  struct task_info info = { 
+    .callee = callee, 
+    .continuation = continuation, 
+    .data = data 
+  };
+  return exec_task(&info, CALL_EPOCHS, ws_size, index_size, NULL);
+}
+
+
+bool yarn_exec_list (yarn_list_executor_t executor, 
+		     void* data, 
+		     void* head,
+		     size_t next_offset,
+		     yarn_word_t thread_count,
+		     yarn_word_t ws_size, 
+		     yarn_word_t index_size,
+		     const struct yarn_policy* policy)
+{
+  struct task_info info = { 
+    .list_executor = executor, 
+    .data = data, 
+    .list_head = head,
+    .list_next_offset = next_offset
+  };
+  return exec_task(&info, thread_count, ws_size, index_size, policy);
+}
+
+
+bool yarn_exec_inspect (yarn_executor_t executor,
+			yarn_inspector_t inspector,
+			void* data, 
+			yarn_word_t count,
+			yarn_word_t thread_count,
+			const void* key,
+			size_t key_size)
+{
+  bool ret;
+
+  if (g_is_executing) {
+    errno = EDEADLK;
+    goto nested_error;
+  }
+
+  bool del_on_exit = false;
+  if (!g_is_init) {
+    ret = yarn_init();
+    if (!ret) goto yarn_init_error;
+
+    del_on_exit = true;
+  }
+
+  if (thread_count == YARN_ALL_THREADS || thread_count > yarn_tpool_size()) {
+    thread_count = yarn_tpool_size();
+  }
+
+  g_is_executing = true;
+
+  const struct yarn_schedule* schedule = 
+    yarn_inspect(inspector, data, count, thread_count, key, key_size);
+  if (!schedule) goto inspect_error;
+
+  ret = yarn_inspect_exec(schedule, executor, data, thread_count);
+  if (!ret) goto exec_error;
+
+  g_is_executing = false;
+
+  if (del_on_exit) yarn_destroy();
+
+  return true;
+
+ exec_error:
+  perror(__FUNCTION__);
+  g_is_executing = false;
+  if(del_on_exit) yarn_destroy();
+  errno = ECANCELED;
+  return false;
+
+ inspect_error:
+  g_is_executing = false;
+  if(del_on_exit) yarn_destroy();
+ yarn_init_error:
+ nested_error:
   perror(__FUNCTION__);
   return false;
 }
@@ -12,25 +12,330 @@
 enum yarn_ret {
   yarn_ret_continue = 0,
   yarn_ret_break = 1,
-  yarn_ret_error = 2
+  yarn_ret_error = 2,
+
+  //! The epoch is being rolled back so the rest of its work can be skipped.
+  yarn_ret_abort = 3
 };
 
 typedef enum yarn_ret (*yarn_executor_t) (const yarn_word_t pool_id, 
 					  void* data,
 					  yarn_word_t indvar);
 
+//! Executes every iteration within [begin, end).
+typedef enum yarn_ret (*yarn_range_executor_t) (const yarn_word_t pool_id, 
+						void* data,
+						yarn_word_t begin,
+						yarn_word_t end);
+
+//! Executes the iteration inner of the outer iteration outer of a loop nest.
+typedef enum yarn_ret (*yarn_nest_executor_t) (const yarn_word_t pool_id, 
+					       void* data,
+					       yarn_word_t outer,
+					       yarn_word_t inner);
+
+//! Executes a task submitted to a yarn_task_queue.
+typedef enum yarn_ret (*yarn_task_executor_t) (const yarn_word_t pool_id, 
+					       void* data,
+					       void* task);
+
+//! Returns the number of inner iterations for the outer iteration outer.
+typedef yarn_word_t (*yarn_inner_count_t) (void* data, yarn_word_t outer);
+
+//! Either the called function or its continuation for yarn_exec_call.
+typedef enum yarn_ret (*yarn_call_executor_t) (const yarn_word_t pool_id, void* data);
+
+//! Executes a single node of the list for yarn_exec_list.
+typedef enum yarn_ret (*yarn_list_executor_t) (const yarn_word_t pool_id, 
+					       void* data,
+					       void* node);
+
 bool yarn_init (void);
 void yarn_destroy (void);
 
 #define YARN_ALL_THREADS ((yarn_word_t)0) // See YARN_TPOOL_ALL_THREADS
 
+/*!
+Executes each iteration of the loop in its own epoch. Every yarn_exec function clamps 
+thread_count to the size of the thread pool, see yarn_thread_count, without reporting it.
+
+If a yarn_exec function fails after the executors started running then errno is set to
+ECANCELED and some iterations might have had side effects. Any other failure happens
+before anything was executed and the loop can safely be executed sequentially instead.
+*/
 bool yarn_exec_simple (yarn_executor_t executor, 
 		       void* data, 
 		       yarn_word_t thread_count,
 		       yarn_word_t ws_size, 
 		       yarn_word_t index_size);
 
+
+/*!
+Tuning knobs for the speculative execution. A zeroed struct gives the same behaviour as 
+yarn_exec_simple.
+ */
+struct yarn_policy {
+  /*! 
+  When a dependency violation is detected, only rollback the violating epoch and the
+  epochs that read its buffered writes instead of every epoch that follows it.
+  */
+  bool selective_rollback;
+
+  /*!
+  Reduces the number of epochs that are executed speculatively when too many of them get
+  rolled back and increases it again once the rollbacks stop. Loops with frequent 
+  conflicts degrade to a sequential execution instead of wasting work.
+  */
+  bool adaptive_depth;
+
+  /*!
+  Number of iterations executed by each epoch of yarn_exec_range. If 0, the number is
+  adjusted at runtime based on the cost of the iterations and the rollback rate.
+  */
+  yarn_word_t chunk_size;
+
+  /*!
+  Expected number of iterations executed before yarn_ret_break is returned. Epochs past
+  that point are held back until we know whether the loop really ended. If 0, the trip 
+  count of the previous execution of the same executor is used instead. Ignored by 
+  yarn_exec_range, yarn_exec_tasks and yarn_exec_list.
+  */
+  yarn_word_t trip_count;
+
+  /*!
+  By default, the thread executing the oldest epoch gets a higher scheduling priority
+  and the other threads yield their processor when the machine is oversubscribed. This
+  treats every thread equally instead.
+  */
+  bool fair_scheduling;
+
+  /*!
+  For loops whose iterations can be executed in any order. Epochs commit as soon as
+  they're done instead of waiting for the epochs before them and never see the writes of
+  uncommitted epochs. Committing a write rolls back the epochs that read the address, 
+  older or younger, and nothing else. The epoch that returns yarn_ret_break is still 
+  committed after every epoch before it. Ignored by yarn_exec_loops and yarn_exec_list.
+
+  The break is only known once its epoch is done so epochs past it that don't break on 
+  their own can be committed before that. An unordered loop should only end on a bound
+  that every later epoch also sees, like indvar >= n, and not on a value that the loop 
+  computes.
+  */
+  bool unordered;
+
+  /*!
+  Declares that iteration i reads what iteration i - dep_distance wrote. Instead of 
+  speculating, an epoch then waits until the epoch dep_distance before it is done and its
+  writes can be forwarded. Every access is still tracked so a wrong distance only costs
+  rollbacks. The distance is counted in epochs which, for yarn_exec_range, is a chunk of
+  iterations. If 0, the epochs speculate freely.
+  */
+  yarn_word_t dep_distance;
+
+  /*!
+  Detects the conflicts when an epoch is about to commit instead of on every store. The 
+  epoch is rolled back if any value it read doesn't match what the epochs before it 
+  committed. Loads and stores no longer touch the state of the other epochs which helps 
+  loops that write a lot but writes aren't forwarded between epochs and a conflict is 
+  only caught once the reader is done. Ignored for unordered loops.
+  */
+  bool lazy_detection;
+
+  /*!
+  By default, a burst of rollbacks makes the epochs execute one at a time for a while 
+  before speculation is tried again. This keeps speculating no matter how many epochs get
+  rolled back.
+  */
+  bool disable_watchdog;
+
+  /*!
+  By default, an epoch that would read a stale value from an address whose committed 
+  values follow a stride reads the next value of the stride instead and it's validated 
+  before the epoch commits. This always waits for or reads the real value instead. 
+  Predictions are never used by unordered loops.
+  */
+  bool disable_prediction;
+};
+
+//! Same as yarn_exec_simple but with a policy. A NULL policy uses the defaults.
+bool yarn_exec_policy (yarn_executor_t executor, 
+		       void* data, 
+		       yarn_word_t thread_count,
+		       yarn_word_t ws_size, 
+		       yarn_word_t index_size,
+		       const struct yarn_policy* policy);
+
+/*!
+Same as yarn_exec_policy but each epoch executes a range of iterations which amortizes 
+the overhead of the epochs for loops with small bodies. The executor should return 
+yarn_ret_break as soon as it reaches the end of the loop and skip the rest of the range.
+*/
+bool yarn_exec_range (yarn_range_executor_t executor, 
+		      void* data, 
+		      yarn_word_t thread_count,
+		      yarn_word_t ws_size, 
+		      yarn_word_t index_size,
+		      const struct yarn_policy* policy);
+
+/*!
+Executes a two level loop nest where each inner iteration is executed by its own epoch.
+The epochs are ordered by outer then inner iteration so inner iterations of different
+outer iterations can execute in parallel which is handy when neither loop is long enough
+to keep the machine busy on its own. 
+
+The trip count of every inner loop is queried through inner_count before the execution
+starts so it must not depend on the results of the nest. Returning yarn_ret_break from the
+executor ends the whole nest.
+
+Only perfect nests are supported: the nest is flattened into a single sequence of inner 
+iterations and there are no epochs for the outer iterations themselves. Code that comes 
+before or after the inner loop has to be folded into the first or last inner iteration 
+by the executor. An outer iteration with no inner iterations executes nothing at all.
+
+Loops can't be executed from within an executor and trying to do so will fail with 
+EDEADLK.
+*/
+bool yarn_exec_nest (yarn_nest_executor_t executor, 
+		     yarn_inner_count_t inner_count,
+		     void* data, 
+		     yarn_word_t outer_count,
+		     yarn_word_t thread_count,
+		     yarn_word_t ws_size, 
+		     yarn_word_t index_size,
+		     const struct yarn_policy* policy);
+
+/*!
+Ordered queue of tasks for yarn_exec_tasks. At most capacity tasks can be waiting or 
+executing at any one time. A queue can only be used for a single call to yarn_exec_tasks.
+*/
+struct yarn_task_queue;
+
+struct yarn_task_queue* yarn_task_queue_init (yarn_word_t capacity);
+void yarn_task_queue_destroy (struct yarn_task_queue* q);
+
+/*!
+Adds a task at the end of the queue. Blocks while the queue is full. Returns false if the
+queue was closed. Only a single thread may submit tasks. NULL marks the end of the queue 
+so it's not a valid task and is rejected with EINVAL.
+*/
+bool yarn_task_submit (struct yarn_task_queue* q, void* task);
+
+//! Indicates that no more tasks will be submitted.
+void yarn_task_close (struct yarn_task_queue* q);
+
+/*!
+Executes the tasks of the queue speculatively in the order they were submitted until the
+queue is closed and empty. Tasks are usually submitted by another thread while this runs.
+Returning yarn_ret_break from the executor stops the execution after the task.
+*/
+bool yarn_exec_tasks (yarn_task_executor_t executor, 
+		      void* data, 
+		      struct yarn_task_queue* queue,
+		      yarn_word_t thread_count,
+		      yarn_word_t ws_size, 
+		      yarn_word_t index_size,
+		      const struct yarn_policy* policy);
+
+
+//! One of the loops executed by yarn_exec_loops.
+struct yarn_loop {
+  yarn_executor_t executor;
+  void* data;
+};
+
+/*!
+Executes the loops one after the other as if yarn_exec_policy was called for each of
+them. The loops share a single timeline so the iterations of a loop can start while the
+previous loop is still being committed. Conflicts between the loops are handled like any 
+other conflict. Each loop ends when its executor returns yarn_ret_break.
+*/
+bool yarn_exec_loops (const struct yarn_loop* loops,
+		      yarn_word_t loop_count,
+		      yarn_word_t thread_count,
+		      yarn_word_t ws_size, 
+		      yarn_word_t index_size,
+		      const struct yarn_policy* policy);
+
+/*!
+Executes callee and, at the same time, speculatively executes continuation as if it was 
+called right after callee returned. The callee is never rolled back. The continuation is
+rolled back if it read a value that the callee writes and it's committed once the callee
+returns. Both must access shared memory through yarn_dep so that the conflicts can be
+detected.
+
+Returning yarn_ret_break from either function has no effect. Calls can't be executed from
+within an executor and trying to do so will fail with EDEADLK. The callee can only be 
+executed again after a failure if yarn_exec_has_started returns false.
+*/
+bool yarn_exec_call (yarn_call_executor_t callee,
+		     yarn_call_executor_t continuation,
+		     void* data,
+		     yarn_word_t ws_size, 
+		     yarn_word_t index_size);
+
+/*!
+Executes a while loop that walks a linked list where each node is executed by its own
+epoch. The pointer to the next node is found at next_offset bytes into each node and the
+walk ends on a NULL pointer or when the executor returns yarn_ret_break. 
+
+The node of an epoch is predicted by walking ahead of the epochs that are still executing.
+If the next pointer read by an epoch, through yarn_dep, doesn't match the prediction then
+every epoch that follows it is rolled back and executed again with the right node. The
+executor is free to modify the list as long as it goes through yarn_dep.
+*/
+bool yarn_exec_list (yarn_list_executor_t executor, 
+		     void* data, 
+		     void* head,
+		     size_t next_offset,
+		     yarn_word_t thread_count,
+		     yarn_word_t ws_size, 
+		     yarn_word_t index_size,
+		     const struct yarn_policy* policy);
+
+
+//! Records the addresses accessed by an iteration for yarn_exec_inspect.
+typedef void (*yarn_inspector_t) (const yarn_word_t pool_id, 
+				  void* data,
+				  yarn_word_t indvar);
+
+//! Called by the inspector for every address that the iteration reads.
+void yarn_inspect_read (yarn_word_t pool_id, const void* addr);
+
+//! Called by the inspector for every address that the iteration writes.
+void yarn_inspect_write (yarn_word_t pool_id, const void* addr);
+
+/*!
+Executes the count iterations of a loop whose accesses go through an index array and
+can't be known until the loop runs. The inspector is first executed in parallel for every
+iteration and reports the addresses that the iteration would access without modifying
+anything. The iterations are then split in waves such that every iteration of a wave
+comes after the iterations it depends on. The waves are executed one after the other and
+the iterations within a wave are executed in parallel.
+
+Nothing is speculative so the executor accesses memory directly instead of going through
+yarn_dep. Addresses are compared as is so every access to a given element has to be
+reported with the same address. Returning yarn_ret_break has no effect.
+
+The waves of the last call are kept for each inspector and are reused as long as data,
+count and the key_size bytes at key are identical. The key should cover whatever determines the
+accessed addresses, usually the index array. A NULL key always runs the inspector. The
+cache is dropped by yarn_destroy.
+
+Loops can't be executed from within an executor and trying to do so will fail with
+EDEADLK.
+*/
+bool yarn_exec_inspect (yarn_executor_t executor,
+			yarn_inspector_t inspector,
+			void* data, 
+			yarn_word_t count,
+			yarn_word_t thread_count,
+			const void* key,
+			size_t key_size);
+
 yarn_word_t yarn_thread_count();
 
+//! True if the last yarn_exec function that failed on this thread had started executing.
+bool yarn_exec_has_started (void);
+
 
 #endif // YARN_YARN_H_
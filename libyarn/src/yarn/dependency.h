@@ -14,6 +14,8 @@ very difficult to track these types of things.
 
 #include "types.h"
 
+#include <setjmp.h>
+
 bool yarn_dep_global_init (size_t ws_size, yarn_word_t index_size);
 bool yarn_dep_global_reset (size_t ws_size, yarn_word_t index_size);
 void yarn_dep_global_destroy (void);
@@ -21,20 +23,118 @@ void yarn_dep_global_destroy (void);
 bool yarn_dep_thread_init (yarn_word_t pool_id, yarn_word_t epoch);
 void yarn_dep_thread_destroy (yarn_word_t pool_id);
 
+/*!
+When enabled, the oldest executing epoch reads and writes memory directly instead of 
+going through the write buffers. Disabled by default. Not thread safe.
+*/
+void yarn_dep_set_direct_head (bool enable);
+
+/*!
+When enabled, loads never return values buffered by other epochs and stores don't check
+for violations. Instead, committing a write rolls back every other epoch that read the
+address. Meant for loops whose epochs can be committed in any order. Disabled by default.
+Not thread safe.
+*/
+void yarn_dep_set_unordered (bool enable);
+
+/*!
+When enabled, a load that would read a value that the previous epoch is about to write 
+returns a value extrapolated from the stride of the committed values instead. Predictions
+are validated by yarn_dep_validate which must be called before the epoch is committed.
+Disabled by default. Not thread safe.
+*/
+void yarn_dep_set_prediction (bool enable);
+
+/*!
+When enabled, the reads and writes of an epoch are kept private to the epoch and stores
+don't check for violations. Loads never see the writes of the other epochs until they're
+committed. Instead, the values read by an epoch are recorded and checked against memory 
+by yarn_dep_validate once every older epoch is committed. Cheaper for write heavy loops 
+but a violation is only caught once the epoch is done. Ignored if unordered is enabled. 
+Disabled by default. Not thread safe.
+*/
+void yarn_dep_set_lazy (bool enable);
+
 bool yarn_dep_store (yarn_word_t pool_id, const void* src, void* dest);
 bool yarn_dep_store_fast (yarn_word_t pool_id, 
 			  yarn_word_t index_id, 
 			  const void* src, 
 			  void* dest);
 
+/*!
+Returns true if the epoch of the thread is doomed to be rolled back. Long running 
+executors should poll this and return yarn_ret_abort as soon as possible. Stores made by
+a doomed epoch no longer trigger rollbacks.
+*/
+bool yarn_dep_is_aborted (yarn_word_t pool_id);
+
+/*!
+Takes a checkpoint of the epoch of the thread. If the epoch is later rolled back because
+of a conflict on an address that it first accessed after the checkpoint then only the 
+work done since the checkpoint is thrown away and the execution resumes from the 
+checkpoint instead of the start of the epoch. The restart is done by the yarn_dep 
+functions and yarn_dep_is_aborted once they notice the rollback.
+
+Has the same restrictions as setjmp. The function that took the checkpoint must not 
+return before the epoch is done and its local variables that are modified after the 
+checkpoint must be volatile. Meant for long epochs where most of the work is done before 
+the accesses that are likely to conflict. Should only be used through
+YARN_DEP_CHECKPOINT.
+*/
+jmp_buf* yarn_dep_checkpoint (yarn_word_t pool_id);
+#define YARN_DEP_CHECKPOINT(pool_id) setjmp(*yarn_dep_checkpoint(pool_id))
+
+/*!
+Forgets the checkpoints of the epoch of the thread. Must be called if the function that 
+took them returns while the thread keeps accessing memory through yarn_dep.
+*/
+void yarn_dep_drop_checkpoints (yarn_word_t pool_id);
+
 bool yarn_dep_load (yarn_word_t pool_id, const void* src, void* dest);
 bool yarn_dep_load_fast (yarn_word_t pool_id, 
 			 yarn_word_t index_id, 
 			 const void* src, 
 			 void* dest);
 
+/*!
+Forwarding channel for loop-carried scalars. yarn_dep_produce behaves like
+yarn_dep_store_fast but also signals that the epoch is done with the value at index_id.
+yarn_dep_consume behaves like yarn_dep_load_fast but first waits until the previous
+epoch produced the value or stopped executing. Should only be used for values that are 
+written once per epoch.
+*/
+bool yarn_dep_produce (yarn_word_t pool_id, 
+		       yarn_word_t index_id, 
+		       const void* src, 
+		       void* dest);
+bool yarn_dep_consume (yarn_word_t pool_id, 
+		       yarn_word_t index_id, 
+		       const void* src, 
+		       void* dest);
+
 void yarn_dep_commit (yarn_word_t epoch);
+
+/*!
+Commits count consecutive epochs starting at first_epoch. Each address is only written 
+once with the value of the youngest epoch that wrote it. pool_id is the calling thread.
+*/
+void yarn_dep_commit_batch (yarn_word_t pool_id, 
+			    yarn_word_t first_epoch, 
+			    yarn_word_t count);
+
+/*!
+Helps with the commits of large write sets that are currently in progress. Returns true 
+if any work was done. Meant to be called by threads that have nothing better to do.
+*/
+bool yarn_dep_commit_help (void);
 void yarn_dep_rollback (yarn_word_t epoch);
 
+/*!
+Returns true if the predictions and the lazy loads of the epoch are known to be correct. 
+They can only be checked once every older epoch is committed which is indicated by 
+is_first. If a value was wrong then the epoch is rolled back and false is returned.
+*/
+bool yarn_dep_validate (yarn_word_t epoch, bool is_first);
+
 
 #endif // YARN_DEPENDENCY_H_
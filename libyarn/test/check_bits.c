@@ -104,6 +104,31 @@ START_TEST(t_bits_range_mask) {
 }
 END_TEST
 
+START_TEST(t_bits_range_mask_word) {
+  const yarn_word_t max = YARN_WORD_BIT_SIZE * 4;
+  const yarn_word_t words = YARN_BIT_WORDS(max);
+  fail_if(words != 4, "words=%zu, expected=4", words);
+
+  for (yarn_word_t first = 0; first < max*2; first += 7) {
+    for (yarn_word_t second = first; second <= first + max; second += 5) {
+
+      for (yarn_word_t w = 0; w < words; ++w) {
+	yarn_word_t expected = 0;
+	for (yarn_word_t epoch = first; epoch < second; ++epoch) {
+	  if (YARN_BIT_WORD(epoch, max) == w) {
+	    expected |= YARN_BIT_WORD_MASK(epoch, max);
+	  }
+	}
+
+	yarn_word_t mask = yarn_bit_mask_range_word(first, second, max, w);
+	fail_if(mask != expected, "(%zu, %zu)[%zu], mask="YARN_SHEX", expected="YARN_SHEX,
+		first, second, w, YARN_AHEX(mask), YARN_AHEX(expected));
+      }
+    }
+  }
+}
+END_TEST
+
 START_TEST(t_bits_log2) {
   {
     yarn_word_t log2 = yarn_bit_log2(0);
@@ -160,6 +185,7 @@ Suite* yarn_bits_suite (void) {
   TCase* tc_basic = tcase_create("yarn_bits");
   tcase_add_test(tc_basic, t_bits_basic);
   tcase_add_test(tc_basic, t_bits_range_mask);
+  tcase_add_test(tc_basic, t_bits_range_mask_word);
   tcase_add_test(tc_basic, t_bits_log2);
   tcase_add_test(tc_basic, t_bits_trailing_zeros);
   suite_add_tcase(s, tc_basic);
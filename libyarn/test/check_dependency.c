@@ -11,9 +11,13 @@
 #include <yarn/dependency.h>
 #include <epoch.h>
 #include <tpool.h>
+#include <atomic.h>
 
 #include <assert.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #define YARN_DBG 0
 #include "dbg.h"
@@ -240,6 +244,118 @@ START_TEST(t_dep_seq_commit) {
 }
 END_TEST
 
+START_TEST(t_dep_seq_commit_batch) {
+  yarn_word_t mem_1 = 0;
+  yarn_word_t mem_2 = 0;
+  yarn_word_t mem_3 = 0;
+
+  t_yarn_check_dep_store(f_seq.pid_1, &mem_1, YARN_T_VALUE_1);
+  t_yarn_check_dep_store(f_seq.pid_1, &mem_2, YARN_T_VALUE_1);
+
+  t_yarn_check_dep_store(f_seq.pid_2, &mem_1, YARN_T_VALUE_2);
+  t_yarn_check_dep_load(f_seq.pid_2, &mem_3, 0);
+
+  t_yarn_check_dep_store(f_seq.pid_3, &mem_1, YARN_T_VALUE_3);
+
+  t_yarn_check_dep_store(f_seq.pid_4, &mem_2, YARN_T_VALUE_4);
+  t_yarn_check_dep_store(f_seq.pid_4, &mem_3, YARN_T_VALUE_4);
+
+  yarn_dep_commit_batch(f_seq.pid_1, f_seq.epoch_1, 3);
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_1, YARN_T_VALUE_3, "COMMIT");
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_2, YARN_T_VALUE_1, "COMMIT");
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_3, 0, "COMMIT");
+
+  // The batch shouldn't interfere with the epochs that follow it.
+  t_yarn_check_dep_load(f_seq.pid_4, &mem_1, YARN_T_VALUE_3);
+  t_yarn_check_dep_load(f_seq.pid_4, &mem_2, YARN_T_VALUE_4);
+
+  yarn_dep_commit(f_seq.epoch_4);
+  t_yarn_check_dep_mem(f_seq.pid_4, mem_1, YARN_T_VALUE_3, "COMMIT");
+  t_yarn_check_dep_mem(f_seq.pid_4, mem_2, YARN_T_VALUE_4, "COMMIT");
+  t_yarn_check_dep_mem(f_seq.pid_4, mem_3, YARN_T_VALUE_4, "COMMIT");
+}
+END_TEST
+
+START_TEST(t_dep_seq_abort) {
+  yarn_word_t mem = YARN_T_VALUE_1;
+
+  yarn_epoch_set_rollback_mode(yarn_epoch_rollback_selective);
+
+  t_yarn_check_dep_load(f_seq.pid_3, &mem, YARN_T_VALUE_1);
+  yarn_epoch_do_rollback(f_seq.epoch_2);
+
+  fail_if(yarn_dep_is_aborted(f_seq.pid_1));
+  fail_if(!yarn_dep_is_aborted(f_seq.pid_2));
+  fail_if(yarn_dep_is_aborted(f_seq.pid_3));
+
+  // A doomed epoch shouldn't drag anyone else down with it.
+  t_yarn_check_dep_store(f_seq.pid_2, &mem, YARN_T_VALUE_2);
+  t_yarn_check_epoch_status(f_seq.epoch_3, yarn_epoch_executing);
+  t_yarn_check_epoch_status(f_seq.epoch_4, yarn_epoch_executing);
+
+  // The store of an epoch that isn't doomed still triggers the rollbacks.
+  t_yarn_check_dep_store(f_seq.pid_1, &mem, YARN_T_VALUE_3);
+  t_yarn_check_epoch_status(f_seq.epoch_3, yarn_epoch_pending_rollback);
+  fail_if(!yarn_dep_is_aborted(f_seq.pid_3));
+}
+END_TEST
+
+// Large enough to be committed in partitions.
+START_TEST(t_dep_seq_commit_large) {
+  enum { MEM_SIZE = 256 };
+  yarn_word_t mem[MEM_SIZE];
+
+  for (yarn_word_t i = 0; i < MEM_SIZE; ++i) {
+    mem[i] = 0;
+    t_yarn_check_dep_store(f_seq.pid_1, &mem[i], YARN_T_VALUE_1);
+    if (i % 2) {
+      t_yarn_check_dep_store(f_seq.pid_2, &mem[i], YARN_T_VALUE_2);
+    }
+  }
+
+  yarn_dep_commit(f_seq.pid_2);
+  yarn_dep_commit(f_seq.pid_1);
+
+  for (yarn_word_t i = 0; i < MEM_SIZE; ++i) {
+    const yarn_word_t exp = i % 2 ? YARN_T_VALUE_2 : YARN_T_VALUE_1;
+    t_yarn_check_dep_mem(f_seq.pid_1, mem[i], exp, "COMMIT");
+  }
+
+  // Nothing left to commit.
+  fail_if(yarn_dep_commit_help());
+}
+END_TEST
+
+START_TEST(t_dep_seq_direct_head) {
+  yarn_word_t mem_1 = 0;
+  yarn_word_t mem_2 = 0;
+
+  // Buffered before the head switches to direct writes.
+  t_yarn_check_dep_store(f_seq.pid_1, &mem_2, YARN_T_VALUE_1);
+  yarn_dep_set_direct_head(true);
+
+  t_yarn_check_dep_load(f_seq.pid_2, &mem_1, 0);
+  t_yarn_check_dep_store(f_seq.pid_1, &mem_1, YARN_T_VALUE_1);
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_1, YARN_T_VALUE_1, "STORE");
+  t_yarn_check_epoch_status(f_seq.epoch_2, yarn_epoch_pending_rollback);
+  t_yarn_check_dep_load(f_seq.pid_3, &mem_1, YARN_T_VALUE_1);
+
+  // Values that were already buffered stay buffered until the commit.
+  t_yarn_check_dep_store(f_seq.pid_1, &mem_2, YARN_T_VALUE_2);
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_2, 0, "STORE");
+  t_yarn_check_dep_load(f_seq.pid_1, &mem_2, YARN_T_VALUE_2);
+  t_yarn_check_dep_load(f_seq.pid_1, &mem_1, YARN_T_VALUE_1);
+
+  // Younger epochs still buffer their writes.
+  t_yarn_check_dep_store(f_seq.pid_3, &mem_1, YARN_T_VALUE_3);
+  t_yarn_check_dep_mem(f_seq.pid_3, mem_1, YARN_T_VALUE_1, "STORE");
+
+  yarn_dep_commit(f_seq.epoch_1);
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_1, YARN_T_VALUE_1, "COMMIT");
+  t_yarn_check_dep_mem(f_seq.pid_1, mem_2, YARN_T_VALUE_2, "COMMIT");
+}
+END_TEST
+
 START_TEST(t_dep_seq_rollback) {  
 
   yarn_word_t mem = YARN_T_VALUE_1;
@@ -285,6 +401,73 @@ START_TEST(t_dep_seq_rollback) {
 }
 END_TEST
 
+struct t_sync_load {
+  yarn_word_t* mem;
+  yarn_word_t value;
+  yarn_atomic_var is_started;
+  yarn_atomic_var is_done;
+};
+
+static void* t_dep_seq_sync_loader (void* data) {
+  struct t_sync_load* load = (struct t_sync_load*) data;
+  yarn_writev_barrier(&load->is_started, true);
+
+  bool ret = yarn_dep_load(f_seq.pid_4, load->mem, &load->value);
+  assert(ret);
+
+  yarn_writev_barrier(&load->is_done, true);
+  return NULL;
+}
+
+static void t_dep_seq_sync_rollback(yarn_word_t epoch) {
+  t_yarn_check_epoch_status(epoch, yarn_epoch_pending_rollback);
+  yarn_dep_rollback(epoch);
+  fail_if (!yarn_epoch_restart(epoch, yarn_epoch_rollback_gen(epoch)));
+}
+
+START_TEST(t_dep_seq_sync_load) {
+  yarn_word_t mem = YARN_T_VALUE_1;
+
+  // Two stale reads are enough for the address to be considered hot.
+  t_yarn_check_dep_load(f_seq.pid_4, &mem, YARN_T_VALUE_1);
+  t_yarn_check_dep_store(f_seq.pid_2, &mem, YARN_T_VALUE_2);
+  t_dep_seq_sync_rollback(f_seq.epoch_4);
+
+  t_yarn_check_dep_load(f_seq.pid_4, &mem, YARN_T_VALUE_2);
+  t_yarn_check_dep_store(f_seq.pid_2, &mem, YARN_T_VALUE_3);
+  t_dep_seq_sync_rollback(f_seq.epoch_4);
+
+  // The head has no one to wait on so it doesn't cool the address down.
+  t_yarn_check_dep_load(f_seq.pid_1, &mem, YARN_T_VALUE_1);
+  t_yarn_check_dep_load(f_seq.pid_1, &mem, YARN_T_VALUE_1);
+  yarn_epoch_set_done(f_seq.epoch_1);
+
+  struct t_sync_load load = { .mem = &mem, .value = 0 };
+  yarn_writev(&load.is_started, false);
+  yarn_writev(&load.is_done, false);
+
+  pthread_t thread;
+  fail_if (pthread_create(&thread, NULL, t_dep_seq_sync_loader, &load));
+
+  while (!yarn_readv(&load.is_started)) {
+    sched_yield();
+  }
+  usleep(10000);
+
+  // epoch_3 is still executing and didn't write the address yet.
+  fail_if (yarn_readv(&load.is_done), "load didn't wait on the older epoch");
+
+  t_yarn_check_dep_store(f_seq.pid_3, &mem, YARN_T_VALUE_4);
+  pthread_join(thread, NULL);
+
+  fail_if (load.value != YARN_T_VALUE_4, 
+	   "LOAD -> value="YARN_SHEX", expected="YARN_SHEX, 
+	   YARN_AHEX(load.value), YARN_AHEX(YARN_T_VALUE_4));
+  t_yarn_check_epoch_status(f_seq.epoch_4, yarn_epoch_executing);
+}
+END_TEST
+
+
 
 static struct {
   yarn_word_t i;
@@ -498,7 +681,12 @@ Suite* yarn_dep_suite (bool para_only) {
     tcase_add_test(tc_seq, t_dep_seq_load_store_fast);
     tcase_add_test(tc_seq, t_dep_seq_reset);
     tcase_add_test(tc_seq, t_dep_seq_commit);
+    tcase_add_test(tc_seq, t_dep_seq_commit_batch);
+    tcase_add_test(tc_seq, t_dep_seq_abort);
+    tcase_add_test(tc_seq, t_dep_seq_commit_large);
+    tcase_add_test(tc_seq, t_dep_seq_direct_head);
     tcase_add_test(tc_seq, t_dep_seq_rollback);
+    tcase_add_test(tc_seq, t_dep_seq_sync_load);
     suite_add_tcase(s, tc_seq);
   }
 
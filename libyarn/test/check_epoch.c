@@ -132,6 +132,171 @@ START_TEST(t_epoch_rollback_range) {
 }
 END_TEST
 
+START_TEST(t_epoch_rollback_selective) {
+  const yarn_word_t IT_COUNT = 4;
+  assert(g_epoch_max > IT_COUNT);
+
+  yarn_epoch_set_rollback_mode(yarn_epoch_rollback_selective);
+
+  for (yarn_word_t i = 0; i < IT_COUNT; ++i) {
+    enum yarn_epoch_status old_status;
+    yarn_word_t epoch;
+    yarn_epoch_next(&epoch, &old_status);
+    yarn_epoch_set_done(epoch);
+  }
+
+  // 3 read a value written by 1 and 2 is independent.
+  fail_if(!yarn_epoch_add_forward(3, 1));
+  yarn_epoch_do_rollback(1);
+
+  t_yarn_check_epoch_status(0, yarn_epoch_done);
+  t_yarn_check_epoch_status(1, yarn_epoch_rollback);
+  t_yarn_check_epoch_status(2, yarn_epoch_done);
+  t_yarn_check_epoch_status(3, yarn_epoch_rollback);
+
+  // Reading from a rolled back epoch should be refused.
+  fail_if(yarn_epoch_add_forward(2, 1));
+
+  // The rolled back epochs are handed out first and in order.
+  const yarn_word_t expected[] = {1, 3, IT_COUNT};
+  const enum yarn_epoch_status expected_status[] = 
+    {yarn_epoch_rollback, yarn_epoch_rollback, yarn_epoch_commit};
+
+  for (yarn_word_t i = 0; i < 3; ++i) {
+    enum yarn_epoch_status old_status;
+    yarn_word_t epoch;
+    yarn_epoch_next(&epoch, &old_status);
+    
+    fail_if(epoch != expected[i], "epoch=%zu, expected=%zu", epoch, expected[i]);
+    t_yarn_check_status(old_status, expected_status[i]);
+    t_yarn_check_epoch_status(epoch, yarn_epoch_executing);
+
+    if (old_status == yarn_epoch_rollback) {
+      yarn_epoch_rollback_done(epoch);
+    }
+  }
+}
+END_TEST
+
+static void t_epoch_depth_run (yarn_word_t count, yarn_word_t rollbacks) {
+  for (yarn_word_t i = 0; i < count; ++i) {
+    enum yarn_epoch_status old_status;
+    yarn_word_t epoch;
+    yarn_epoch_next(&epoch, &old_status);
+    yarn_epoch_set_done(epoch);
+
+    for (yarn_word_t r = 0; r < rollbacks; ++r) {
+      yarn_epoch_do_rollback(epoch);
+
+      yarn_word_t rollback_epoch;
+      yarn_epoch_next(&rollback_epoch, &old_status);
+      fail_if(rollback_epoch != epoch, "epoch=%zu, expected=%zu", rollback_epoch, epoch);
+      t_yarn_check_status(old_status, yarn_epoch_rollback);
+      yarn_epoch_rollback_done(epoch);
+      yarn_epoch_set_done(epoch);
+    }
+
+    yarn_word_t to_commit;
+    void* task;
+    fail_if(!yarn_epoch_get_next_commit(&to_commit, &task));
+    fail_if(to_commit != epoch, "to_commit=%zu, expected=%zu", to_commit, epoch);
+    yarn_epoch_commit_done(to_commit);
+  }
+}
+
+START_TEST(t_epoch_depth) {
+  yarn_epoch_set_adaptive_depth(true);
+  yarn_epoch_reset();
+  fail_if(yarn_epoch_depth() != g_epoch_max);
+
+  // Every epoch is rolled back once.
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW, 1);
+  fail_if(yarn_epoch_depth() != g_epoch_max/2, 
+	  "depth=%zu, expected=%zu", yarn_epoch_depth(), g_epoch_max/2);
+
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW, 1);
+  fail_if(yarn_epoch_depth() != g_epoch_max/4, 
+	  "depth=%zu, expected=%zu", yarn_epoch_depth(), g_epoch_max/4);
+
+  // No rollbacks.
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW, 0);
+  fail_if(yarn_epoch_depth() != g_epoch_max/2, 
+	  "depth=%zu, expected=%zu", yarn_epoch_depth(), g_epoch_max/2);
+
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW*2, 0);
+  fail_if(yarn_epoch_depth() != g_epoch_max, 
+	  "depth=%zu, expected=%zu", yarn_epoch_depth(), g_epoch_max);
+}
+END_TEST
+
+/*
+Commits count epochs in batches where a single violation squashes every epoch of the 
+batch.
+ */
+static void t_epoch_wide_rollback_run (yarn_word_t count) {
+  const yarn_word_t batch = g_epoch_max < count ? g_epoch_max : count;
+  enum yarn_epoch_status old_status;
+
+  for (yarn_word_t i = 0; i < count; i += batch) {
+    yarn_word_t first;
+    yarn_epoch_next(&first, &old_status);
+    yarn_epoch_set_done(first);
+    for (yarn_word_t j = 1; j < batch; ++j) {
+      yarn_word_t epoch;
+      yarn_epoch_next(&epoch, &old_status);
+      yarn_epoch_set_done(epoch);
+    }
+
+    yarn_epoch_do_rollback(first);
+
+    for (yarn_word_t j = 0; j < batch; ++j) {
+      yarn_word_t epoch;
+      yarn_epoch_next(&epoch, &old_status);
+      fail_if(epoch != first + j, "epoch=%zu, expected=%zu", epoch, first + j);
+      t_yarn_check_status(old_status, yarn_epoch_rollback);
+      yarn_epoch_rollback_done(epoch);
+      yarn_epoch_set_done(epoch);
+
+      yarn_word_t to_commit;
+      void* task;
+      fail_if(!yarn_epoch_get_next_commit(&to_commit, &task));
+      fail_if(to_commit != epoch, "to_commit=%zu, expected=%zu", to_commit, epoch);
+      yarn_epoch_commit_done(to_commit);
+    }
+  }
+}
+
+START_TEST(t_epoch_watchdog) {
+  yarn_epoch_set_watchdog(true);
+  yarn_epoch_reset();
+
+  // Not bad enough to be considered a storm.
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW/2, 1);
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW/2, 0);
+  fail_if(yarn_epoch_depth() != g_epoch_max, "depth=%zu", yarn_epoch_depth());
+
+  // A violation that squashes a lot of epochs still only counts once.
+  t_epoch_wide_rollback_run(YARN_EPOCH_DEPTH_WINDOW);
+  fail_if(yarn_epoch_depth() != g_epoch_max, "depth=%zu", yarn_epoch_depth());
+
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW, YARN_EPOCH_STORM_RATIO);
+  fail_if(yarn_epoch_depth() != 1, "depth=%zu", yarn_epoch_depth());
+
+  t_epoch_depth_run(YARN_EPOCH_SERIAL_MIN-1, 0);
+  fail_if(yarn_epoch_depth() != 1, "depth=%zu", yarn_epoch_depth());
+  t_epoch_depth_run(1, 0);
+  fail_if(yarn_epoch_depth() != g_epoch_max, "depth=%zu", yarn_epoch_depth());
+
+  // A consecutive storm doubles the length of the sequential execution.
+  t_epoch_depth_run(YARN_EPOCH_DEPTH_WINDOW, YARN_EPOCH_STORM_RATIO);
+  t_epoch_depth_run(YARN_EPOCH_SERIAL_MIN, 0);
+  fail_if(yarn_epoch_depth() != 1, "depth=%zu", yarn_epoch_depth());
+  t_epoch_depth_run(YARN_EPOCH_SERIAL_MIN, 0);
+  fail_if(yarn_epoch_depth() != g_epoch_max, "depth=%zu", yarn_epoch_depth());
+}
+END_TEST
+
+
 START_TEST(t_epoch_commit) {
   const int IT_COUNT = g_epoch_max / 2;
   void* VALUE = (void*) YARN_T_VALUE_1;
@@ -195,6 +360,48 @@ START_TEST(t_epoch_commit) {
 }
 END_TEST
 
+START_TEST(t_epoch_commit_batch) {
+  const yarn_word_t IT_COUNT = 4;
+  assert(g_epoch_max > IT_COUNT);
+  void* VALUE = (void*) YARN_T_VALUE_1;
+
+  yarn_word_t epochs[IT_COUNT];
+  for (yarn_word_t i = 0; i < IT_COUNT; ++i) {
+    enum yarn_epoch_status old_status;
+    yarn_epoch_next(&epochs[i], &old_status);
+    t_yarn_set_epoch_data(epochs[i], VALUE);
+  }
+
+  yarn_epoch_set_done(epochs[0]);
+  yarn_epoch_set_done(epochs[1]);
+  yarn_epoch_set_done(epochs[3]);
+
+  yarn_word_t first;
+  yarn_word_t count;
+
+  // The run stops at the first epoch that isn't done.
+  fail_if(!yarn_epoch_get_commit_batch(&first, &count, IT_COUNT));
+  fail_if(first != epochs[0], "first=%zu, expected=%zu", first, epochs[0]);
+  fail_if(count != 2, "count=%zu, expected=2", count);
+  t_yarn_check_epoch_data(first, VALUE);
+  t_yarn_check_epoch_data(first+1, VALUE);
+
+  fail_if(yarn_epoch_get_commit_batch(&first, &count, IT_COUNT));
+  yarn_epoch_commit_done(epochs[0]);
+  yarn_epoch_commit_done(epochs[1]);
+
+  // The run is also bounded by max_count.
+  yarn_epoch_set_done(epochs[2]);
+  fail_if(!yarn_epoch_get_commit_batch(&first, &count, 1));
+  fail_if(first != epochs[2] || count != 1, "first=%zu, count=%zu", first, count);
+  yarn_epoch_commit_done(epochs[2]);
+
+  fail_if(!yarn_epoch_get_commit_batch(&first, &count, IT_COUNT));
+  fail_if(first != epochs[3] || count != 1, "first=%zu, count=%zu", first, count);
+  yarn_epoch_commit_done(epochs[3]);
+}
+END_TEST
+
 START_TEST(t_epoch_stop_basic) {
   enum yarn_epoch_status status;
   yarn_word_t epoch;
@@ -400,7 +607,11 @@ Suite* yarn_epoch_suite (bool para_only) {
     tcase_add_test(tc_basic, t_epoch_rollback_executing);
     tcase_add_test(tc_basic, t_epoch_rollback_done);
     tcase_add_test(tc_basic, t_epoch_rollback_range);
+    tcase_add_test(tc_basic, t_epoch_rollback_selective);
+    tcase_add_test(tc_basic, t_epoch_depth);
+    tcase_add_test(tc_basic, t_epoch_watchdog);
     tcase_add_test(tc_basic, t_epoch_commit);
+    tcase_add_test(tc_basic, t_epoch_commit_batch);
     tcase_add_test(tc_basic, t_epoch_stop_basic);
     tcase_add_test(tc_basic, t_epoch_stop_rollback_before);
     tcase_add_test(tc_basic, t_epoch_stop_rollback_after);
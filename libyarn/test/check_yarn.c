@@ -12,9 +12,14 @@ The main yarn header for the target programs.
 
 #include <yarn.h>
 #include <epoch.h>
+#include <atomic.h>
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
 
 #define YARN_DBG 0
 #include "dbg.h"
@@ -90,6 +95,1115 @@ START_TEST (t_yarn_exec_simple) {
 END_TEST
 
 
+enum yarn_ret t_yarn_exec_channel_worker (const yarn_word_t pool_id, 
+					  void* data, 
+					  yarn_word_t indvar) 
+{
+  data_t* counter = (data_t*) data;
+        
+  if (indvar > counter->n) {
+    yarn_dep_store(pool_id, &indvar, &counter->i);
+    return yarn_ret_break;
+  }
+      
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_consume(pool_id, INDEX_ACC, &counter->acc, &acc));
+  acc += indvar;
+  CHECK_DEP(yarn_dep_produce(pool_id, INDEX_ACC, &acc, &counter->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_channel) {
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 100;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    bool ret = yarn_exec_simple(t_yarn_exec_channel_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+  }
+  
+}
+END_TEST
+
+
+#define T_PREDICT_STRIDE 3
+
+enum yarn_ret t_yarn_exec_predict_worker (const yarn_word_t pool_id, 
+					  void* data, 
+					  yarn_word_t indvar) 
+{
+  data_t* counter = (data_t*) data;
+        
+  if (indvar > counter->n) {
+    yarn_dep_store(pool_id, &indvar, &counter->i);
+    return yarn_ret_break;
+  }
+
+  // A regular stride with a single hiccup to exercise the mispredictions.
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &counter->acc, &acc));
+  acc += indvar == counter->n/2 ? 1 : T_PREDICT_STRIDE;
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_predict) {
+  struct yarn_policy policy = { .disable_prediction = false };
+
+  for (int i = 0; i < 10; ++i) {
+    policy.disable_prediction = i % 2;
+
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 1000;
+    counter.r = counter.n * T_PREDICT_STRIDE + 1;
+
+    bool ret = yarn_exec_policy(t_yarn_exec_predict_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1, &policy);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+  }
+  
+}
+END_TEST
+
+
+START_TEST (t_yarn_exec_selective) {
+  struct yarn_policy policy = { .selective_rollback = true };
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 100;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    bool ret = yarn_exec_policy(t_yarn_exec_simple_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1, &policy);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+  }
+  
+}
+END_TEST
+
+
+START_TEST (t_yarn_exec_lazy) {
+  struct yarn_policy policy = { .lazy_detection = true };
+
+  for (int i = 0; i < 10; ++i) {
+    // Conflicts are caught on commit whatever the rollback mode.
+    policy.selective_rollback = i % 2;
+
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 100;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    bool ret = yarn_exec_policy(t_yarn_exec_simple_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1, &policy);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+  }
+  
+}
+END_TEST
+
+
+#define T_CHECKPOINT_N 200
+#define T_CHECKPOINT_POLLS 10
+
+typedef struct {
+  yarn_word_t i;
+  yarn_word_t acc;
+  yarn_word_t n;
+  yarn_word_t r;
+  yarn_word_t squares[T_CHECKPOINT_N+1];
+} checkpoint_t;
+
+enum yarn_ret t_yarn_exec_checkpoint_worker (const yarn_word_t pool_id, 
+					     void* data, 
+					     yarn_word_t indvar) 
+{
+  checkpoint_t* d = (checkpoint_t*) data;
+        
+  if (indvar > d->n) {
+    yarn_dep_store(pool_id, &indvar, &d->i);
+    return yarn_ret_break;
+  }
+
+  // Independent work that isn't redone when the accumulator conflicts.
+  yarn_word_t square = indvar * indvar;
+  CHECK_DEP(yarn_dep_store(pool_id, &square, &d->squares[indvar]));
+
+  YARN_DEP_CHECKPOINT(pool_id);
+
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &d->acc, &acc));
+
+  // Gives the rollbacks a chance to land before the epoch is done.
+  for (int j = 0; j < T_CHECKPOINT_POLLS && !yarn_dep_is_aborted(pool_id); ++j) {
+    sched_yield();
+  }
+
+  acc += indvar;
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &d->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_checkpoint) {
+  struct yarn_policy policy = { .selective_rollback = false };
+
+  for (int i = 0; i < 10; ++i) {
+    policy.selective_rollback = i % 2;
+
+    checkpoint_t d;
+    memset(&d, 0, sizeof(d));
+    d.n = T_CHECKPOINT_N;
+    d.r = (d.n*(d.n+1))/2;  
+
+    bool ret = yarn_exec_policy(t_yarn_exec_checkpoint_worker, &d, 
+				YARN_ALL_THREADS, d.n+2, 1, &policy);
+
+    fail_if (!ret);
+    fail_if (d.acc != d.r, "answer=%zu, expected=%zu (i=%d)", d.acc, d.r, i);
+    fail_if (d.i != d.n+1, "i=%zu, expected=%zu", d.i, d.n+1);
+    for (yarn_word_t j = 0; j <= d.n; ++j) {
+      fail_if (d.squares[j] != j*j, "squares[%zu]=%zu (i=%d)", j, d.squares[j], i);
+    }
+  }
+  
+}
+END_TEST
+
+
+// Commutative updates of a few shared bins.
+#define T_BIN_COUNT 4
+
+typedef struct {
+  yarn_word_t bins[T_BIN_COUNT];
+  yarn_word_t n;
+} bins_t;
+
+enum yarn_ret t_yarn_exec_bins_worker (const yarn_word_t pool_id, 
+				       void* data, 
+				       yarn_word_t indvar) 
+{
+  bins_t* bins = (bins_t*) data;
+        
+  if (indvar >= bins->n) {
+    return yarn_ret_break;
+  }
+
+  yarn_word_t* bin = &bins->bins[indvar % T_BIN_COUNT];
+      
+  yarn_word_t value;
+  CHECK_DEP(yarn_dep_load(pool_id, bin, &value));
+  value += indvar;
+  CHECK_DEP(yarn_dep_store(pool_id, &value, bin));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_unordered) {
+  struct yarn_policy policy = { .unordered = true };
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 100;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    bool ret = yarn_exec_policy(t_yarn_exec_simple_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1, &policy);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+
+    bins_t bins = { .n = 200 };
+    ret = yarn_exec_policy(t_yarn_exec_bins_worker, &bins, 
+			   YARN_ALL_THREADS, T_BIN_COUNT, 1, &policy);
+    fail_if (!ret);
+
+    for (yarn_word_t bin = 0; bin < T_BIN_COUNT; ++bin) {
+      yarn_word_t expected = 0;
+      for (yarn_word_t k = bin; k < bins.n; k += T_BIN_COUNT) {
+	expected += k;
+      }
+      fail_if (bins.bins[bin] != expected,
+	       "bin=%zu, answer=%zu, expected=%zu (i=%d)", 
+	       bin, bins.bins[bin], expected, i);
+    }
+  }
+  
+}
+END_TEST
+
+
+#define T_CALL_SIZE 64
+
+typedef struct {
+  yarn_word_t values[T_CALL_SIZE];
+  yarn_word_t sum;
+} call_t;
+
+enum yarn_ret t_yarn_exec_callee (const yarn_word_t pool_id, void* data) {
+  call_t* call = (call_t*) data;
+
+  for (yarn_word_t i = 0; i < T_CALL_SIZE; ++i) {
+    yarn_word_t value = i * 3;
+    CHECK_DEP(yarn_dep_store(pool_id, &value, &call->values[i]));
+  }
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+enum yarn_ret t_yarn_exec_continuation (const yarn_word_t pool_id, void* data) {
+  call_t* call = (call_t*) data;
+
+  yarn_word_t sum = 0;
+  for (yarn_word_t i = 0; i < T_CALL_SIZE; ++i) {
+    yarn_word_t value;
+    CHECK_DEP(yarn_dep_load(pool_id, &call->values[i], &value));
+    sum += value;
+  }
+  CHECK_DEP(yarn_dep_store(pool_id, &sum, &call->sum));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+static bool t_yarn_call_nested_early;
+
+enum yarn_ret t_yarn_exec_call_nested (const yarn_word_t pool_id, void* data) {
+  (void) pool_id;
+
+  bool ret = yarn_exec_call(t_yarn_exec_callee, t_yarn_exec_continuation, data,
+			    T_CALL_SIZE+1, 1);
+  t_yarn_call_nested_early = !ret && !yarn_exec_has_started();
+  return yarn_ret_continue;
+}
+
+START_TEST (t_yarn_exec_call) {
+  const yarn_word_t expected = 3 * (T_CALL_SIZE * (T_CALL_SIZE-1)) / 2;
+
+  for (int i = 0; i < 10; ++i) {
+    call_t call = { .sum = 0 };
+
+    bool ret = yarn_exec_call(t_yarn_exec_callee, t_yarn_exec_continuation, &call,
+			      T_CALL_SIZE+1, 1);
+    fail_if (!ret);
+    fail_if (call.sum != expected, 
+	     "answer=%zu, expected=%zu (i=%d)", call.sum, expected, i);
+  }
+
+  // A nested call fails before executing anything so it can fall back on a plain call.
+  {
+    call_t call = { .sum = 0 };
+
+    t_yarn_call_nested_early = false;
+    fail_if (!yarn_exec_call(t_yarn_exec_callee, t_yarn_exec_call_nested, &call, 
+			     T_CALL_SIZE+1, 1));
+    fail_if (!t_yarn_call_nested_early);
+  }
+}
+END_TEST
+
+
+#define T_LIST_SIZE 200
+
+struct t_node {
+  yarn_word_t value;
+  struct t_node* next;
+};
+
+/*
+Unlinks the node that follows every multiple of 3 which makes the walk mispredict the 
+next node of those epochs.
+ */
+enum yarn_ret t_yarn_exec_list_worker (const yarn_word_t pool_id, 
+				       void* data, 
+				       void* node) 
+{
+  yarn_word_t* acc_ptr = (yarn_word_t*) data;
+  struct t_node* cur = (struct t_node*) node;
+
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load(pool_id, acc_ptr, &acc));
+  acc += cur->value;
+  CHECK_DEP(yarn_dep_store(pool_id, &acc, acc_ptr));
+
+  if (cur->value % 3 != 0) {
+    return yarn_ret_continue;
+  }
+
+  struct t_node* next;
+  CHECK_DEP(yarn_dep_load(pool_id, &cur->next, &next));
+  if (next) {
+    struct t_node* next_next;
+    CHECK_DEP(yarn_dep_load(pool_id, &next->next, &next_next));
+    CHECK_DEP(yarn_dep_store(pool_id, &next_next, &cur->next));
+  }
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_list) {
+  yarn_word_t expected_acc = 0;
+  yarn_word_t expected_len = 0;
+  for (yarn_word_t i = 0; i < T_LIST_SIZE; ++i) {
+    expected_acc += i;
+    expected_len++;
+    if (i % 3 == 0 && i+1 < T_LIST_SIZE) {
+      i++;
+    }
+  }
+
+  struct t_node nodes[T_LIST_SIZE];
+
+  for (int i = 0; i < 10; ++i) {
+    for (yarn_word_t j = 0; j < T_LIST_SIZE; ++j) {
+      nodes[j].value = j;
+      nodes[j].next = j+1 < T_LIST_SIZE ? &nodes[j+1] : NULL;
+    }
+
+    yarn_word_t acc = 0;
+    bool ret = yarn_exec_list(t_yarn_exec_list_worker, &acc, &nodes[0], 
+			      offsetof(struct t_node, next),
+			      YARN_ALL_THREADS, T_LIST_SIZE, 1, NULL);
+    fail_if (!ret);
+    fail_if (acc != expected_acc, 
+	     "answer=%zu, expected=%zu (i=%d)", acc, expected_acc, i);
+
+    yarn_word_t len = 0;
+    for (struct t_node* node = &nodes[0]; node; node = node->next) {
+      len++;
+    }
+    fail_if (len != expected_len, "len=%zu, expected=%zu (i=%d)", len, expected_len, i);
+  }
+}
+END_TEST
+
+
+#define T_WAVE_SIZE 200
+#define T_WAVE_DISTANCE 3
+
+typedef struct {
+  yarn_word_t values[T_WAVE_SIZE];
+} wave_t;
+
+// Iteration i reads what iteration i - T_WAVE_DISTANCE wrote.
+enum yarn_ret t_yarn_exec_wave_worker (const yarn_word_t pool_id, 
+				       void* data, 
+				       yarn_word_t indvar) 
+{
+  wave_t* wave = (wave_t*) data;
+        
+  if (indvar >= T_WAVE_SIZE) {
+    return yarn_ret_break;
+  }
+  if (indvar < T_WAVE_DISTANCE) {
+    return yarn_ret_continue;
+  }
+
+  yarn_word_t value;
+  CHECK_DEP(yarn_dep_load(pool_id, &wave->values[indvar - T_WAVE_DISTANCE], &value));
+  value += indvar;
+  CHECK_DEP(yarn_dep_store(pool_id, &value, &wave->values[indvar]));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_distance) {
+  yarn_word_t expected[T_WAVE_SIZE];
+  for (yarn_word_t i = 0; i < T_WAVE_SIZE; ++i) {
+    expected[i] = i < T_WAVE_DISTANCE ? 0 : expected[i - T_WAVE_DISTANCE] + i;
+  }
+
+  // A wrong distance must still give the right answer.
+  const yarn_word_t distances[] = { T_WAVE_DISTANCE, 1, T_WAVE_DISTANCE+2 };
+
+  for (size_t k = 0; k < sizeof(distances) / sizeof(distances[0]); ++k) {
+    struct yarn_policy policy = { .dep_distance = distances[k] };
+
+    for (int i = 0; i < 10; ++i) {
+      wave_t wave = { .values = { 0 } };
+
+      bool ret = yarn_exec_policy(t_yarn_exec_wave_worker, &wave, 
+				  YARN_ALL_THREADS, T_WAVE_SIZE, 1, &policy);
+      fail_if (!ret);
+
+      for (yarn_word_t j = 0; j < T_WAVE_SIZE; ++j) {
+	fail_if (wave.values[j] != expected[j],
+		 "values[%zu]=%zu, expected=%zu (distance=%zu, i=%d)", 
+		 j, wave.values[j], expected[j], distances[k], i);
+      }
+    }
+  }
+}
+END_TEST
+
+
+#define T_INSPECT_SIZE 500
+#define T_INSPECT_VALUES 64
+
+typedef struct {
+  yarn_word_t dst[T_INSPECT_SIZE];
+  yarn_word_t src[T_INSPECT_SIZE];
+  yarn_word_t values[T_INSPECT_VALUES];
+} inspect_t;
+
+// The update isn't commutative so the iterations that conflict must stay in order.
+enum yarn_ret t_yarn_exec_inspect_worker (const yarn_word_t pool_id, 
+					  void* data, 
+					  yarn_word_t indvar) 
+{
+  (void) pool_id;
+  inspect_t* t = (inspect_t*) data;
+  yarn_word_t* dst = &t->values[t->dst[indvar]];
+  *dst = *dst * 3 + t->values[t->src[indvar]] + indvar;
+  return yarn_ret_continue;
+}
+
+// Counts the iterations inspected to tell whether the cached waves were used.
+static yarn_atomic_var g_inspect_calls;
+
+void t_yarn_exec_inspector (const yarn_word_t pool_id, void* data, yarn_word_t indvar) {
+  inspect_t* t = (inspect_t*) data;
+  yarn_incv(&g_inspect_calls);
+  yarn_inspect_read(pool_id, &t->values[t->src[indvar]]);
+  yarn_inspect_read(pool_id, &t->values[t->dst[indvar]]);
+  yarn_inspect_write(pool_id, &t->values[t->dst[indvar]]);
+}
+
+START_TEST (t_yarn_exec_inspect) {
+  static inspect_t t;
+  yarn_word_t expected[T_INSPECT_VALUES];
+
+  // The second run of each seed reuses the waves of the first one.
+  for (int i = 0; i < 20; ++i) {
+    const yarn_word_t seed = i / 2 + 1;
+    for (yarn_word_t j = 0; j < T_INSPECT_SIZE; ++j) {
+      t.dst[j] = (j * seed * 7 + seed) % T_INSPECT_VALUES;
+      t.src[j] = (j * seed * 13 + 5) % T_INSPECT_VALUES;
+    }
+
+    for (yarn_word_t j = 0; j < T_INSPECT_VALUES; ++j) {
+      t.values[j] = expected[j] = j;
+    }
+    for (yarn_word_t j = 0; j < T_INSPECT_SIZE; ++j) {
+      expected[t.dst[j]] = expected[t.dst[j]] * 3 + expected[t.src[j]] + j;
+    }
+
+    yarn_writev(&g_inspect_calls, 0);
+    bool ret = yarn_exec_inspect(t_yarn_exec_inspect_worker, t_yarn_exec_inspector, &t, 
+				 T_INSPECT_SIZE, YARN_ALL_THREADS, 
+				 &t, offsetof(inspect_t, values));
+    fail_if (!ret);
+
+    const yarn_word_t calls = yarn_readv(&g_inspect_calls);
+    const yarn_word_t expected_calls = i % 2 ? 0 : T_INSPECT_SIZE;
+    fail_if (calls != expected_calls, 
+	     "calls=%zu, expected=%zu (i=%d)", calls, expected_calls, i);
+
+    for (yarn_word_t j = 0; j < T_INSPECT_VALUES; ++j) {
+      fail_if (t.values[j] != expected[j],
+	       "values[%zu]=%zu, expected=%zu (i=%d)", j, t.values[j], expected[j], i);
+    }
+  }
+
+  // Same key but the loop works on another array so the waves can't be reused.
+  {
+    static inspect_t other;
+    memcpy(&other, &t, sizeof(inspect_t));
+
+    yarn_writev(&g_inspect_calls, 0);
+    bool ret = yarn_exec_inspect(t_yarn_exec_inspect_worker, t_yarn_exec_inspector, 
+				 &other, T_INSPECT_SIZE, YARN_ALL_THREADS, 
+				 &t, offsetof(inspect_t, values));
+    fail_if (!ret);
+    fail_if (yarn_readv(&g_inspect_calls) != T_INSPECT_SIZE);
+  }
+}
+END_TEST
+
+
+START_TEST (t_yarn_exec_adaptive_depth) {
+  struct yarn_policy policy = { .adaptive_depth = true };
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 1000;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    bool ret = yarn_exec_policy(t_yarn_exec_simple_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1, &policy);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+  }
+}
+END_TEST
+
+
+#define T_SYNC_SIZE 200
+
+typedef struct {
+  yarn_word_t acc;
+} sync_t;
+
+/*
+Every iteration reads the value written by the one before it and gives up its processor
+before writing its own so the younger epochs keep reading stale values and the address
+quickly gets hot enough for the loads to wait on the older epochs.
+ */
+enum yarn_ret t_yarn_exec_sync_worker (const yarn_word_t pool_id, 
+				       void* data, 
+				       yarn_word_t indvar) 
+{
+  sync_t* sync = (sync_t*) data;
+  if (indvar >= T_SYNC_SIZE) {
+    return yarn_ret_break;
+  }
+
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load(pool_id, &sync->acc, &acc));
+
+  sched_yield();
+  acc = acc * 3 + indvar;
+
+  CHECK_DEP(yarn_dep_store(pool_id, &acc, &sync->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_sync) {
+  struct yarn_policy policy = { .disable_watchdog = true };
+
+  yarn_word_t expected = 0;
+  for (yarn_word_t i = 0; i < T_SYNC_SIZE; ++i) {
+    expected = expected * 3 + i;
+  }
+
+  for (int i = 0; i < 10; ++i) {
+    sync_t sync = { .acc = 0 };
+
+    bool ret = yarn_exec_policy(t_yarn_exec_sync_worker, &sync, 
+				YARN_ALL_THREADS, 2, 1, &policy);
+    fail_if (!ret);
+    fail_if (sync.acc != expected, 
+	     "answer=%zu, expected=%zu (i=%d)", sync.acc, expected, i);
+  }
+}
+END_TEST
+
+
+// Counts the epochs that were executed past the end of the loop.
+static yarn_atomic_var g_trip_overshoot;
+
+enum yarn_ret t_yarn_exec_trip_worker (const yarn_word_t pool_id, 
+				       void* data, 
+				       yarn_word_t indvar) 
+{
+  data_t* counter = (data_t*) data;
+  if (indvar > counter->n+1) {
+    yarn_incv(&g_trip_overshoot);
+  }
+  return t_yarn_exec_simple_worker(pool_id, data, indvar);
+}
+
+START_TEST (t_yarn_exec_trip_count) {
+  struct yarn_policy hint_policy = { .trip_count = 101 };
+  struct yarn_policy learn_policy = { .trip_count = 0 };
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 100;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    // The first iteration has to learn the trip count.
+    yarn_writev(&g_trip_overshoot, 0);
+    bool ret = yarn_exec_policy(t_yarn_exec_trip_worker, &counter, YARN_ALL_THREADS, 
+				2, 1, i % 2 ? &hint_policy : &learn_policy);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+    fail_if (i > 0 && yarn_readv(&g_trip_overshoot) != 0, 
+	     "overshoot=%zu (i=%d)", yarn_readv(&g_trip_overshoot), i);
+  }
+}
+END_TEST
+
+
+// Adds the result of the previous loop on every iteration.
+struct t_loop_chain {
+  data_t* prev;
+  data_t* cur;
+};
+
+enum yarn_ret t_yarn_exec_chain_worker (const yarn_word_t pool_id, 
+					void* data, 
+					yarn_word_t indvar) 
+{
+  struct t_loop_chain* chain = (struct t_loop_chain*) data;
+        
+  if (indvar > chain->cur->n) {
+    yarn_dep_store(pool_id, &indvar, &chain->cur->i);
+    return yarn_ret_break;
+  }
+      
+  yarn_word_t prev;
+  CHECK_DEP(yarn_dep_load(pool_id, &chain->prev->acc, &prev));
+
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load(pool_id, &chain->cur->acc, &acc));
+  acc += prev;
+  CHECK_DEP(yarn_dep_store(pool_id, &acc, &chain->cur->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_loops) {
+  struct yarn_policy policies[] = { { .selective_rollback = false }, 
+				    { .selective_rollback = true } };
+
+  for (int i = 0; i < 10; ++i) {
+    data_t first = { .i = 0, .acc = 0, .n = 100 };
+    data_t second = { .i = 0, .acc = 0, .n = 20 };
+    data_t third = { .i = 0, .acc = 0, .n = 50 };
+
+    struct t_loop_chain chain_2 = { .prev = &first, .cur = &second };
+    struct t_loop_chain chain_3 = { .prev = &second, .cur = &third };
+
+    const struct yarn_loop loops[] = {
+      { .executor = t_yarn_exec_simple_worker, .data = &first },
+      { .executor = t_yarn_exec_chain_worker, .data = &chain_2 },
+      { .executor = t_yarn_exec_chain_worker, .data = &chain_3 }
+    };
+
+    bool ret = yarn_exec_loops(loops, 3, YARN_ALL_THREADS, 10, 1, &policies[i % 2]);
+    fail_if (!ret);
+
+    const yarn_word_t r_1 = (first.n*(first.n+1))/2;
+    const yarn_word_t r_2 = (second.n+1) * r_1;
+    const yarn_word_t r_3 = (third.n+1) * r_2;
+
+    fail_if (first.acc != r_1, "first=%zu, expected=%zu (i=%d)", first.acc, r_1, i);
+    fail_if (second.acc != r_2, "second=%zu, expected=%zu (i=%d)", second.acc, r_2, i);
+    fail_if (third.acc != r_3, "third=%zu, expected=%zu (i=%d)", third.acc, r_3, i);
+    fail_if (first.i != first.n+1 || second.i != second.n+1 || third.i != third.n+1,
+	     "i=(%zu, %zu, %zu)", first.i, second.i, third.i);
+  }
+}
+END_TEST
+
+
+// Burns some cycles between the load and the store to give the rollbacks time to happen.
+enum yarn_ret t_yarn_exec_abort_worker (const yarn_word_t pool_id, 
+					void* data, 
+					yarn_word_t indvar) 
+{
+  data_t* counter = (data_t*) data;
+        
+  if (indvar > counter->n) {
+    yarn_dep_store(pool_id, &indvar, &counter->i);
+    return yarn_ret_break;
+  }
+      
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &counter->acc, &acc));
+
+  for (volatile int i = 0; i < 10000; ++i) {
+    if (i % 100 == 0 && yarn_dep_is_aborted(pool_id)) {
+      return yarn_ret_abort;
+    }
+  }
+
+  acc += indvar;
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_abort) {
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+    counter.n = 100;
+    counter.r = (counter.n*(counter.n+1))/2;  
+
+    bool ret = yarn_exec_simple(t_yarn_exec_abort_worker, &counter, 
+				YARN_ALL_THREADS, 2, 1);
+
+    fail_if (!ret);
+    fail_if (counter.acc != counter.r, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, counter.r, i);
+    fail_if (counter.i != counter.n+1,
+	     "i=%zu, expected=%zu", counter.i, counter.n+1);
+  }
+}
+END_TEST
+
+
+static yarn_word_t t_yarn_nest_inner_count (void* data, yarn_word_t outer) {
+  (void) data;
+  // Includes a few empty inner loops.
+  return outer % 5;
+}
+
+static yarn_word_t t_yarn_nest_value (yarn_word_t outer, yarn_word_t inner) {
+  return outer * 100 + inner;
+}
+
+enum yarn_ret t_yarn_exec_nest_worker (const yarn_word_t pool_id, 
+				       void* data, 
+				       yarn_word_t outer,
+				       yarn_word_t inner) 
+{
+  data_t* counter = (data_t*) data;
+
+  if (inner >= t_yarn_nest_inner_count(data, outer)) {
+    return yarn_ret_error;
+  }
+
+  // Also checks that the iterations are ordered since the accumulator isn't commutative.
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &counter->acc, &acc));
+  acc = acc * 3 + t_yarn_nest_value(outer, inner);
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+
+  yarn_word_t i;
+  CHECK_DEP(yarn_dep_load(pool_id, &counter->i, &i));
+  i++;
+  CHECK_DEP(yarn_dep_store(pool_id, &i, &counter->i));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_nest) {
+  const yarn_word_t outer_count = 30;
+
+  yarn_word_t expected_acc = 0;
+  yarn_word_t expected_i = 0;
+  for (yarn_word_t outer = 0; outer < outer_count; ++outer) {
+    for (yarn_word_t inner = 0; inner < t_yarn_nest_inner_count(NULL, outer); ++inner) {
+      expected_acc = expected_acc * 3 + t_yarn_nest_value(outer, inner);
+      expected_i++;
+    }
+  }
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+
+    bool ret = yarn_exec_nest(t_yarn_exec_nest_worker, t_yarn_nest_inner_count, 
+			      &counter, outer_count, YARN_ALL_THREADS, 2, 1, NULL);
+
+    fail_if (!ret);
+    fail_if (counter.acc != expected_acc, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, expected_acc, i);
+    fail_if (counter.i != expected_i, "i=%zu, expected=%zu", counter.i, expected_i);
+  }
+}
+END_TEST
+
+
+// Only outer iterations 3 and 7 have inner iterations.
+static yarn_word_t t_yarn_nest_sparse_count (void* data, yarn_word_t outer) {
+  (void) data;
+  return outer == 3 ? 4 : outer == 7 ? 1 : 0;
+}
+
+static yarn_word_t t_yarn_nest_empty_count (void* data, yarn_word_t outer) {
+  (void) data;
+  (void) outer;
+  return 0;
+}
+
+enum yarn_ret t_yarn_exec_nest_sparse_worker (const yarn_word_t pool_id, 
+					      void* data, 
+					      yarn_word_t outer,
+					      yarn_word_t inner) 
+{
+  data_t* counter = (data_t*) data;
+
+  if (inner >= t_yarn_nest_sparse_count(data, outer)) {
+    return yarn_ret_error;
+  }
+
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &counter->acc, &acc));
+  acc = acc * 3 + t_yarn_nest_value(outer, inner);
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_nest_empty) {
+  const yarn_word_t outer_count = 10;
+
+  yarn_word_t expected_acc = 0;
+  for (yarn_word_t outer = 0; outer < outer_count; ++outer) {
+    for (yarn_word_t inner = 0; inner < t_yarn_nest_sparse_count(NULL, outer); ++inner) {
+      expected_acc = expected_acc * 3 + t_yarn_nest_value(outer, inner);
+    }
+  }
+
+  for (int i = 0; i < 10; ++i) {
+    data_t counter = { .acc = 0 };
+
+    // Empty outer iterations are skipped, including the leading and trailing ones.
+    bool ret = yarn_exec_nest(t_yarn_exec_nest_sparse_worker, t_yarn_nest_sparse_count, 
+			      &counter, outer_count, YARN_ALL_THREADS, 2, 1, NULL);
+    fail_if (!ret);
+    fail_if (counter.acc != expected_acc, 
+	     "answer=%zu, expected=%zu (i=%d)", counter.acc, expected_acc, i);
+
+    // A nest without any inner iterations doesn't execute anything.
+    counter.acc = 0;
+    ret = yarn_exec_nest(t_yarn_exec_nest_sparse_worker, t_yarn_nest_empty_count, 
+			 &counter, outer_count, YARN_ALL_THREADS, 2, 1, NULL);
+    fail_if (!ret);
+    fail_if (counter.acc != 0, "answer=%zu, expected=0 (i=%d)", counter.acc, i);
+  }
+}
+END_TEST
+
+
+#define T_TASK_COUNT 500
+
+struct t_task_producer {
+  struct yarn_task_queue* queue;
+  yarn_word_t values[T_TASK_COUNT];
+};
+
+static void* t_yarn_task_producer (void* data) {
+  struct t_task_producer* producer = (struct t_task_producer*) data;
+
+  for (yarn_word_t i = 0; i < T_TASK_COUNT; ++i) {
+    producer->values[i] = i+1;
+    if (!yarn_task_submit(producer->queue, &producer->values[i])) {
+      break;
+    }
+  }
+  yarn_task_close(producer->queue);
+
+  return NULL;
+}
+
+enum yarn_ret t_yarn_exec_tasks_worker (const yarn_word_t pool_id, 
+					void* data, 
+					void* task) 
+{
+  data_t* counter = (data_t*) data;
+  const yarn_word_t value = *((yarn_word_t*) task);
+
+  // Not commutative so this also checks the ordering of the tasks.
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &counter->acc, &acc));
+  acc = acc * 3 + value;
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+
+  yarn_word_t i;
+  CHECK_DEP(yarn_dep_load(pool_id, &counter->i, &i));
+  i++;
+  CHECK_DEP(yarn_dep_store(pool_id, &i, &counter->i));
+
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_tasks) {
+  yarn_word_t expected_acc = 0;
+  for (yarn_word_t i = 0; i < T_TASK_COUNT; ++i) {
+    expected_acc = expected_acc * 3 + (i+1);
+  }
+
+  // Small enough for the producer to be blocked.
+  const yarn_word_t capacities[] = { 1, 4, 64 };
+
+  for (size_t k = 0; k < sizeof(capacities) / sizeof(capacities[0]); ++k) {
+    struct t_task_producer producer;
+    producer.queue = yarn_task_queue_init(capacities[k]);
+    fail_if (!producer.queue);
+
+    // NULL is reserved for the end of the queue.
+    fail_if (yarn_task_submit(producer.queue, NULL));
+
+    pthread_t thread;
+    fail_if (pthread_create(&thread, NULL, t_yarn_task_producer, &producer));
+
+    data_t counter;
+    counter.i = 0;
+    counter.acc = 0;
+
+    bool ret = yarn_exec_tasks(t_yarn_exec_tasks_worker, &counter, producer.queue,
+			       YARN_ALL_THREADS, 2, 1, NULL);
+
+    pthread_join(thread, NULL);
+    yarn_task_queue_destroy(producer.queue);
+
+    fail_if (!ret);
+    fail_if (counter.acc != expected_acc, "answer=%zu, expected=%zu (capacity=%zu)", 
+	     counter.acc, expected_acc, capacities[k]);
+    fail_if (counter.i != T_TASK_COUNT, "i=%zu, expected=%d", counter.i, T_TASK_COUNT);
+  }
+}
+END_TEST
+
+
+enum yarn_ret t_yarn_exec_range_worker (const yarn_word_t pool_id, 
+					void* data, 
+					yarn_word_t begin,
+					yarn_word_t end) 
+{
+  data_t* counter = (data_t*) data;
+
+  yarn_word_t acc;
+  CHECK_DEP(yarn_dep_load_fast(pool_id, INDEX_ACC, &counter->acc, &acc));
+
+  for (yarn_word_t indvar = begin; indvar < end; ++indvar) {
+    if (indvar > counter->n) {
+      CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+      yarn_dep_store(pool_id, &indvar, &counter->i);
+      return yarn_ret_break;
+    }
+    acc += indvar;
+  }
+
+  CHECK_DEP(yarn_dep_store_fast(pool_id, INDEX_ACC, &acc, &counter->acc));
+  return yarn_ret_continue;
+
+ dep_error:
+  perror(__FUNCTION__);
+  return yarn_ret_error;
+}
+
+START_TEST (t_yarn_exec_range) {
+  struct yarn_policy policy = { .chunk_size = 0 };
+  const yarn_word_t chunk_sizes[] = { 0, 1, 7, 1000 };
+
+  for (size_t k = 0; k < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++k) {
+    policy.chunk_size = chunk_sizes[k];
+
+    for (int i = 0; i < 10; ++i) {
+      data_t counter;
+      counter.i = 0;
+      counter.acc = 0;
+      counter.n = 1000;
+      counter.r = (counter.n*(counter.n+1))/2;  
+
+      bool ret = yarn_exec_range(t_yarn_exec_range_worker, &counter, 
+				 YARN_ALL_THREADS, 2, 1, &policy);
+
+      fail_if (!ret);
+      fail_if (counter.acc != counter.r, "answer=%zu, expected=%zu (chunk=%zu, i=%d)",
+	       counter.acc, counter.r, policy.chunk_size, i);
+      fail_if (counter.i != counter.n+1,
+	       "i=%zu, expected=%zu", counter.i, counter.n+1);
+    }
+  }
+}
+END_TEST
+
+
 Suite* yarn_exec_suite (bool para_only) {
   (void) para_only;
 
@@ -97,6 +1211,25 @@ Suite* yarn_exec_suite (bool para_only) {
   TCase* tc_std_init = tcase_create("yarn_exec_std_init");
   tcase_add_checked_fixture(tc_std_init, t_yarn_setup, t_yarn_teardown);
   tcase_add_test(tc_std_init, t_yarn_exec_simple);
+  tcase_add_test(tc_std_init, t_yarn_exec_channel);
+  tcase_add_test(tc_std_init, t_yarn_exec_predict);
+  tcase_add_test(tc_std_init, t_yarn_exec_selective);
+  tcase_add_test(tc_std_init, t_yarn_exec_lazy);
+  tcase_add_test(tc_std_init, t_yarn_exec_checkpoint);
+  tcase_add_test(tc_std_init, t_yarn_exec_unordered);
+  tcase_add_test(tc_std_init, t_yarn_exec_adaptive_depth);
+  tcase_add_test(tc_std_init, t_yarn_exec_trip_count);
+  tcase_add_test(tc_std_init, t_yarn_exec_range);
+  tcase_add_test(tc_std_init, t_yarn_exec_abort);
+  tcase_add_test(tc_std_init, t_yarn_exec_nest);
+  tcase_add_test(tc_std_init, t_yarn_exec_nest_empty);
+  tcase_add_test(tc_std_init, t_yarn_exec_tasks);
+  tcase_add_test(tc_std_init, t_yarn_exec_loops);
+  tcase_add_test(tc_std_init, t_yarn_exec_call);
+  tcase_add_test(tc_std_init, t_yarn_exec_list);
+  tcase_add_test(tc_std_init, t_yarn_exec_distance);
+  tcase_add_test(tc_std_init, t_yarn_exec_sync);
+  tcase_add_test(tc_std_init, t_yarn_exec_inspect);
   suite_add_tcase(s, tc_std_init);
 
   TCase* tc_fast_init = tcase_create("yarn_exec_fast_init");
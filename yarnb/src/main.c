@@ -16,8 +16,10 @@ Now leave me alone...
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 
 
 struct task {
@@ -39,6 +41,14 @@ struct task {
 #define SPEEDUP_MIN 0.5
 #define SPEEDUP_STEP 0.5
 
+// Iteration length used when running alongside the cpu hogs.
+#define HOG_WAIT_NS 10000
+
+// Shape of the write heavy loop used to compare the conflict detection modes.
+#define LAZY_ITERATIONS 10000
+#define LAZY_WRITES 32
+#define LAZY_TABLE_SIZE 4096
+
 #define DEBUG "DEBUG - "
 #define INFO  "INFO  - "
 #define WARN  "WARN  - "
@@ -57,6 +67,9 @@ int speedup_search (const double target_speedup,
 void run_normal (struct task* t);
 enum yarn_ret run_speculative (const yarn_word_t pool_id, void* task, yarn_word_t indvar);
 
+int hog_bench (void);
+int lazy_bench (void);
+
 
 
 static double g_max_speedup;
@@ -135,6 +148,13 @@ static void warm_up (void) {
 }
 
 int main (int argc, char** argv) {
+
+  if (argc > 1 && strcmp(argv[1], "--hog") == 0) {
+    return hog_bench();
+  }
+  if (argc > 1 && strcmp(argv[1], "--lazy") == 0) {
+    return lazy_bench();
+  }
   
   if (argc > 1) {
     g_use_log = true;
@@ -325,6 +345,13 @@ void exec_speculative (struct task* t) {
   assert(ret);
 }
 
+void exec_speculative_fair (struct task* t) {
+  static const struct yarn_policy policy = { .fair_scheduling = true };
+  bool ret = yarn_exec_policy(run_speculative, (void*) t, 
+			      t->thread_count, t->array_size, 0, &policy);
+  assert(ret);
+}
+
 
 yarn_time_t time_exec (exec_func_t exec_func, 
 		       yarn_time_t wait_time, 
@@ -427,3 +454,193 @@ enum yarn_ret run_speculative (const yarn_word_t pool_id, void* task, yarn_word_
   return yarn_ret_continue;
 }
 
+
+
+
+static volatile bool g_hog_stop;
+
+static void* hog_thread (void* param) {
+  (void) param;
+  while (!g_hog_stop);
+  return NULL;
+}
+
+/*!
+Compares the speedup with and without the head priority while other threads are
+competing for the processors.
+ */
+int hog_bench (void) {
+  bool ret = yarn_init();
+  if (!ret) goto yarn_error;
+
+  const yarn_word_t threads = yarn_thread_count();
+
+  printf(INFO "Yarn Benchmark - CPU hogs\n");
+  printf(INFO "\tSpeculative threads = %zu\n", threads);
+  printf(INFO "\tIteration time = %dns\n", HOG_WAIT_NS);
+
+  warm_up();
+
+  printf(INFO "\n");
+  printf(INFO "Executing the benchmark...\n");
+  fflush(stdout);
+
+  pthread_t* hogs = malloc(threads * sizeof(pthread_t));
+  if (!hogs) goto alloc_error;
+
+  const yarn_word_t hog_step = threads > 1 ? threads / 2 : 1;
+
+  for (yarn_word_t hog_count = 0; hog_count <= threads; hog_count += hog_step) {
+    g_hog_stop = false;
+
+    yarn_word_t created = 0;
+    for (; created < hog_count; ++created) {
+      if (pthread_create(&hogs[created], NULL, hog_thread, NULL)) {
+	perror(__FUNCTION__);
+	break;
+      }
+    }
+
+    yarn_time_t base_time = time_exec(exec_normal, HOG_WAIT_NS, threads);
+    yarn_time_t fair_time = time_exec(exec_speculative_fair, HOG_WAIT_NS, threads);
+    yarn_time_t head_time = time_exec(exec_speculative, HOG_WAIT_NS, threads);
+
+    g_hog_stop = true;
+    for (yarn_word_t i = 0; i < created; ++i) {
+      pthread_join(hogs[i], NULL);
+    }
+
+    printf(INFO "(%2zu hogs) fair = %3f, head priority = %3f\n", created,
+	   (double) base_time / (double) fair_time,
+	   (double) base_time / (double) head_time);
+    fflush(stdout);
+  }
+
+  free(hogs);
+  yarn_destroy();
+  return 0;
+
+ alloc_error:
+  yarn_destroy();
+ yarn_error:
+  perror(__FUNCTION__);
+  return 1;
+}
+
+
+
+struct lazy_task {
+  yarn_word_t table[LAZY_TABLE_SIZE];
+};
+
+static void run_lazy_normal (struct lazy_task* t) {
+  for (yarn_word_t i = 0; i < LAZY_ITERATIONS; ++i) {
+    const size_t base = (i * LAZY_WRITES) % LAZY_TABLE_SIZE;
+
+    yarn_word_t value = t->table[base];
+    for (size_t j = 0; j < LAZY_WRITES; ++j) {
+      t->table[base + j] = ++value;
+    }
+  }
+}
+
+/*!
+Each iteration fills a stripe of the table from a value found in the stripe. The stripes
+are only reused once the table wraps around so there are very few true conflicts and the
+time is mostly spent on tracking the stores.
+ */
+static enum yarn_ret run_lazy_speculative (const yarn_word_t pool_id, 
+					   void* data, 
+					   yarn_word_t indvar) 
+{
+  struct lazy_task* t = (struct lazy_task*) data;
+
+  if (indvar >= LAZY_ITERATIONS) {
+    return yarn_ret_break;
+  }
+
+  const size_t base = (indvar * LAZY_WRITES) % LAZY_TABLE_SIZE;
+
+  yarn_word_t value;
+  yarn_dep_load(pool_id, &t->table[base], &value);
+  for (size_t j = 0; j < LAZY_WRITES; ++j) {
+    ++value;
+    yarn_dep_store(pool_id, &value, &t->table[base + j]);
+  }
+
+  return yarn_ret_continue;
+}
+
+static yarn_time_t time_lazy (const struct yarn_policy* policy, yarn_word_t thread_count) {
+  static const int n = 10;
+
+  struct lazy_task* t = (struct lazy_task*) malloc(sizeof(struct lazy_task));
+  if (!t) goto alloc_error;
+
+  yarn_time_t time_sum = 0;
+
+  for (int i = 0; i < n; ++i) {
+    memset(t, 0, sizeof(struct lazy_task));
+    yarn_time_t start = yarn_timer_sample_system();
+
+    if (policy) {
+      bool ret = yarn_exec_policy(run_lazy_speculative, (void*) t, thread_count, 
+				  LAZY_TABLE_SIZE, 0, policy);
+      assert(ret);
+    }
+    else {
+      run_lazy_normal(t);
+    }
+
+    time_sum += yarn_timer_diff(start, yarn_timer_sample_system());
+  }
+
+  free(t);
+  return time_sum / n;
+
+ alloc_error:
+  perror(__FUNCTION__);
+  return 0;
+}
+
+/*!
+Compares the speedup of a write heavy loop when the conflicts are detected on every store
+and when they're detected on commit.
+ */
+int lazy_bench (void) {
+  bool ret = yarn_init();
+  if (!ret) goto yarn_error;
+
+  printf(INFO "Yarn Benchmark - Lazy conflict detection\n");
+  printf(INFO "\tSpeculative threads = %zu\n", yarn_thread_count());
+  printf(INFO "\tIterations = %d\n", LAZY_ITERATIONS);
+  printf(INFO "\tWrites per iteration = %d\n", LAZY_WRITES);
+
+  warm_up();
+
+  printf(INFO "\n");
+  printf(INFO "Executing the benchmark...\n");
+  fflush(stdout);
+
+  static const struct yarn_policy eager_policy = { .lazy_detection = false };
+  static const struct yarn_policy lazy_policy = { .lazy_detection = true };
+
+  for (yarn_word_t threads = 1; threads <= yarn_thread_count(); ++threads) {
+    yarn_time_t base_time = time_lazy(NULL, threads);
+    yarn_time_t eager_time = time_lazy(&eager_policy, threads);
+    yarn_time_t lazy_time = time_lazy(&lazy_policy, threads);
+
+    printf(INFO "(%2zu / %2zu) eager = %3f, lazy = %3f\n", 
+	   threads, yarn_thread_count(),
+	   (double) base_time / (double) eager_time,
+	   (double) base_time / (double) lazy_time);
+    fflush(stdout);
+  }
+
+  yarn_destroy();
+  return 0;
+
+ yarn_error:
+  perror(__FUNCTION__);
+  return 1;
+}
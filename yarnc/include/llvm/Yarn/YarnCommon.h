@@ -36,7 +36,8 @@ namespace yarn {
   enum yarn_ret {
     yarn_ret_continue = 0,
     yarn_ret_break = 1,
-    yarn_ret_error = 2
+    yarn_ret_error = 2,
+    yarn_ret_abort = 3
   };
 
   enum {
@@ -0,0 +1,702 @@
+//===- YarnInstrumentCall.cpp - Method-level speculation ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the FreeBSD License.
+// See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Yarnc call instrumentation pass. Part of the yarn project which can be found
+// somewhere else.
+//
+// Looks for calls to leaf functions whose result is unused and that are
+// followed by a straight-line sequence of loads, stores and arithmetic within
+// the same basic block. The call and the sequence are outlined into a callee
+// and a continuation function which are handed to yarn_exec_call. The callee
+// is executed normally while the continuation is executed speculatively.
+//
+// The original code is left in place and is used if yarn_exec_call fails before
+// executing anything. A failure after the callee started aborts the program
+// since the callee can't be executed a second time.
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "yarncall"
+#include "YarnUtil.h"
+#include <llvm/Yarn/YarnCommon.h>
+#include <llvm/Pass.h>
+#include <llvm/Function.h>
+#include <llvm/Module.h>
+#include <llvm/BasicBlock.h>
+#include <llvm/Value.h>
+#include <llvm/Instructions.h>
+#include <llvm/IntrinsicInst.h>
+#include <llvm/Constants.h>
+#include <llvm/Type.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/ADT/SmallVector.h>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cassert>
+using namespace llvm;
+using namespace yarn;
+
+
+namespace {
+
+  typedef ValueMap<const Value*, Value*> VMapTy;
+
+
+//===----------------------------------------------------------------------===//
+/// InstrumentCallUtil Decl
+
+  class InstrumentCallUtil : public Noncopyable {
+
+    Module* M;
+    CallInst* CI;
+
+    // Instructions that follow the call in its block, excluding the terminator.
+    std::vector<Instruction*> Continuation;
+
+    // Values defined outside of the call site that are needed by the callee or
+    //   the continuation. They're passed around in an array of yarn_word_t.
+    std::vector<Value*> LiveIns;
+
+    const IntegerType* YarnWordTy;
+    const IntegerType* EnumTy;
+    const PointerType* VoidPtrTy;
+    const FunctionType* YarnCallExecutorFctTy;
+    ArrayType* LiveInArrayTy;
+
+    Constant* YarnExecCallFct;
+    Constant* YarnExecHasStartedFct;
+    Constant* YarnDepLoadFct;
+    Constant* YarnDepStoreFct;
+    Constant* AbortFct;
+
+  public:
+
+    InstrumentCallUtil (Module* m, CallInst* ci) :
+      M(m), CI(ci), Continuation(), LiveIns(),
+      YarnWordTy(NULL), EnumTy(NULL), VoidPtrTy(NULL),
+      YarnCallExecutorFctTy(NULL), LiveInArrayTy(NULL),
+      YarnExecCallFct(NULL), YarnExecHasStartedFct(NULL),
+      YarnDepLoadFct(NULL), YarnDepStoreFct(NULL), AbortFct(NULL)
+    {}
+
+    bool canInstrument ();
+    void instrumentCall ();
+
+  private:
+
+    inline LLVMContext& getContext() { return M->getContext(); }
+
+    bool isWordType (const Type* t) const;
+    bool isInstrumentableAccess (const Instruction* inst) const;
+    bool isLeafFct (const Function* f) const;
+    void addLiveIn (Value* val);
+
+    void createDeclarations ();
+    Function* createSpecCallee ();
+    Function* createCalleeFct (Function* specCallee);
+    Function* createContinuationFct ();
+    void instrumentSrcFct (Function* calleeFct, Function* contFct);
+
+    Value* castWord (Value* val, const Type* target, Instruction* insertBefore);
+    void loadLiveIns (Value* dataPtr, BasicBlock* bb, VMapTy& vmap);
+    void collectAccesses (BasicBlock::iterator it,
+			  BasicBlock::iterator itEnd,
+			  std::vector<Instruction*>& accesses);
+    void checkDepCall (Instruction* call, BasicBlock* errorBB);
+    void instrumentAccesses (const std::vector<Instruction*>& accesses,
+			     Value* poolIdVal,
+			     Value* bufferWordPtr,
+			     BasicBlock* errorBB);
+
+  };
+
+
+//===----------------------------------------------------------------------===//
+/// YarnInstrumentCall Decl
+
+  class YarnInstrumentCall : public ModulePass, public Noncopyable {
+  public:
+
+    static char ID; // Pass identification, replacement for typeid
+
+    YarnInstrumentCall() : ModulePass(ID) {}
+
+    virtual bool runOnModule(Module &M);
+    virtual void print (llvm::raw_ostream &O, const llvm::Module *M) const;
+
+  };
+
+} // anynmous namespace
+
+
+
+//===----------------------------------------------------------------------===//
+/// InstrumentCallUtil Impl
+
+
+bool InstrumentCallUtil::isWordType (const Type* t) const {
+  if (t->isPointerTy()) {
+    return true;
+  }
+  // yarn_dep always moves whole words around.
+  return t->isIntegerTy() && t->getPrimitiveSizeInBits() == YarnWordBitSize;
+}
+
+bool InstrumentCallUtil::isInstrumentableAccess (const Instruction* inst) const {
+  if (const LoadInst* li = dyn_cast<LoadInst>(inst)) {
+    return !li->isVolatile() && isWordType(li->getType());
+  }
+  if (const StoreInst* si = dyn_cast<StoreInst>(inst)) {
+    return !si->isVolatile() && isWordType(si->getOperand(0)->getType());
+  }
+  return true;
+}
+
+/// The callee has to go through yarn_dep for all its accesses so we can't let
+/// it call anything that we didn't instrument.
+bool InstrumentCallUtil::isLeafFct (const Function* f) const {
+  for (Function::const_iterator bb = f->begin(), bbEnd = f->end(); bb != bbEnd; ++bb) {
+    for (BasicBlock::const_iterator it = bb->begin(), itEnd = bb->end(); it != itEnd; ++it) {
+      const Instruction* inst = &(*it);
+      if (isa<DbgInfoIntrinsic>(inst)) {
+	continue;
+      }
+      if (isa<CallInst>(inst) || isa<InvokeInst>(inst) || isa<VAArgInst>(inst)) {
+	return false;
+      }
+      if (!isInstrumentableAccess(inst)) {
+	return false;
+      }
+    }
+  }
+  return true;
+}
+
+void InstrumentCallUtil::addLiveIn (Value* val) {
+  if (!isa<Instruction>(val) && !isa<Argument>(val)) {
+    return;
+  }
+  if (std::find(LiveIns.begin(), LiveIns.end(), val) == LiveIns.end()) {
+    LiveIns.push_back(val);
+  }
+}
+
+
+bool InstrumentCallUtil::canInstrument () {
+  Function* callee = CI->getCalledFunction();
+  if (!callee || callee->isDeclaration() || callee->isVarArg()) {
+    return false;
+  }
+  if (!CI->use_empty() || !isLeafFct(callee)) {
+    return false;
+  }
+
+  BasicBlock* bb = CI->getParent();
+  BasicBlock::iterator it (CI);
+  for (++it; &(*it) != bb->getTerminator(); ++it) {
+    Instruction* inst = &(*it);
+    if (isa<DbgInfoIntrinsic>(inst)) {
+      continue;
+    }
+
+    bool isAllowed =
+      isa<LoadInst>(inst) || isa<StoreInst>(inst) ||
+      isa<BinaryOperator>(inst) || isa<CastInst>(inst) || isa<CmpInst>(inst) ||
+      isa<GetElementPtrInst>(inst) || isa<SelectInst>(inst);
+    if (!isAllowed || !isInstrumentableAccess(inst)) {
+      return false;
+    }
+
+    Continuation.push_back(inst);
+  }
+
+  bool hasAccess = false;
+  std::set<Instruction*> contSet (Continuation.begin(), Continuation.end());
+
+  for (size_t i = 0; i < Continuation.size(); ++i) {
+    Instruction* inst = Continuation[i];
+    hasAccess |= isa<LoadInst>(inst) || isa<StoreInst>(inst);
+
+    // Nothing can be used after the continuation because it runs in another function.
+    for (Value::use_iterator useIt = inst->use_begin(), useItEnd = inst->use_end();
+	 useIt != useItEnd; ++useIt)
+    {
+      Instruction* user = dyn_cast<Instruction>(*useIt);
+      if (!user || contSet.find(user) == contSet.end()) {
+	return false;
+      }
+    }
+
+    for (unsigned op = 0; op < inst->getNumOperands(); ++op) {
+      Instruction* opInst = dyn_cast<Instruction>(inst->getOperand(op));
+      if (opInst && contSet.find(opInst) != contSet.end()) {
+	continue;
+      }
+      addLiveIn(inst->getOperand(op));
+    }
+  }
+
+  // Nothing to overlap the callee with.
+  if (!hasAccess) {
+    return false;
+  }
+
+  for (unsigned i = 0; i < CI->getNumArgOperands(); ++i) {
+    addLiveIn(CI->getArgOperand(i));
+  }
+
+  for (size_t i = 0; i < LiveIns.size(); ++i) {
+    if (!isWordType(LiveIns[i]->getType())) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void InstrumentCallUtil::createDeclarations () {
+  YarnWordTy = IntegerType::get(getContext(), YarnWordBitSize);
+  EnumTy = IntegerType::get(getContext(), YarnRetBitSize);
+  VoidPtrTy = PointerType::getUnqual(Type::getInt8Ty(getContext()));
+  LiveInArrayTy = ArrayType::get(YarnWordTy, std::max<size_t>(LiveIns.size(), 1));
+
+  const Type* boolTy = Type::getInt1Ty(getContext());
+
+  {
+    std::vector<const Type*> args;
+    args.push_back(YarnWordTy); // yarn_word_t pool_id
+    args.push_back(VoidPtrTy);  // void* data
+    YarnCallExecutorFctTy = FunctionType::get(EnumTy, args, false); // enum yarn_ret
+  }
+
+  {
+    std::vector<const Type*> args;
+    args.push_back(PointerType::getUnqual(YarnCallExecutorFctTy)); // callee
+    args.push_back(PointerType::getUnqual(YarnCallExecutorFctTy)); // continuation
+    args.push_back(VoidPtrTy); // void* data
+    args.push_back(YarnWordTy); // ws_size
+    args.push_back(YarnWordTy); // index_size
+    FunctionType* t = FunctionType::get(boolTy, args, false);
+
+    YarnExecCallFct = M->getOrInsertFunction("yarn_exec_call", t);
+  }
+
+  {
+    std::vector<const Type*> args;
+    FunctionType* t = FunctionType::get(boolTy, args, false);
+    YarnExecHasStartedFct = M->getOrInsertFunction("yarn_exec_has_started", t);
+  }
+
+  {
+    std::vector<const Type*> args;
+    FunctionType* t = FunctionType::get(Type::getVoidTy(getContext()), args, false);
+    AbortFct = M->getOrInsertFunction("abort", t);
+  }
+
+  {
+    std::vector<const Type*> args;
+    args.push_back(YarnWordTy); // yarn_word_t pool_id
+    args.push_back(VoidPtrTy); // const void* src
+    args.push_back(VoidPtrTy); // const void* dest
+    FunctionType* t = FunctionType::get(boolTy, args, false);
+
+    YarnDepLoadFct = M->getOrInsertFunction("yarn_dep_load", t);
+    YarnDepStoreFct = M->getOrInsertFunction("yarn_dep_store", t);
+  }
+}
+
+
+Value* InstrumentCallUtil::castWord (Value* val,
+				     const Type* target,
+				     Instruction* insertBefore)
+{
+  if (val->getType() == target) {
+    return val;
+  }
+
+  bool srcPtr = val->getType()->isPointerTy();
+  bool targetPtr = target->isPointerTy();
+
+  if (srcPtr == targetPtr) {
+    return new BitCastInst(val, target, "", insertBefore);
+  }
+  if (targetPtr) {
+    return new IntToPtrInst(val, target, "", insertBefore);
+  }
+  return new PtrToIntInst(val, target, "", insertBefore);
+}
+
+
+/// Loads the live-ins out of the array pointed to by dataPtr at the end of bb.
+void InstrumentCallUtil::loadLiveIns (Value* dataPtr, BasicBlock* bb, VMapTy& vmap) {
+  Instruction* term = bb->getTerminator();
+
+  Value* arrayPtr = castWord(dataPtr, PointerType::getUnqual(LiveInArrayTy), term);
+
+  for (unsigned i = 0; i < LiveIns.size(); ++i) {
+    std::vector<Value*> indexes;
+    indexes.push_back(ConstantInt::get(Type::getInt32Ty(getContext()), 0));
+    indexes.push_back(ConstantInt::get(Type::getInt32Ty(getContext()), i));
+
+    Value* ptr = GetElementPtrInst::Create(arrayPtr, indexes.begin(), indexes.end(),
+					   "", term);
+    Value* word = new LoadInst(ptr, LiveIns[i]->getName(), term);
+    vmap[LiveIns[i]] = castWord(word, LiveIns[i]->getType(), term);
+  }
+}
+
+
+/// Gathers the loads and stores of the range that aren't on the function's stack frame.
+void InstrumentCallUtil::collectAccesses (BasicBlock::iterator it,
+					  BasicBlock::iterator itEnd,
+					  std::vector<Instruction*>& accesses)
+{
+  for (; it != itEnd; ++it) {
+    Instruction* inst = &(*it);
+
+    if (LoadInst* loadInst = dyn_cast<LoadInst>(inst)) {
+      if (!isa<AllocaInst>(loadInst->getPointerOperand())) {
+	accesses.push_back(inst);
+      }
+    }
+    else if (StoreInst* storeInst = dyn_cast<StoreInst>(inst)) {
+      if (!isa<AllocaInst>(storeInst->getPointerOperand())) {
+	accesses.push_back(inst);
+      }
+    }
+  }
+}
+
+
+/// Splits the block right after the yarn_dep call and branches to errorBB if it failed.
+void InstrumentCallUtil::checkDepCall (Instruction* call, BasicBlock* errorBB) {
+  BasicBlock::iterator next(call);
+  ++next;
+
+  BasicBlock* bb = call->getParent();
+  BasicBlock* nextBB = bb->splitBasicBlock(next, "ydep.ok");
+
+  bb->getTerminator()->eraseFromParent();
+  BranchInst::Create(nextBB, errorBB, call, bb);
+}
+
+
+/*!
+Redirects the loads and stores through a yarn_word_t buffer that is filled and flushed by
+yarn_dep_load and yarn_dep_store. Accesses to the function's own stack frame are left
+alone since nobody else can see them. If a yarn_dep call fails, the value in the buffer
+is meaningless so we bail out to errorBB.
+ */
+void InstrumentCallUtil::instrumentAccesses (const std::vector<Instruction*>& accesses,
+					     Value* poolIdVal,
+					     Value* bufferWordPtr,
+					     BasicBlock* errorBB)
+{
+  for (size_t i = 0; i < accesses.size(); ++i) {
+    Instruction* inst = accesses[i];
+
+    if (LoadInst* loadInst = dyn_cast<LoadInst>(inst)) {
+      Value* ptr = loadInst->getPointerOperand();
+
+      std::vector<Value*> args;
+      args.push_back(poolIdVal);
+      args.push_back(castWord(ptr, VoidPtrTy, loadInst)); // src
+      args.push_back(castWord(bufferWordPtr, VoidPtrTy, loadInst)); // dest
+      Instruction* call = 
+	CallInst::Create(YarnDepLoadFct, args.begin(), args.end(), "", loadInst);
+
+      loadInst->setOperand(0, castWord(bufferWordPtr, ptr->getType(), loadInst));
+      checkDepCall(call, errorBB);
+    }
+
+    else if (StoreInst* storeInst = dyn_cast<StoreInst>(inst)) {
+      Value* ptr = storeInst->getPointerOperand();
+
+      // The call goes after the store so that the buffer is filled first.
+      BasicBlock::iterator it(storeInst);
+      Instruction* insertPos = &(*(++it));
+
+      std::vector<Value*> args;
+      args.push_back(poolIdVal);
+      args.push_back(castWord(bufferWordPtr, VoidPtrTy, insertPos)); // src
+      args.push_back(castWord(ptr, VoidPtrTy, insertPos)); // dest
+      Instruction* call = 
+	CallInst::Create(YarnDepStoreFct, args.begin(), args.end(), "", insertPos);
+
+      storeInst->setOperand(1, castWord(bufferWordPtr, ptr->getType(), storeInst));
+      checkDepCall(call, errorBB);
+    }
+  }
+}
+
+
+/// Copy of the callee with an extra pool_id argument and instrumented accesses.
+Function* InstrumentCallUtil::createSpecCallee () {
+  Function* callee = CI->getCalledFunction();
+  const FunctionType* calleeTy = callee->getFunctionType();
+
+  std::vector<const Type*> argTys;
+  argTys.push_back(YarnWordTy); // yarn_word_t pool_id
+  argTys.insert(argTys.end(), calleeTy->param_begin(), calleeTy->param_end());
+  FunctionType* specTy = FunctionType::get(calleeTy->getReturnType(), argTys, false);
+
+  Function* spec = Function::Create(specTy, GlobalValue::InternalLinkage,
+				    callee->getName() + ".yspec", M);
+
+  VMapTy vmap;
+  Function::arg_iterator specArg = spec->arg_begin();
+  Value* poolIdVal = &(*specArg);
+  poolIdVal->setName("pool_id");
+  ++specArg;
+
+  for (Function::const_arg_iterator arg = callee->arg_begin(), argEnd = callee->arg_end();
+       arg != argEnd; ++arg, ++specArg)
+  {
+    specArg->setName(arg->getName());
+    vmap[&(*arg)] = &(*specArg);
+  }
+
+  SmallVector<ReturnInst*, 4> returns;
+  CloneFunctionInto(spec, callee, vmap, false, returns);
+
+  BasicBlock* entry = &spec->getEntryBlock();
+  Value* bufferWordPtr = new AllocaInst(YarnWordTy, 0, "", entry->getFirstNonPHI());
+
+  // Gather first since the instrumentation splits the blocks.
+  std::vector<Instruction*> accesses;
+  for (Function::iterator bb = spec->begin(), bbEnd = spec->end(); bb != bbEnd; ++bb) {
+    collectAccesses(bb->begin(), bb->end(), accesses);
+  }
+
+  // The callee can't return yarn_ret_error and it can't be rolled back either.
+  BasicBlock* errorBB = BasicBlock::Create(getContext(), "ydep.error", spec);
+  CallInst::Create(AbortFct, "", errorBB);
+  new UnreachableInst(getContext(), errorBB);
+
+  instrumentAccesses(accesses, poolIdVal, bufferWordPtr, errorBB);
+
+  return spec;
+}
+
+
+/// enum yarn_ret callee (yarn_word_t pool_id, void* data);
+Function* InstrumentCallUtil::createCalleeFct (Function* specCallee) {
+  Function* f = Function::Create(YarnCallExecutorFctTy, GlobalValue::InternalLinkage,
+				 CI->getParent()->getParent()->getName() + ".ycallee", M);
+
+  Function::arg_iterator arg = f->arg_begin();
+  Value* poolIdVal = &(*arg++);
+  Value* dataPtr = &(*arg++);
+
+  BasicBlock* bb = BasicBlock::Create(getContext(), "entry", f);
+  Instruction* ret = ReturnInst::Create(getContext(),
+					ConstantInt::get(EnumTy, yarn_ret_continue), bb);
+
+  VMapTy vmap;
+  loadLiveIns(dataPtr, bb, vmap);
+
+  std::vector<Value*> args;
+  args.push_back(poolIdVal);
+  for (unsigned i = 0; i < CI->getNumArgOperands(); ++i) {
+    Value* argVal = CI->getArgOperand(i);
+    args.push_back(vmap.count(argVal) ? vmap[argVal] : argVal);
+  }
+  CallInst::Create(specCallee, args.begin(), args.end(), "", ret);
+
+  return f;
+}
+
+
+/// enum yarn_ret continuation (yarn_word_t pool_id, void* data);
+Function* InstrumentCallUtil::createContinuationFct () {
+  Function* f = Function::Create(YarnCallExecutorFctTy, GlobalValue::InternalLinkage,
+				 CI->getParent()->getParent()->getName() + ".ycont", M);
+
+  Function::arg_iterator arg = f->arg_begin();
+  Value* poolIdVal = &(*arg++);
+  Value* dataPtr = &(*arg++);
+
+  BasicBlock* bb = BasicBlock::Create(getContext(), "entry", f);
+  Instruction* ret = ReturnInst::Create(getContext(),
+					ConstantInt::get(EnumTy, yarn_ret_continue), bb);
+
+  VMapTy vmap;
+  loadLiveIns(dataPtr, bb, vmap);
+
+  Value* bufferWordPtr = new AllocaInst(YarnWordTy, 0, "", bb->getFirstNonPHI());
+
+  // Clone the continuation in order while remapping the operands by hand.
+  Instruction* first = NULL;
+  for (size_t i = 0; i < Continuation.size(); ++i) {
+    Instruction* inst = Continuation[i]->clone();
+    inst->setName(Continuation[i]->getName());
+    bb->getInstList().insert(ret, inst);
+    vmap[Continuation[i]] = inst;
+
+    for (unsigned op = 0; op < inst->getNumOperands(); ++op) {
+      Value* opVal = inst->getOperand(op);
+      if (vmap.count(opVal)) {
+	inst->setOperand(op, vmap[opVal]);
+      }
+    }
+
+    if (!first) {
+      first = inst;
+    }
+  }
+
+  std::vector<Instruction*> accesses;
+  collectAccesses(BasicBlock::iterator(first), BasicBlock::iterator(ret), accesses);
+
+  BasicBlock* errorBB = BasicBlock::Create(getContext(), "ydep.error", f);
+  ReturnInst::Create(getContext(), ConstantInt::get(EnumTy, yarn_ret_error), errorBB);
+
+  instrumentAccesses(accesses, poolIdVal, bufferWordPtr, errorBB);
+
+  return f;
+}
+
+
+/*
+Packs the live-ins and calls yarn_exec_call right before the original call. The block is
+split so that the original call and continuation are skipped if yarn_exec_call succeeds.
+They're only executed if yarn_exec_call failed before the callee started since it might
+not be safe to execute the callee twice.
+
+  %yc.array = alloca [n x yarn_word_t]
+  store live-ins into %yc.array
+  %r = call yarn_exec_call(callee, continuation, %yc.array, 0, 1)
+  br %r, %after, %check
+check:
+  %s = call yarn_exec_has_started()
+  br %s, %abort, %orig
+abort:
+  call abort()
+  unreachable
+orig:
+  call f(...)
+  continuation
+  br %after
+after:
+  terminator
+ */
+void InstrumentCallUtil::instrumentSrcFct (Function* calleeFct, Function* contFct) {
+  BasicBlock* bb = CI->getParent();
+  Function* srcFct = bb->getParent();
+
+  BasicBlock* origBB = bb->splitBasicBlock(BasicBlock::iterator(CI), "ycall.orig");
+  BasicBlock* afterBB =
+    origBB->splitBasicBlock(BasicBlock::iterator(origBB->getTerminator()), "ycall.after");
+
+  // Replace the unconditional branch created by the split.
+  bb->getTerminator()->eraseFromParent();
+
+  Instruction* entryPos = srcFct->getEntryBlock().getFirstNonPHI();
+  Value* arrayPtr = new AllocaInst(LiveInArrayTy, 0, "", entryPos);
+
+  BasicBlock* checkBB = BasicBlock::Create(getContext(), "ycall.check", srcFct, origBB);
+  BasicBlock* abortBB = BasicBlock::Create(getContext(), "ycall.abort", srcFct, origBB);
+
+  BranchInst* br = BranchInst::Create(afterBB, checkBB,
+				      ConstantInt::getTrue(getContext()), bb);
+
+  for (unsigned i = 0; i < LiveIns.size(); ++i) {
+    std::vector<Value*> indexes;
+    indexes.push_back(ConstantInt::get(Type::getInt32Ty(getContext()), 0));
+    indexes.push_back(ConstantInt::get(Type::getInt32Ty(getContext()), i));
+
+    Value* ptr = GetElementPtrInst::Create(arrayPtr, indexes.begin(), indexes.end(),
+					   "", br);
+    new StoreInst(castWord(LiveIns[i], YarnWordTy, br), ptr, br);
+  }
+
+  std::vector<Value*> args;
+  args.push_back(calleeFct);
+  args.push_back(contFct);
+  args.push_back(castWord(arrayPtr, VoidPtrTy, br));
+  // ws_size - default value.
+  args.push_back(ConstantInt::get(YarnWordTy, 0));
+  // index_size - the fast index functions aren't used.
+  args.push_back(ConstantInt::get(YarnWordTy, 1));
+
+  Value* retVal = CallInst::Create(YarnExecCallFct, args.begin(), args.end(), "", br);
+  br->setCondition(retVal);
+
+  Value* hasStarted = CallInst::Create(YarnExecHasStartedFct, "", checkBB);
+  BranchInst::Create(abortBB, origBB, hasStarted, checkBB);
+
+  CallInst::Create(AbortFct, "", abortBB);
+  new UnreachableInst(getContext(), abortBB);
+}
+
+
+void InstrumentCallUtil::instrumentCall () {
+  createDeclarations();
+
+  Function* specCallee = createSpecCallee();
+  Function* calleeFct = createCalleeFct(specCallee);
+  Function* contFct = createContinuationFct();
+
+  // This will trash our analysis data. Do it last.
+  instrumentSrcFct(calleeFct, contFct);
+}
+
+
+
+//===----------------------------------------------------------------------===//
+/// YarnInstrumentCall Impl
+
+char YarnInstrumentCall::ID = 0;
+
+bool YarnInstrumentCall::runOnModule(Module &M) {
+  // Gather the calls first because we'll be adding functions to the module.
+  std::vector<CallInst*> calls;
+  for (Module::iterator fct = M.begin(), fctEnd = M.end(); fct != fctEnd; ++fct) {
+    for (Function::iterator bb = fct->begin(), bbEnd = fct->end(); bb != bbEnd; ++bb) {
+      for (BasicBlock::iterator it = bb->begin(), itEnd = bb->end(); it != itEnd; ++it) {
+	if (CallInst* ci = dyn_cast<CallInst>(it)) {
+	  calls.push_back(ci);
+	}
+      }
+    }
+  }
+
+  bool didSomething = false;
+
+  // Instrumenting a call only splits its own block so the other calls are still valid.
+  for (size_t i = 0; i < calls.size(); ++i) {
+    InstrumentCallUtil icu(&M, calls[i]);
+    if (!icu.canInstrument()) {
+      continue;
+    }
+
+    icu.instrumentCall();
+    didSomething = true;
+  }
+
+  return didSomething;
+}
+
+
+void YarnInstrumentCall::print (llvm::raw_ostream &O, const llvm::Module *M) const {
+
+}
+
+
+
+//===----------------------------------------------------------------------===//
+/// Pass Registration
+
+INITIALIZE_PASS(YarnInstrumentCall, "yarn-call",
+                "Yarn method-level speculation",
+                false, false);
@@ -30,6 +30,7 @@
 #include <llvm/DerivedTypes.h>
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/CFG.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/ADT/Statistic.h>
@@ -80,6 +81,9 @@ namespace {
     Constant* YarnDepLoadFastFct;
     Constant* YarnDepStoreFct;
     Constant* YarnDepStoreFastFct;
+    Constant* YarnDepConsumeFct;
+    Constant* YarnDepProduceFct;
+    Constant* YarnDepIsAbortedFct;
 
     std::map<char, unsigned> ValCounter;
 
@@ -91,6 +95,8 @@ namespace {
       YarnExecutorFctTy(NULL), YarnExecSimpleFct(NULL),
       YarnDepLoadFct(NULL), YarnDepLoadFastFct(NULL), 
       YarnDepStoreFct(NULL), YarnDepStoreFastFct(NULL),
+      YarnDepConsumeFct(NULL), YarnDepProduceFct(NULL),
+      YarnDepIsAbortedFct(NULL),
       ValCounter()
     {}
 
@@ -130,6 +136,15 @@ namespace {
     inline Constant* getYarnDepStoreFastFct () const { 
       return YarnDepStoreFastFct; 
     }
+    inline Constant* getYarnDepConsumeFct () const { 
+      return YarnDepConsumeFct; 
+    }
+    inline Constant* getYarnDepProduceFct () const { 
+      return YarnDepProduceFct; 
+    }
+    inline Constant* getYarnDepIsAbortedFct () const { 
+      return YarnDepIsAbortedFct; 
+    }
 
     std::string makeName(char prefix);    
     std::string makeName(char prefix, const std::string suffix);    
@@ -231,7 +246,8 @@ namespace {
 			     Value* bufferVoidPtr,
 			     const PointerInstr* ptrInstr);
 
-    void cleanupTmpFct(BasicBlock*);
+    void cleanupTmpFct(BasicBlock* instrHeader, Value* poolIdVal);
+    void instrumentAbortPolls(const Loop* l, Value* poolIdVal, BasicBlock* abortExit);
 
   };
 
@@ -369,6 +385,16 @@ void InstrumentModuleUtil::createDeclarations () {
 
     YarnDepLoadFastFct = M->getOrInsertFunction("yarn_dep_load_fast", t);
     YarnDepStoreFastFct = M->getOrInsertFunction("yarn_dep_store_fast", t);
+    YarnDepConsumeFct = M->getOrInsertFunction("yarn_dep_consume", t);
+    YarnDepProduceFct = M->getOrInsertFunction("yarn_dep_produce", t);
+  }
+
+  {
+    std::vector<const Type*> args;
+    args.push_back(YarnWordTy); // yarn_word_t pool_id
+    FunctionType* t = FunctionType::get(boolTy, args, false);
+
+    YarnDepIsAbortedFct = M->getOrInsertFunction("yarn_dep_is_aborted", t);
   }
 
   DeclarationsInserted = true;
@@ -514,7 +540,7 @@ void InstrumentLoopUtil::createTmpFct () {
   // Do the rest of the instrumentation.
   instrumentTmpBody(poolIdVal, bufferWordPtr, bufferVoidPtr);
   instrumentIndVar(poolIdVal, bufferWordPtr, bufferVoidPtr, indVar);
-  cleanupTmpFct(instrHeader);  
+  cleanupTmpFct(instrHeader, poolIdVal);  
 }
 
 
@@ -523,7 +549,8 @@ void InstrumentLoopUtil::instrumentTmpBody (Value* poolIdVal,
 					    Value* bufferWordPtr, 
 					    Value* bufferVoidPtr)
 {
-  // Process the value accesses.
+  // Process the value accesses. These are the loop-carried values which are written once
+  // per epoch so they go through the yarn_dep_consume/produce channels.
   typedef YarnLoop::ValueInstrList VIL;
   const VIL& valInstrList = YL->getValueInstrs();
   for (VIL::const_iterator it = valInstrList.begin(), itEnd = valInstrList.end();
@@ -598,9 +625,9 @@ void InstrumentLoopUtil::instrumentValueLoad (Value* poolIdVal,
   if (valueInstr->getInstPos()) {
     Instruction* pos = map<Instruction>::get(TmpVMap, valueInstr->getInstPos());
 
-    // Call yarn_dep_load to load the desired value into the buffer.
+    // Call yarn_dep_consume to load the desired value into the buffer.
     // Place before the target instruction.
-    retVal = CallInst::Create(IMU->getYarnDepLoadFastFct(), 
+    retVal = CallInst::Create(IMU->getYarnDepConsumeFct(), 
 			      args.begin(), args.end(), 
 			      IMU->makeName(RET, name), pos);
 
@@ -618,9 +645,9 @@ void InstrumentLoopUtil::instrumentValueLoad (Value* poolIdVal,
     BasicBlock* pos = map<BasicBlock>::get(TmpVMap, valueInstr->getBBPos());
     assert (pos && "Either getInstPos or getBBPos should be non-null.");
 	
-    // Call yarn_dep_load to load the desired value into the buffer. 
+    // Call yarn_dep_consume to load the desired value into the buffer. 
     //Append at the end of the BB.
-    retVal = CallInst::Create(IMU->getYarnDepLoadFastFct(), 
+    retVal = CallInst::Create(IMU->getYarnDepConsumeFct(), 
 			      args.begin(), args.end(),
 			      IMU->makeName(RET, name), pos);
 
@@ -663,7 +690,7 @@ void InstrumentLoopUtil::instrumentValueStore (Value* poolIdVal,
 
   if (valueInstr->getInstPos()) {
     // Call yarn to store the buffer into memory.
-    retVal = CallInst::Create(IMU->getYarnDepStoreFastFct(), 
+    retVal = CallInst::Create(IMU->getYarnDepProduceFct(), 
 			      args.begin(), args.end(),
 			      IMU->makeName(RET, name));
 
@@ -692,7 +719,7 @@ void InstrumentLoopUtil::instrumentValueStore (Value* poolIdVal,
 
     // Call yarn to store the buffer into memory.
     // Place the call at the beginning of the BB.
-    retVal = CallInst::Create(IMU->getYarnDepStoreFastFct(), 
+    retVal = CallInst::Create(IMU->getYarnDepProduceFct(), 
 			      args.begin(), args.end(),
 			      IMU->makeName(RET, name), &pos->front());
 
@@ -794,7 +821,7 @@ void InstrumentLoopUtil::instrumentPtrStore (Value* poolIdVal,
 
 // For some reason the use_list for a BB is giving some weird result so we can't use
 // them to change the terminator inst. As a work-around we do a plain-old search.
-void InstrumentLoopUtil::cleanupTmpFct(BasicBlock* instrHeader) {  
+void InstrumentLoopUtil::cleanupTmpFct(BasicBlock* instrHeader, Value* poolIdVal) {  
   const Loop* l = YL->getLoop();
   BasicBlock* headerBlock = map<BasicBlock>::get(TmpVMap, l->getHeader());
   BasicBlock* latchBlock = map<BasicBlock>::get(TmpVMap, l->getLoopLatch());
@@ -840,6 +867,23 @@ void InstrumentLoopUtil::cleanupTmpFct(BasicBlock* instrHeader) {
     
   }
 
+  {
+    // Create a block that contains the abort return statement.
+    BasicBlock* abortExit = 
+      BasicBlock::Create(IMU->getContext(), IMU->makeName(LABEL), TmpFct, exitBlock);
+
+    ReturnInst::Create(IMU->getContext(), 
+		       ConstantInt::get(IMU->getEnumType(), yarn_ret_abort),
+		       abortExit);
+
+    // Each epoch is a single iteration of l so only the inner loops need to be polled.
+    // Has to be done last because it splits the blocks used by the other fixups.
+    const std::vector<Loop*>& subLoops = l->getSubLoops();
+    for (size_t i = 0; i < subLoops.size(); ++i) {
+      instrumentAbortPolls(subLoops[i], poolIdVal, abortExit);
+    }
+  }
+
   // Delete header phi nodes
   while (PHINode* phi = dyn_cast<PHINode>(&headerBlock->front())) {
     phi->eraseFromParent();
@@ -850,6 +894,45 @@ void InstrumentLoopUtil::cleanupTmpFct(BasicBlock* instrHeader) {
 }
 
 
+// Polls yarn_dep_is_aborted on every back-edge of the loop so that a doomed epoch doesn't 
+// have to run a long inner loop to completion.
+void InstrumentLoopUtil::instrumentAbortPolls (const Loop* l, 
+					       Value* poolIdVal, 
+					       BasicBlock* abortExit) 
+{
+  // Gather the back-edges first since splitting the blocks changes the pred list.
+  std::vector<BasicBlock*> latchList;
+  for (pred_iterator it = pred_begin(l->getHeader()), itEnd = pred_end(l->getHeader()); 
+       it != itEnd; ++it)
+  {
+    if (l->contains(*it)) {
+      latchList.push_back(map<BasicBlock>::get(TmpVMap, *it));
+    }
+  }
+
+  for (size_t i = 0; i < latchList.size(); ++i) {
+    BasicBlock* latchBlock = latchList[i];
+    TerminatorInst* ti = latchBlock->getTerminator();
+
+    Value* isAborted = CallInst::Create(IMU->getYarnDepIsAbortedFct(), poolIdVal,
+					IMU->makeName(RET), ti);
+
+    // Move the old terminator into its own block and branch to it if we're not aborted.
+    BasicBlock* backEdgeBlock = 
+      latchBlock->splitBasicBlock(BasicBlock::iterator(ti), IMU->makeName(LABEL));
+    latchBlock->getTerminator()->eraseFromParent();
+    BranchInst::Create(abortExit, backEdgeBlock, isAborted, latchBlock);
+
+    assert(ti->getParent() == backEdgeBlock && "Split went sideways.");
+  }
+
+  const std::vector<Loop*>& subLoops = l->getSubLoops();
+  for (size_t i = 0; i < subLoops.size(); ++i) {
+    instrumentAbortPolls(subLoops[i], poolIdVal, abortExit);
+  }
+}
+
+
 void InstrumentLoopUtil::createNewFct() {
 
   // Create the final speculative function
@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+
+typedef uint_fast32_t word_t;
+
+
+// Keeps clang from inlining the call which would leave nothing for -yarn-call.
+//  No loops either since -yarn-loop would get to it first.
+__attribute__((noinline))
+void fill (word_t* a, word_t v) {
+  a[0] = v;
+  a[1] = v * v;
+  a[2] = v * v * v;
+}
+
+// The statement after the call is executed while fill is running.
+void work (word_t* a, word_t v, word_t* x, word_t* y) {
+  fill(a, v);
+  *x = *x + a[2] + *y;
+}
+
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing argument.\n");
+    return 1;
+  }
+
+  word_t v = strtol(argv[1], NULL, 10);
+
+  word_t a[3] = { 0, 0, 0 };
+  word_t x = 1;
+  word_t y = 2;
+
+  work(a, v, &x, &y);
+  printf("[%zu] x=%zu, expected=%zu\n", v, x, 1 + v*v*v + 2);
+
+  return 0;
+}